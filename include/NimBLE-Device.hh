@@ -11,7 +11,12 @@
 
 #include "NimBLEDevice.h"
 #include "freertos/FreeRTOS.h"
+#include "NimBLE-Device/Seqlock.hh"
+#include "NimBLE-Device/Router.hh"
+#include "NimBLE-Device/WriteQueue.hh"
+#include "NimBLE-Device/Watchdog.hh"
 
+#include <atomic>
 #include <functional>
 #include <cstdint>
 #include <string>
@@ -59,6 +64,26 @@ public:
     //
     static InterestingDevice* foundDevice(NimBLEAdvertisedDevice* dev);
 
+    //
+    // Account for a repeat of an advertisement already passed to foundDevice() (e.g. dropped by a duplicate filter),
+    // so the advertising rate of selection candidates is not underestimated.
+    // Returns a pointer to the device if it selected the advertiser, or NULL otherwise.
+    //
+    static InterestingDevice* repeatedDevice(NimBLEAdvertisedDevice* dev);
+
+    //
+    // When several advertisers match a wildcard device, collect them for 'windowMs' ms from the first one
+    // and use the best ranked one. An advertiser at least as strong as 'strongDbm' is used right away.
+    // No selection window if 'windowMs' is 0 (default): the first one found is used.
+    //
+    static void setSelectionWindow(long windowMs, int strongDbm = -50);
+
+    //
+    // Complete the selections whose window has expired, if no other advertisement did.
+    // To be called periodically while scanning. May run concurrently with foundDevice() and repeatedDevice().
+    //
+    static void serviceSelection(long nowInMs);
+
     //
     // Return all interesting devices, whether found or not.
     //
@@ -69,6 +94,12 @@ public:
     //
     static std::vector<InterestingDevice*> getFoundDevices();
 
+    //
+    // Return up to 'max' found interesting devices in the specified array, without allocating.
+    // Returns the number of devices returned.
+    //
+    static unsigned getFoundDevices(InterestingDevice* devs[], unsigned max);
+
     //
     // Return a pointer to an interesting device by given unique name (not BLE device name)
     // Returns NULL if the specified device does not exist.
@@ -97,7 +128,9 @@ public:
     bool wasFound();
 
     //
-    // Initialize all not-yet-initialized found devices, returning true if everything succeeded
+    // Initialize all not-yet-initialized found devices, returning true if everything succeeded.
+    // If the registry is open, known devices not yet found are connected to directly: those that
+    // cannot be are left to be found by a scan.
     //
     static bool initFoundDevices();
 
@@ -110,7 +143,98 @@ public:
     //
     // Returns true of the device is fully connected and ready to use
     //
-    bool isConnected();
+    virtual bool isConnected();
+
+    //
+    // Return the MAC address
+    //
+    const NimBLEAddress& getAddress() const;
+
+    //
+    // Returns true if no MAC address was specified: the first device with a matching name is used
+    //
+    bool isWildcard() const;
+
+    //
+    // A candidate advertiser for a wildcard device.
+    // The score is the average RSSI, plus 2dB for each advertisement per second (up to 10/sec).
+    //
+    struct Candidate {
+        NimBLEAddress addr;
+        int           rssi;
+        unsigned      adverts;
+        long          firstMs;
+        long          lastMs;
+        int           score;
+    };
+
+    //
+    // Return the candidates of the last selection, best ranked first
+    //
+    std::vector<Candidate> getCandidates();
+
+    //
+    // Synchronize the controller's filter accept list (white list) with the addresses of the
+    // not-yet-found devices. The pool owns the accept list: other addresses are removed.
+    // Returns true if the accept list can be used to scan, i.e. no not-yet-found device is a wildcard.
+    //
+    static bool syncWhiteList();
+
+    //
+    // Returns a number that changes whenever the set of not-yet-found devices changes
+    //
+    static uint32_t getPoolGeneration();
+
+    //
+    // Return the signal strength of the connection, in dBm, or 0 if not connected
+    //
+    int getRssi();
+
+    //
+    // Returns true if the BLE link is up, whether or not the device is initialized
+    //
+    bool isLinkUp();
+
+    //
+    // Returns true while a connection to the device is being established
+    //
+    bool isConnecting() const;
+
+    //
+    // Disconnect the device to free its connection, keeping its state.
+    // It is initialized again by the next initDevice(). Returns false if it was not connected.
+    //
+    bool park();
+
+    //
+    // Returns true if the device was disconnected by park()
+    //
+    bool isParked() const;
+
+    //
+    // State of the device
+    //
+    struct State {
+        bool found;
+        bool connected;     // The BLE connection was established
+        bool init;          // The device is initialized and ready to use
+        bool parked;
+    };
+
+    //
+    // Return a coherent snapshot of the state, without locking. Can be called from any task.
+    //
+    State getState() const;
+
+    //
+    // Return the notification routing statistics of the current connection
+    //
+    Router::Stats getNotificationStats() const;
+
+    //
+    // Return the write statistics of the specified class
+    //
+    WriteQueue::Stats getWriteStats(WriteQueue::Class_t cls) const;
 
     //
     // Subscribe to the battery level notifications (optional)
@@ -135,7 +259,7 @@ public:
     virtual void serviceLoop(long nowInMs) = 0;
 
     //
-    // Delete this device.
+    // Delete this device, removing it from the device pool.
     //
     virtual ~InterestingDevice();
 
@@ -143,12 +267,58 @@ public:
     // Delete all known interesting devices
     //
     static void reset();
+
+    //
+    // Emergency stop of all the devices that support it (e.g. Coyotes).
+    // Their queued writes are dropped and their power settings refused, then the connected ones are
+    // sent a zero-power write right away, from the calling task, without waiting for their next tick.
+    // They stay stopped until clearEmergencyStop(). Returns the number of devices sent the write.
+    //
+    static unsigned emergencyStop();
+    static void     clearEmergencyStop();
+    static bool     isEmergencyStopped();
+
+    struct StopStats {
+        unsigned long stops;
+        unsigned      devices;      // Devices sent the zero-power write by the last stop
+        unsigned      failed;       // Devices whose write failed
+        long          lastUs;       // Time from the call to the end of the last write, for the last stop
+        long          maxUs;
+    };
+
+    static StopStats getStopStats();
+
+    //
+    // Return the health watchdog, to change the expected heartbeats (see Watchdog)
+    //
+    Watchdog& getWatchdog();
+
+    //
+    // Check the heartbeats of this device and recover from the stalled ones.
+    // Done by serviceAllDevices() for all initialized devices, including those that opted out of it.
+    //
+    void checkHealth(long nowInMs);
     
 
 protected:
     NimBLEAdvertisedDevice* mDev;
     NimBLEClient*           mClient;
 
+    //
+    // Notifications of the current connection, to be subscribed to through the router
+    //
+    Router                  mRouter;
+
+    //
+    // Writes to the current connection, to be issued by a single writer (e.g. the transmit task)
+    //
+    WriteQueue              mWrites;
+
+    //
+    // Heartbeats of the device, checked by checkHealth()
+    //
+    Watchdog                mWatchdog;
+
     //
     // Create an interesting device with the given unique name, BLE device name, and MAC address
     //
@@ -159,6 +329,11 @@ protected:
     //
     void changeAddress(const char* macAddr);
 
+    //
+    // Forget that the device was found, so it can be found again by a scan after a disconnect
+    //
+    void rearm();
+
     //
     // Notify of an event
     //
@@ -172,6 +347,29 @@ protected:
     bool connect(bool refresh = true);
     virtual void doDisconnect();
 
+    //
+    // Emergency stop support (optional).
+    // latchStop() must not block, and returns false if not supported. sendStop() issues the zero-power write.
+    //
+    virtual bool latchStop()
+        {
+            return false;
+        }
+    virtual bool sendStop()
+        {
+            return false;
+        }
+    virtual void releaseStop()
+        {
+        }
+
+    //
+    // Recover from a stalled heartbeat, for the Watchdog::RESET action (optional)
+    //
+    virtual void resetHeartbeat(Watchdog::Heartbeat_t hb)
+        {
+        }
+
     //
     // For debugging: create an image of a byte string
     //
@@ -180,15 +378,35 @@ protected:
     
 private:
     static std::vector<InterestingDevice*> sAllDevices;
+    static uint32_t                        sGeneration;
+    static long                            sWindowMs;
+    static int                             sStrongDbm;
+    static bool                            sStopped;
+    static StopStats                       sStopStats;
     
     std::string         mUniqueName;
     std::string         mDeviceName;
     NimBLEAddress       mAddress;
+    bool                mWildcard;
     bool                mMustFind;
     bool                mFound;
     bool                mConnected;
+    std::atomic<bool>   mConnecting;
     bool                mInit;
     bool                mService;
+    bool                mWarm;
+    bool                mParked;
+    bool                mLatched;     // By emergencyStop()
+
+    static const unsigned sMaxCandidates = 4;
+
+    Candidate           mCandidates[sMaxCandidates];
+    unsigned            mNumCandidates;
+    bool                mSelecting;
+    long                mWindowEndMs;
+
+    Seqlock<State>      mState;
+    void                publishState();
 
     std::function<void(uint8_t)> mEventCb;
     std::function<void(uint8_t)> mBatteryCb;
@@ -196,6 +414,15 @@ private:
     bool doConnect(bool refresh, int attempt = 1);
     virtual bool doInitDevice() = 0;
 
+    void bind(const NimBLEAddress& addr, NimBLEAdvertisedDevice* dev);
+    bool       addCandidate(NimBLEAdvertisedDevice* dev, long nowInMs);
+    Candidate* updateCandidate(const NimBLEAddress& addr, int rssi, long nowInMs);
+    void rankCandidates();
+    bool selectCandidate(long nowInMs);
+
+    static bool inUse(const NimBLEAddress& addr);
+    static void warmStart();
+
     //
     // These are default implementations for NimBLE callbacks
     //
@@ -32,11 +32,7 @@ public:
 
     virtual ~Device();
 
-    bool doInitDevice()             override;
     void serviceLoop(long nowInMs)  override;
-
-private:
-    void notifyButton(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify);
 };
 
 }
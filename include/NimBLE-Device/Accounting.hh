@@ -0,0 +1,136 @@
+//
+// NimBLE-Device per-device memory and stack accounting
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device.hh"
+
+#include <cstddef>
+
+
+namespace NimBLE {
+
+//
+// Memory used by each interesting device, by subsystem:
+//
+//  - heap:        heap consumed by the last connection and initialization of the device
+//                 (NimBLE client, discovered attributes, subscriptions), measured as the drop in free heap.
+//                 Other tasks allocating at the same time skew the measurement.
+//  - containers:  bytes held in the library's containers (e.g. playlists) through Accounting::Allocator,
+//                 charged to the device whose Accounting::Scope is current when allocating.
+//  - attributes:  NimBLE client and remote attribute objects, counted after initialization.
+//  - stack:       size and high-water mark of the task servicing the device, if any.
+//
+// Allocations outside of any device scope are charged to the "(library)" account.
+//
+class Accounting
+{
+public:
+    static const unsigned MAX_ACCOUNTS = 16;
+
+    struct Usage {
+        const char* name;
+        size_t      heap;
+        size_t      containers;
+        size_t      containersPeak;
+        unsigned    services;
+        unsigned    characteristics;
+        unsigned    descriptors;
+        size_t      attributes;         // Estimated bytes of client and attribute objects
+        size_t      stackSize;
+        size_t      stackFree;          // Lowest amount of free stack so far
+    };
+
+    //
+    // Charge the allocations made by this thread to the specified device while in scope
+    //
+    class Scope
+    {
+    public:
+        Scope(const InterestingDevice& dev);
+        ~Scope();
+
+    private:
+        uint8_t mPrevious;
+    };
+
+    //
+    // Allocator for the library's containers
+    //
+    template<class T>
+    class Allocator
+    {
+    public:
+        typedef T value_type;
+
+        Allocator() noexcept
+            {}
+
+        template<class U>
+        Allocator(const Allocator<U>&) noexcept
+            {}
+
+        T* allocate(size_t n)
+            {
+                return (T*) Accounting::allocate(n * sizeof(T));
+            }
+
+        void deallocate(T* p, size_t n) noexcept
+            {
+                Accounting::deallocate(p, n * sizeof(T));
+            }
+
+        template<class U>
+        bool operator==(const Allocator<U>&) const noexcept
+            {
+                return true;
+            }
+
+        template<class U>
+        bool operator!=(const Allocator<U>&) const noexcept
+            {
+                return false;
+            }
+    };
+
+    //
+    // Return the free heap, to be passed to connected() once the device is initialized
+    //
+    static size_t freeHeap();
+
+    //
+    // Record the heap used to connect and initialize the device, and count its attributes
+    //
+    static void connected(const InterestingDevice& dev, NimBLEClient* client, size_t freeHeapBefore);
+
+    //
+    // Record the task servicing the device, and the size of its stack
+    //
+    static void trackTask(const InterestingDevice& dev, TaskHandle_t task, size_t stackSize);
+
+    //
+    // Fill up to 'max' entries with the usage of each account, "(library)" first.
+    // Returns the number of entries filled.
+    //
+    static unsigned report(Usage* usage, unsigned max);
+
+    //
+    // Return the usage summed over all accounts
+    //
+    static Usage total();
+
+    static void* allocate(size_t size);
+    static void  deallocate(void* p, size_t size) noexcept;
+};
+
+}
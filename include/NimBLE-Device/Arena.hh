@@ -0,0 +1,250 @@
+//
+// NimBLE-Device static allocation support
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+
+//
+// When CONFIG_NIMBLE_DEVICE_STATIC_ALLOC is defined (see Kconfig), channels, task stacks,
+// playlists and the device pool come from fixed-capacity storage sized at compile time,
+// and any heap allocation after Arena::seal() is counted as an error.
+//
+#ifndef CONFIG_NIMBLE_DEVICE_ARENA_SIZE
+#define CONFIG_NIMBLE_DEVICE_ARENA_SIZE  40960
+#endif
+
+#ifndef CONFIG_NIMBLE_DEVICE_MAX_DEVICES
+#define CONFIG_NIMBLE_DEVICE_MAX_DEVICES 8
+#endif
+
+#ifndef CONFIG_NIMBLE_DEVICE_MAX_STEPS
+#define CONFIG_NIMBLE_DEVICE_MAX_STEPS   64
+#endif
+
+#ifndef CONFIG_NIMBLE_DEVICE_MAX_QUEUE
+#define CONFIG_NIMBLE_DEVICE_MAX_QUEUE   4
+#endif
+
+
+namespace NimBLE {
+
+//
+// A vector with a fixed capacity of N elements, stored in place.
+// Only the subset of the std::vector API used in this library is provided.
+//
+template<class T, size_t N>
+class FixedVector
+{
+public:
+    FixedVector()
+        : mSize(0)
+        {}
+
+    FixedVector(const FixedVector& other)
+        : mSize(0)
+        {
+            for (const auto& it : other) push_back(it);
+        }
+
+    FixedVector& operator=(const FixedVector& other)
+        {
+            if (this == &other) return *this;
+            clear();
+            for (const auto& it : other) push_back(it);
+            return *this;
+        }
+
+    ~FixedVector()
+        {
+            clear();
+        }
+
+    size_t size() const      { return mSize; }
+    bool   empty() const     { return mSize == 0; }
+    size_t capacity() const  { return N; }
+    size_t max_size() const  { return N; }
+    void   reserve(size_t n) {}
+
+    T*       data()        { return (T*) mStore; }
+    const T* data() const  { return (const T*) mStore; }
+
+    T*       begin()       { return data(); }
+    T*       end()         { return data() + mSize; }
+    const T* begin() const { return data(); }
+    const T* end() const   { return data() + mSize; }
+
+    T&       operator[](size_t i)       { return data()[i]; }
+    const T& operator[](size_t i) const { return data()[i]; }
+
+    //
+    // Returns false if full
+    //
+    bool push_back(const T& val)
+        {
+            if (mSize == N) return false;
+            new (data() + mSize) T(val);
+            mSize++;
+            return true;
+        }
+
+    void clear()
+        {
+            while (mSize > 0) data()[--mSize].~T();
+        }
+
+private:
+    alignas(T) unsigned char mStore[N * sizeof(T)];
+    size_t                   mSize;
+};
+
+
+//
+// A double-ended queue with a fixed capacity of N elements, stored in place
+//
+template<class T, size_t N>
+class FixedDeque
+{
+public:
+    FixedDeque()
+        : mHead(0)
+        , mSize(0)
+        {}
+
+    FixedDeque(const FixedDeque&) = delete;
+    FixedDeque& operator=(const FixedDeque&) = delete;
+
+    ~FixedDeque()
+        {
+            clear();
+        }
+
+    size_t size() const      { return mSize; }
+    bool   empty() const     { return mSize == 0; }
+    size_t max_size() const  { return N; }
+
+    T& front() { return slot(0); }
+
+    //
+    // Returns false if full
+    //
+    bool push_back(T&& val)
+        {
+            if (mSize == N) return false;
+            new (&slot(mSize)) T(std::move(val));
+            mSize++;
+            return true;
+        }
+
+    void pop_front()
+        {
+            slot(0).~T();
+            mHead = (mHead + 1) % N;
+            mSize--;
+        }
+
+    void clear()
+        {
+            while (mSize > 0) pop_front();
+            mHead = 0;
+        }
+
+private:
+    alignas(T) unsigned char mStore[N * sizeof(T)];
+    size_t                   mHead;
+    size_t                   mSize;
+
+    T& slot(size_t i)
+        {
+            return ((T*) mStore)[(mHead + i) % N];
+        }
+};
+
+
+//
+// Storage for objects and task stacks that live as long as the application.
+//
+// With CONFIG_NIMBLE_DEVICE_STATIC_ALLOC, allocations come from a fixed-size arena and are never freed,
+// and tasks are created with static stacks. Otherwise, the heap is used.
+//
+class Arena
+{
+public:
+    //
+    // Allocate the specified number of bytes. Returns NULL if the arena is exhausted.
+    //
+    static void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    //
+    // Create and destroy an object
+    //
+    template<class T, class... ARGS>
+    static T* create(ARGS&&... args)
+        {
+#ifdef CONFIG_NIMBLE_DEVICE_STATIC_ALLOC
+            void* p = allocate(sizeof(T), alignof(T));
+            if (p == nullptr) return nullptr;
+            return new (p) T(std::forward<ARGS>(args)...);
+#else
+            return new T(std::forward<ARGS>(args)...);
+#endif
+        }
+
+    template<class T>
+    static void destroy(T* obj)
+        {
+            if (obj == nullptr) return;
+#ifdef CONFIG_NIMBLE_DEVICE_STATIC_ALLOC
+            obj->~T();
+#else
+            delete obj;
+#endif
+        }
+
+    //
+    // Create a task, pinned to the specified core if any. Returns false if it cannot be created.
+    //
+    static bool createTask(TaskFunction_t fct, const char* name, uint32_t stackSize, void* arg, UBaseType_t prio, TaskHandle_t* handle,
+                           BaseType_t core = tskNO_AFFINITY);
+
+    //
+    // Mark the end of the initialization: any heap allocation from now on is counted as an error.
+    //
+    static void seal();
+    static bool isSealed();
+
+    //
+    // Call the specified function on every heap allocation after seal().
+    // The function is called from the allocator and must not allocate.
+    //
+    static void subscribeLateAllocation(void (*fct)(size_t size));
+
+    struct Stats {
+        size_t        used;         // Bytes allocated from the arena
+        size_t        capacity;     // Size of the arena (0 if not using static allocation)
+        unsigned long exhausted;    // Allocations that did not fit in the arena
+        unsigned long late;         // Heap allocations after seal()
+        size_t        lateBytes;
+    };
+
+    static Stats getStats();
+};
+
+}
@@ -0,0 +1,113 @@
+//
+// NimBLE-Device sharing of a limited number of connections among the pool of devices
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device.hh"
+
+
+namespace NimBLE {
+
+//
+// Decide which found devices are connected when there are more than the controller can
+// connect to at the same time.
+//
+// ALWAYS devices (e.g. Coyotes) are kept connected. TIME_SLICED devices (e.g. iTags, buttons)
+// take turns in the remaining connections, each for a time slice. ON_DEMAND devices are only
+// connected when requested, and parked once idle. Parked devices keep their state and are
+// initialized again when they get a connection back.
+//
+class ConnectionBudget
+{
+public:
+    //
+    // Share the specified number of connections.
+    // Use a lower number than the controller supports to simulate a smaller controller.
+    //
+    ConnectionBudget(unsigned maxConnections = CONFIG_BT_NIMBLE_MAX_CONNECTIONS);
+    virtual ~ConnectionBudget();
+
+    typedef enum {ALWAYS, TIME_SLICED, ON_DEMAND} Priority_t;
+
+    //
+    // Manage the specified device with the specified priority
+    //
+    void add(InterestingDevice& dev, Priority_t prio);
+
+    //
+    // Time slice of TIME_SLICED devices, and how long ON_DEMAND devices remain connected after a request
+    //
+    void setSlices(long sliceMs = 10000, long idleMs = 5000);
+
+    //
+    // Connect the specified device as soon as possible, preempting TIME_SLICED devices if necessary
+    //
+    void request(InterestingDevice& dev);
+
+    //
+    // Connect, park and rotate devices. Connecting blocks until the device is initialized.
+    // To be called periodically.
+    //
+    void service(long nowInMs);
+
+    //
+    // Statistics per priority class.
+    // Latency is from the time a device needs a connection (request, or parked awaiting its turn) to its initialization.
+    //
+    struct Stats {
+        unsigned long connects;     // Successful connections
+        unsigned long failures;     // Failed connections
+        unsigned long parks;        // Devices parked to free a connection
+        long          avgLatencyMs;
+        long          maxLatencyMs;
+    };
+
+    Stats getStats(Priority_t prio);
+    void  resetStats();
+
+protected:
+    //
+    // Operations on the devices, overridden to simulate a controller
+    //
+    virtual bool devFound(InterestingDevice& dev);
+    virtual bool devLinkUp(InterestingDevice& dev);
+    virtual bool devConnected(InterestingDevice& dev);
+    virtual bool devParked(InterestingDevice& dev);
+    virtual bool devInit(InterestingDevice& dev);
+    virtual bool devPark(InterestingDevice& dev);
+
+private:
+    struct Member {
+        InterestingDevice* dev;
+        Priority_t         prio;
+        long               sinceMs;     // Connected: end of the time slice. Not connected: waiting since.
+        long               requestMs;   // Pending request (0 if none)
+    };
+
+    SemaphoreHandle_t   mMutex;
+    std::vector<Member> mMembers;
+    unsigned            mMax;
+    unsigned            mCursor;
+    long                mSliceMs;
+    long                mIdleMs;
+
+    Stats mStats[3];
+    long  mSumMs[3];
+
+    Member* find(InterestingDevice* dev);
+    bool    connect(Member& m, long nowInMs);
+    void    park(Member& m, long nowInMs);
+    bool    parkVictim(Member* except, long nowInMs);
+};
+
+}
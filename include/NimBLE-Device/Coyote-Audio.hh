@@ -0,0 +1,134 @@
+//
+// Audio-to-intensity streaming for Dungeon Labs Coyote channels
+//
+// WARNING: USE AT YOUR OWN RISK
+//
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device/Coyote-Generator.hh"
+
+#include <cstdio>
+
+
+namespace NimBLE {
+
+namespace COYOTE {
+
+//
+// Generator modulated by a stream of PCM audio samples (signed 16-bit, mono).
+//
+// The RMS level of every 25ms of audio (one V3 sub-slot) is mapped through a configurable
+// curve to an intensity and a pulse period. Only a bounded number of slots are buffered:
+// if audio is pushed faster than it is played, the oldest slots are dropped.
+//
+// Play it on a channel using Channel::setGenerator() or Channel::queueGenerator().
+//
+class AudioStream : public Generator
+{
+public:
+    //
+    // An audio stream at the specified sample rate, buffering up to 'maxSlots' slots of 'slotMs' ms
+    //
+    AudioStream(unsigned sampleRate, unsigned maxSlots = 16, unsigned slotMs = 25);
+
+    virtual ~AudioStream();
+
+    //
+    // Set the curve mapping the RMS level (0..255) to an intensity (0..100).
+    // Default is linear, with levels below 8 muted.
+    //
+    void setCurve(const uint8_t curve[256]);
+
+    //
+    // Set the pulse period, in ms, used at the lowest and highest levels.
+    // Default is 100ms for silence down to 10ms for full scale.
+    //
+    void setPeriod(uint16_t quiet, uint16_t loud);
+
+    //
+    // Push a block of PCM samples. May be called from any thread.
+    // Returns the number of samples consumed (always 'n').
+    //
+    size_t push(const int16_t* pcm, size_t n);
+
+    //
+    // Push up to 'maxSamples' PCM samples read from a raw PCM file, without overflowing
+    // the slot buffer. Returns the number of samples read, 0 at end of file.
+    //
+    size_t push(FILE* fp, size_t maxSamples = 4096);
+
+    //
+    // Returns the number of slots that can still be buffered
+    //
+    unsigned room();
+
+    //
+    // Streaming statistics
+    //
+    struct Stats {
+        unsigned long samples;        // Samples processed
+        unsigned long processUs;      // Time spent processing samples, in us
+        unsigned long slots;          // Slots computed
+        unsigned long played;         // Slots played
+        unsigned long overruns;       // Slots dropped because the buffer was full
+        unsigned long underruns;      // Ticks played with no slot available
+        long          latencyMs;      // Audio-to-frame latency of the last slot played
+        long          maxLatencyMs;   // Worst audio-to-frame latency
+
+        //
+        // Samples processed per second of processing time
+        //
+        unsigned long samplesPerSec() const
+        {
+            return (processUs) ? (uint64_t) samples * 1000000 / processUs : 0;
+        }
+    };
+
+    Stats getStats();
+    void  resetStats();
+
+    //
+    // Generator interface
+    //
+    virtual void reset() override;
+    virtual bool next(unsigned tickMs, Sample& s) override;
+
+    //
+    // Compute the RMS level (0..255) of a block of samples
+    //
+    static uint8_t level(const int16_t* pcm, size_t n);
+
+private:
+    struct Slot {
+        uint8_t  level;
+        long     stamp;
+    };
+
+    SemaphoreHandle_t mMutex;
+    unsigned          mSlotLen;
+    unsigned          mSlotMs;
+    uint8_t           mCurve[256];
+    uint16_t          mQuiet;
+    uint16_t          mLoud;
+
+    std::vector<int16_t> mPartial;
+    std::vector<Slot>    mRing;
+    unsigned             mHead;
+    unsigned             mCount;
+    Stats                mStats;
+
+    void addSlot(uint8_t level, long stamp);
+};
+
+}
+}
@@ -0,0 +1,132 @@
+//
+// Bind button and keyboard input to Dungeon Labs Coyote controls
+//
+// WARNING: USE AT YOUR OWN RISK
+//
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device/Coyote.hh"
+#include "NimBLE-Device/Keyboard.hh"
+
+
+namespace NimBLE {
+
+namespace COYOTE {
+
+//
+// A table of bindings from input (device, key, event or gesture) to Coyote channel actions.
+//
+// Bindings are kept sorted in a flat table, looked up and executed directly in the input
+// notification path. The latency from the input to the end of the write of the next frame
+// on the affected devices is measured.
+//
+// The table subscribes to its input devices: it must remain in existence as long as they do.
+//
+class Bindings
+{
+public:
+    Bindings();
+    ~Bindings();
+
+    //
+    // What triggers a binding: a key event, or a gesture
+    //
+    typedef enum {PRESS, RELEASE, TAP, DOUBLE_TAP, LONG_PRESS, REPEAT, CHORD} Trigger_t;
+
+    //
+    // What a binding does to its channel.
+    // EMERGENCY_STOP stops all the devices (see InterestingDevice::emergencyStop()) and the channels in the table.
+    //
+    typedef enum {INCREMENT_POWER, SET_POWER, START, STOP, EMERGENCY_STOP} Action_t;
+
+    //
+    // Bind a trigger on a key of the specified input device to an action on the specified channel.
+    // 'arg' is the power increment (INCREMENT_POWER), the power (SET_POWER), or the duration in secs (START).
+    // For CHORD, the key is the chord identifier. A trigger can have multiple bindings, executed in order.
+    // Returns false if the binding is invalid.
+    //
+    bool bind(Keyboard::Device& input, uint8_t key, Trigger_t trigger, Channel& ch, Action_t action, int arg = 0);
+
+    //
+    // Bind a trigger to switching to the specified waveform, at the specified power (current power if 0)
+    //
+    bool bind(Keyboard::Device& input, uint8_t key, Trigger_t trigger, Channel& ch, const V2::Waveform& wave, uint8_t power = 0);
+    bool bind(Keyboard::Device& input, uint8_t key, Trigger_t trigger, Channel& ch, const V3::Waveform& wave, uint8_t power = 0);
+
+    //
+    // Bind a trigger to an arbitrary function
+    //
+    bool bind(Keyboard::Device& input, uint8_t key, Trigger_t trigger, std::function<void()> fct);
+
+    //
+    // Remove all bindings for the specified trigger
+    //
+    void unbind(Keyboard::Device& input, uint8_t key, Trigger_t trigger);
+
+    //
+    // Stop all the devices, latching their power at 0 until InterestingDevice::clearEmergencyStop(),
+    // and stop all the bound channels
+    //
+    void emergencyStop();
+
+    //
+    // Dispatch and latency statistics, in ms.
+    // The input-to-frame latency includes waiting for the next 100ms transmit tick.
+    //
+    struct Stats {
+        unsigned long dispatched;   // Inputs that matched at least one binding
+        unsigned long actions;      // Actions executed
+        unsigned long unbound;      // Inputs that did not match any binding
+        unsigned long measured;     // Input-to-frame latency measurements
+        long          lastMs;
+        long          minMs;
+        long          maxMs;
+        long          avgMs;
+    };
+
+    Stats getStats();
+    void  resetStats();
+
+private:
+    typedef enum {POWER_INC, POWER_SET, WAVE_V2, WAVE_V3, PLAY, HALT, ESTOP, CALL} Op_t;
+
+    //
+    // One dispatch table entry, sorted by key: input index (16 bits), key (8 bits), trigger (8 bits)
+    //
+    struct Binding {
+        uint32_t key;
+        Op_t     op;
+        Channel* ch;
+        int      arg;
+        unsigned idx;       // Index in the waveform or function table
+    };
+
+    SemaphoreHandle_t                  mMutex;
+    std::vector<Keyboard::Device*>     mInputs;
+    std::vector<Device*>               mDevices;
+    std::vector<Binding>               mTable;
+    std::vector<V2::Waveform>          mV2Waves;
+    std::vector<V3::Waveform>          mV3Waves;
+    std::vector<std::function<void()>> mFcts;
+    Stats                              mStats;
+    long                               mSumMs;
+
+    bool add(Keyboard::Device& input, uint8_t key, Trigger_t trigger, Channel* ch, Op_t op, int arg, unsigned idx = 0);
+    int  inputIdx(Keyboard::Device& input);
+    void dispatch(unsigned idx, uint8_t key, Trigger_t trigger);
+    void execute(const Binding& b, long nowInMs);
+    void latency(long ms);
+};
+
+}
+}
@@ -0,0 +1,334 @@
+//
+// Wire encoding and decoding of Dungeon Labs Coyote V2 and V3 messages
+//
+// WARNING: USE AT YOUR OWN RISK
+//
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+//
+// All encoders write into a caller-provided buffer and return the number of bytes written,
+// or 0 if the buffer is too small. All decoders return false if the message is too short or
+// is not of the expected type. Bits are packed explicitly: nothing depends on the compiler's
+// bitfield layout or on the host byte order.
+//
+
+namespace NimBLE {
+
+namespace COYOTE {
+
+namespace CODEC {
+
+//
+// Little-endian 24-bit values, as used by all V2 messages
+//
+constexpr void
+putLE24(uint8_t* buf, uint32_t val)
+{
+    buf[0] = val;
+    buf[1] = val >> 8;
+    buf[2] = val >> 16;
+}
+
+constexpr uint32_t
+getLE24(const uint8_t* buf)
+{
+    return buf[0] | (buf[1] << 8) | ((uint32_t) buf[2] << 16);
+}
+
+
+namespace V2 {
+
+//
+// Waveform segment: X (5 bits), Y (10 bits), Z (5 bits)
+//
+struct Wave {
+    uint8_t  x;
+    uint16_t y;
+    uint8_t  z;
+};
+
+constexpr size_t WaveLen = 3;
+
+constexpr size_t
+encode(const Wave& m, uint8_t* buf, size_t len)
+{
+    if (len < WaveLen) return 0;
+    putLE24(buf, (m.x & 0x1F) | ((m.y & 0x3FF) << 5) | ((uint32_t) (m.z & 0x1F) << 15));
+    return WaveLen;
+}
+
+constexpr bool
+decode(const uint8_t* buf, size_t len, Wave& m)
+{
+    if (len < WaveLen) return false;
+    uint32_t v = getLE24(buf);
+    m.x = v & 0x1F;
+    m.y = (v >> 5) & 0x3FF;
+    m.z = (v >> 15) & 0x1F;
+    return true;
+}
+
+
+//
+// Power levels: B (11 bits), A (11 bits)
+//
+struct Power {
+    uint16_t A;
+    uint16_t B;
+};
+
+constexpr size_t PowerLen = 3;
+
+constexpr size_t
+encode(const Power& m, uint8_t* buf, size_t len)
+{
+    if (len < PowerLen) return 0;
+    putLE24(buf, (m.B & 0x7FF) | ((uint32_t) (m.A & 0x7FF) << 11));
+    return PowerLen;
+}
+
+constexpr bool
+decode(const uint8_t* buf, size_t len, Power& m)
+{
+    if (len < PowerLen) return false;
+    uint32_t v = getLE24(buf);
+    m.B = v & 0x7FF;
+    m.A = (v >> 11) & 0x7FF;
+    return true;
+}
+
+
+//
+// Power configuration: step (8 bits), max power (11 bits)
+//
+struct Config {
+    uint8_t  step;
+    uint16_t maxPwr;
+};
+
+constexpr size_t ConfigLen = 3;
+
+constexpr size_t
+encode(const Config& m, uint8_t* buf, size_t len)
+{
+    if (len < ConfigLen) return 0;
+    putLE24(buf, m.step | ((uint32_t) (m.maxPwr & 0x7FF) << 8));
+    return ConfigLen;
+}
+
+constexpr bool
+decode(const uint8_t* buf, size_t len, Config& m)
+{
+    if (len < ConfigLen) return false;
+    uint32_t v = getLE24(buf);
+    m.step   = v & 0xFF;
+    m.maxPwr = (v >> 8) & 0x7FF;
+    return true;
+}
+
+}  // CODEC::V2
+
+
+namespace V3 {
+
+//
+// Power change modes
+//
+enum PowerMode {NONE = 0, INCREMENT = 1, DECREMENT = 2, ABSOLUTE = 3};
+
+//
+// B0: power update and 100ms of waveform (4 x 25ms) for both channels
+//
+struct B0 {
+    uint8_t serial;       // 0..15
+    uint8_t modeA;
+    uint8_t modeB;
+    uint8_t powA;
+    uint8_t powB;
+    uint8_t freqA[4];
+    uint8_t intA[4];
+    uint8_t freqB[4];
+    uint8_t intB[4];
+};
+
+constexpr size_t B0Len = 20;
+
+constexpr size_t
+encode(const B0& m, uint8_t* buf, size_t len)
+{
+    if (len < B0Len) return 0;
+    buf[0] = 0xB0;
+    buf[1] = ((m.serial & 0x0F) << 4) | ((m.modeA & 0x03) << 2) | (m.modeB & 0x03);
+    buf[2] = m.powA;
+    buf[3] = m.powB;
+    for (unsigned i = 0; i < 4; i++) {
+        buf[ 4 + i] = m.freqA[i];
+        buf[ 8 + i] = m.intA[i];
+        buf[12 + i] = m.freqB[i];
+        buf[16 + i] = m.intB[i];
+    }
+    return B0Len;
+}
+
+constexpr bool
+decode(const uint8_t* buf, size_t len, B0& m)
+{
+    if (len < B0Len || buf[0] != 0xB0) return false;
+    m.serial = buf[1] >> 4;
+    m.modeA  = (buf[1] >> 2) & 0x03;
+    m.modeB  = buf[1] & 0x03;
+    m.powA   = buf[2];
+    m.powB   = buf[3];
+    for (unsigned i = 0; i < 4; i++) {
+        m.freqA[i] = buf[ 4 + i];
+        m.intA[i]  = buf[ 8 + i];
+        m.freqB[i] = buf[12 + i];
+        m.intB[i]  = buf[16 + i];
+    }
+    return true;
+}
+
+
+//
+// B1: power update acknowledgement
+//
+struct B1 {
+    uint8_t serial;
+    uint8_t powA;
+    uint8_t powB;
+};
+
+constexpr size_t B1Len = 4;
+
+constexpr size_t
+encode(const B1& m, uint8_t* buf, size_t len)
+{
+    if (len < B1Len) return 0;
+    buf[0] = 0xB1;
+    buf[1] = m.serial;
+    buf[2] = m.powA;
+    buf[3] = m.powB;
+    return B1Len;
+}
+
+constexpr bool
+decode(const uint8_t* buf, size_t len, B1& m)
+{
+    if (len < B1Len || buf[0] != 0xB1) return false;
+    m.serial = buf[1];
+    m.powA   = buf[2];
+    m.powB   = buf[3];
+    return true;
+}
+
+
+//
+// BF: set power limits and balance parameters. BE: the same, as reported by the device
+//
+struct Limits {
+    uint8_t limitA;
+    uint8_t limitB;
+    uint8_t freqBalA;
+    uint8_t freqBalB;
+    uint8_t intBalA;
+    uint8_t intBalB;
+};
+
+constexpr size_t LimitsLen = 7;
+
+constexpr size_t
+encode(const Limits& m, uint8_t* buf, size_t len, uint8_t op = 0xBF)
+{
+    if (len < LimitsLen) return 0;
+    buf[0] = op;
+    buf[1] = m.limitA;
+    buf[2] = m.limitB;
+    buf[3] = m.freqBalA;
+    buf[4] = m.freqBalB;
+    buf[5] = m.intBalA;
+    buf[6] = m.intBalB;
+    return LimitsLen;
+}
+
+constexpr bool
+decode(const uint8_t* buf, size_t len, Limits& m, uint8_t op = 0xBE)
+{
+    if (len < LimitsLen || buf[0] != op) return false;
+    m.limitA   = buf[1];
+    m.limitB   = buf[2];
+    m.freqBalA = buf[3];
+    m.freqBalB = buf[4];
+    m.intBalA  = buf[5];
+    m.intBalB  = buf[6];
+    return true;
+}
+
+}  // CODEC::V3
+
+
+//
+// Compile-time round-trip checks
+//
+namespace CHECK {
+
+constexpr bool
+wave(uint8_t x, uint16_t y, uint8_t z)
+{
+    uint8_t  buf[V2::WaveLen] = {};
+    V2::Wave m = {};
+    return V2::encode(V2::Wave{x, y, z}, buf, sizeof(buf)) == V2::WaveLen &&
+           V2::decode(buf, sizeof(buf), m) && m.x == x && m.y == y && m.z == z;
+}
+
+constexpr bool
+power(uint16_t a, uint16_t b)
+{
+    uint8_t   buf[V2::PowerLen] = {};
+    V2::Power m = {};
+    return V2::encode(V2::Power{a, b}, buf, sizeof(buf)) == V2::PowerLen &&
+           V2::decode(buf, sizeof(buf), m) && m.A == a && m.B == b;
+}
+
+constexpr bool
+b0(uint8_t serial, uint8_t powA, uint8_t powB)
+{
+    uint8_t buf[V3::B0Len] = {};
+    V3::B0  m = {};
+    return V3::encode(V3::B0{serial, V3::ABSOLUTE, V3::NONE, powA, powB, {10, 20, 30, 40}, {0, 50, 100, 0}, {}, {}}, buf, sizeof(buf)) == V3::B0Len &&
+           V3::decode(buf, sizeof(buf), m) && m.serial == serial && m.modeA == V3::ABSOLUTE && m.modeB == V3::NONE &&
+           m.powA == powA && m.powB == powB && m.freqA[3] == 40 && m.intA[2] == 100;
+}
+
+// Snooped V2 waveform bytes {0xE1, 0x03, 0x0A} are X=1, Y=31, Z=20
+constexpr bool
+snooped()
+{
+    uint8_t  buf[V2::WaveLen] = {0xE1, 0x03, 0x0A};
+    V2::Wave m = {};
+    return V2::decode(buf, sizeof(buf), m) && m.x == 1 && m.y == 31 && m.z == 20;
+}
+
+static_assert(wave(31, 1023, 31) && wave(1, 9, 16) && wave(0, 0, 0), "V2 waveform codec");
+static_assert(power(2047, 0) && power(0, 2047) && power(1234, 567), "V2 power codec");
+static_assert(b0(15, 200, 0) && b0(1, 0, 200), "V3 B0 codec");
+
+static_assert(snooped(), "V2 waveform layout");
+
+}
+
+}
+}
+}
@@ -0,0 +1,328 @@
+//
+// Procedural waveform generators for Dungeon Labs Coyote channels
+//
+// WARNING: USE AT YOUR OWN RISK
+//
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device/Coyote.hh"
+
+#include <array>
+
+
+namespace NimBLE {
+
+namespace COYOTE {
+
+//
+// Base class for waveforms computed one tick at a time, instead of being stored as a
+// sequence of waveform segments. A generator uses the same amount of memory no matter
+// how long it plays.
+//
+// A generator must remain valid for as long as it is queued on or playing on a channel.
+//
+class Generator
+{
+public:
+    //
+    // One generated tick: pulse period, in ms (10..1000) and intensity (0..100)
+    //
+    struct Sample {
+        uint16_t period;
+        uint8_t  intensity;
+    };
+
+    virtual ~Generator()
+    {}
+
+    //
+    // Restart the generator from the beginning
+    //
+    virtual void reset() = 0;
+
+    //
+    // Compute the sample for the next tick, 'tickMs' ms long.
+    // Returns false if the generator has nothing more to play.
+    //
+    virtual bool next(unsigned tickMs, Sample& s) = 0;
+
+    //
+    // Encode a sample as a V2 or V3 waveform segment
+    //
+    template<class VAL>
+    static VAL encode(const Sample& s);
+};
+
+
+template<>
+inline V2::WaveVal
+Generator::encode<V2::WaveVal>(const Sample& s)
+{
+    uint16_t period = s.period;
+
+    if (period <   10) period = 10;
+    if (period > 1000) period = 1000;
+
+    return V2::WaveVal(1, period - 1, ((s.intensity > 100) ? 100 : s.intensity) / 5);
+}
+
+
+template<>
+inline V3::WaveVal
+Generator::encode<V3::WaveVal>(const Sample& s)
+{
+    return V3::WaveVal(V3::WaveVal(encode<V2::WaveVal>(s)).getFreq(), s.intensity);
+}
+
+
+namespace GENERATORS {
+
+//
+// Waveform shapes, returning a level (0..255) for a phase (0..255)
+//
+struct Sine {
+    static constexpr std::array<uint8_t, 256> table()
+    {
+        // Bhaskara I's approximation of sin() over [0, PI], mirrored for [PI, 2*PI]
+        std::array<uint8_t, 256> t{};
+        for (int i = 0; i < 256; i++) {
+            int x = (i & 0x7F) * 180 / 128;
+            int s = 4 * x * (180 - x) * 1000 / (40500 - x * (180 - x));
+            t[i] = (i < 128) ? 128 + s * 127 / 1000 : 128 - s * 128 / 1000;
+        }
+        return t;
+    }
+
+    static uint8_t at(uint8_t phase)
+    {
+        static constexpr std::array<uint8_t, 256> sTable = table();
+        return sTable[phase];
+    }
+};
+
+struct Triangle {
+    static constexpr uint8_t at(uint8_t phase)
+    {
+        return (phase < 128) ? phase * 2 : (255 - phase) * 2;
+    }
+};
+
+struct Square {
+    static constexpr uint8_t at(uint8_t phase)
+    {
+        return (phase < 128) ? 255 : 0;
+    }
+};
+
+struct Ramp {
+    static constexpr uint8_t at(uint8_t phase)
+    {
+        return phase;
+    }
+};
+
+
+//
+// Intensity modulated between 'minInt' and 'maxInt' following SHAPE, with a cycle of 'cycleMs' ms,
+// at a fixed pulse period
+//
+template<class SHAPE>
+class Periodic : public Generator
+{
+public:
+    Periodic(unsigned cycleMs, uint8_t minInt, uint8_t maxInt, uint16_t period = 10)
+        : mCycle((cycleMs) ? cycleMs : 1)
+        , mMin(minInt)
+        , mMax(maxInt)
+        , mPeriod(period)
+        , mNow(0)
+        {}
+
+    virtual void reset() override
+        {
+            mNow = 0;
+        }
+
+    virtual bool next(unsigned tickMs, Sample& s) override
+        {
+            uint8_t level = SHAPE::at(mNow * 256 / mCycle);
+
+            s.period    = mPeriod;
+            s.intensity = mMin + (mMax - mMin) * level / 255;
+
+            mNow = (mNow + tickMs) % mCycle;
+
+            return true;
+        }
+
+private:
+    uint32_t mCycle;
+    int      mMin;
+    int      mMax;
+    uint16_t mPeriod;
+    uint32_t mNow;
+};
+
+typedef Periodic<Sine>     SineWave;
+typedef Periodic<Triangle> TriangleWave;
+typedef Periodic<Square>   SquareWave;
+
+
+//
+// Pulse period swept between 'fromPeriod' and 'toPeriod' ms following SHAPE, with a cycle of 'cycleMs' ms,
+// at a fixed intensity. Plays a single cycle unless 'loop' is true.
+//
+template<class SHAPE>
+class Sweep : public Generator
+{
+public:
+    Sweep(unsigned cycleMs, uint16_t fromPeriod, uint16_t toPeriod, uint8_t intensity, bool loop = true)
+        : mCycle((cycleMs) ? cycleMs : 1)
+        , mFrom(fromPeriod)
+        , mTo(toPeriod)
+        , mIntensity(intensity)
+        , mLoop(loop)
+        , mNow(0)
+        {}
+
+    virtual void reset() override
+        {
+            mNow = 0;
+        }
+
+    virtual bool next(unsigned tickMs, Sample& s) override
+        {
+            if (mNow >= mCycle) {
+                if (!mLoop) return false;
+                mNow %= mCycle;
+            }
+
+            uint8_t level = SHAPE::at(mNow * 256 / mCycle);
+
+            s.period    = mFrom + (mTo - mFrom) * level / 255;
+            s.intensity = mIntensity;
+
+            mNow += tickMs;
+
+            return true;
+        }
+
+private:
+    uint32_t mCycle;
+    int      mFrom;
+    int      mTo;
+    uint8_t  mIntensity;
+    bool     mLoop;
+    uint32_t mNow;
+};
+
+typedef Sweep<Sine>     SineSweep;
+typedef Sweep<Ramp>     RampSweep;
+
+
+//
+// Pseudo-random number generator (xorshift32)
+//
+struct XorShift32 {
+    uint32_t state;
+
+    XorShift32(uint32_t seed)
+        : state((seed) ? seed : 0x2545F491)
+        {}
+
+    uint32_t operator()()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+
+//
+// Bursts of random length (onMin..onMax ms) and intensity (minInt..maxInt) separated by random gaps
+// (offMin..offMax ms). The same seed always generates the same sequence.
+//
+template<class RNG = XorShift32>
+class RandomBurst : public Generator
+{
+public:
+    RandomBurst(uint32_t seed, unsigned onMin, unsigned onMax, unsigned offMin, unsigned offMax,
+                uint8_t minInt, uint8_t maxInt, uint16_t period = 10)
+        : mSeed(seed)
+        , mOnMin(onMin)
+        , mOnMax((onMax > onMin) ? onMax : onMin)
+        , mOffMin(offMin)
+        , mOffMax((offMax > offMin) ? offMax : offMin)
+        , mMin(minInt)
+        , mMax((maxInt > minInt) ? maxInt : minInt)
+        , mPeriod(period)
+        , mRng(seed)
+        , mOn(false)
+        , mLeft(0)
+        , mIntensity(0)
+        {}
+
+    virtual void reset() override
+        {
+            mRng  = RNG(mSeed);
+            mOn   = false;
+            mLeft = 0;
+        }
+
+    virtual bool next(unsigned tickMs, Sample& s) override
+        {
+            while (mLeft < tickMs) {
+                mOn = !mOn;
+                if (mOn) {
+                    mLeft      += random(mOnMin, mOnMax);
+                    mIntensity  = random(mMin, mMax);
+                } else {
+                    mLeft      += random(mOffMin, mOffMax);
+                }
+                // Avoid spinning on zero-length bursts and gaps
+                if (mLeft == 0) mLeft = tickMs;
+            }
+            mLeft -= tickMs;
+
+            s.period    = mPeriod;
+            s.intensity = (mOn) ? mIntensity : 0;
+
+            return true;
+        }
+
+private:
+    uint32_t random(uint32_t lo, uint32_t hi)
+        {
+            return lo + mRng() % (hi - lo + 1);
+        }
+
+    uint32_t mSeed;
+    unsigned mOnMin;
+    unsigned mOnMax;
+    unsigned mOffMin;
+    unsigned mOffMax;
+    uint8_t  mMin;
+    uint8_t  mMax;
+    uint16_t mPeriod;
+    RNG      mRng;
+    bool     mOn;
+    uint32_t mLeft;
+    uint8_t  mIntensity;
+};
+
+}
+
+}
+}
@@ -0,0 +1,345 @@
+//
+// Playlist sequencer for Dungeon Labs Coyote channels
+//
+// WARNING: USE AT YOUR OWN RISK
+//
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device/Coyote.hh"
+#include "NimBLE-Device/Coyote-Generator.hh"
+#include "NimBLE-Device/Arena.hh"
+#include "NimBLE-Device/Accounting.hh"
+
+#include <deque>
+#include <optional>
+
+
+namespace NimBLE {
+
+namespace COYOTE {
+
+//
+// Sequence of playlist entries, played one tick at a time.
+//
+// Waveforms are compiled into (segment, number of ticks) steps when they are queued,
+// so that moving from one entry to the next in the transmit loop is a simple move.
+// Generators are instead pulled from one tick at a time.
+// Transitions always happen on a tick boundary: the tick following the last tick of an entry
+// is the first tick of the next entry.
+//
+// With CONFIG_NIMBLE_DEVICE_STATIC_ALLOC, waveforms and the playlist are stored in place,
+// up to CONFIG_NIMBLE_DEVICE_MAX_STEPS steps and CONFIG_NIMBLE_DEVICE_MAX_QUEUE entries.
+// Otherwise, they are allocated on the heap and charged to the current Accounting::Scope.
+//
+// Not thread-safe: callers must hold the channel mutex.
+//
+template<class VAL>
+class Sequencer
+{
+public:
+    struct Step {
+        VAL      val;
+        uint32_t ticks;
+    };
+
+#ifdef CONFIG_NIMBLE_DEVICE_STATIC_ALLOC
+    typedef FixedVector<Step, CONFIG_NIMBLE_DEVICE_MAX_STEPS> Steps;
+#else
+    typedef std::vector<Step, Accounting::Allocator<Step>> Steps;
+#endif
+
+    struct Entry {
+        Steps             steps;
+        Generator*        gen;     // Generator to pull from instead of 'steps'
+        std::optional<VAL> out;    // Last segment pulled from 'gen'
+        uint8_t           power;   // Power to set when the entry starts (0 to keep current power)
+        unsigned          loops;   // Number of times to play the waveform (0 for no limit)
+        unsigned long     ticks;   // Number of ticks to play the waveform (0 for no limit)
+        unsigned          fade;    // Number of ticks to crossfade from the previous entry
+    };
+
+    //
+    // A sequencer called every 'tickMs' ms
+    //
+    Sequencer(unsigned tickMs)
+        : mTickMs(tickMs)
+        , mQueue()
+        , mCurrent()
+        , mPrevious()
+        , mHave(false)
+        , mCursor()
+        , mPrevCursor()
+        , mFadeLeft(0)
+        , mMixed()
+        , mPower(0)
+        , mLimit(0)
+        , mPlayed(0)
+        {}
+
+    //
+    // Compile a waveform into a playlist entry.
+    // Durations are in ms. If both 'ms' and 'loops' are 0, the entry loops until
+    // another entry is queued, then hands over at the end of the current pass.
+    // Returns false if the waveform is empty or too long.
+    //
+    template<class WAVE>
+    bool compile(Entry& e, const WAVE& wave, uint8_t power, long ms, unsigned loops, long fadeMs) const
+        {
+            e.steps.clear();
+            if (wave.size() > e.steps.max_size()) return false;
+
+            e.steps.reserve(wave.size());
+            for (const auto& it : wave) {
+                VAL      val(it);
+                uint32_t n = (((val.duration() - 1) / 100) + 1) * val.getRepeat();
+
+                if (n == 0) continue;
+                e.steps.push_back({val, n});
+            }
+            e.gen   = nullptr;
+            e.power = power;
+            e.loops = loops;
+            e.ticks = (ms > 0) ? (ms + mTickMs - 1) / mTickMs : 0;
+            e.fade  = (fadeMs > 0) ? fadeMs / mTickMs : 0;
+
+            return e.steps.size() > 0;
+        }
+
+    //
+    // Make a playlist entry out of a generator, to be played for the specified number of ms.
+    // If 'ms' is 0, the entry plays until the generator ends or until another entry is queued.
+    //
+    void compile(Entry& e, Generator& gen, uint8_t power, long ms, long fadeMs) const
+        {
+            e.steps.clear();
+            e.gen   = &gen;
+            e.power = power;
+            e.loops = 0;
+            e.ticks = (ms > 0) ? (ms + mTickMs - 1) / mTickMs : 0;
+            e.fade  = (fadeMs > 0) ? fadeMs / mTickMs : 0;
+        }
+
+    //
+    // Append an entry to the playlist. Returns false if the playlist is full.
+    //
+    bool push(Entry&& e)
+        {
+            if (mQueue.size() >= mQueue.max_size()) return false;
+            mQueue.push_back(std::move(e));
+            return true;
+        }
+
+    //
+    // Drop all entries and play the specified one right away
+    //
+    void replace(Entry&& e)
+        {
+            mQueue.clear();
+            mCurrent  = std::move(e);
+            mCurrent.fade = 0;
+            mHave     = true;
+            mCursor   = start(mCurrent);
+            mFadeLeft = 0;
+            mPower    = 0;
+        }
+
+    //
+    // Drop all entries, including the one currently playing
+    //
+    void clear()
+        {
+            mQueue.clear();
+            mHave     = false;
+            mFadeLeft = 0;
+            mPower    = 0;
+        }
+
+    //
+    // Returns true if there is nothing to play
+    //
+    bool empty() const
+        {
+            return !mHave && mQueue.empty();
+        }
+
+    //
+    // Number of entries waiting to be played
+    //
+    size_t pending() const
+        {
+            return mQueue.size();
+        }
+
+    //
+    // Restart the current entry from the beginning and play for the specified number of ms (forever if 0)
+    //
+    void restart(long ms)
+        {
+            if (mHave) mCursor = start(mCurrent);
+            mFadeLeft = 0;
+            mLimit    = (ms > 0) ? (ms + mTickMs - 1) / mTickMs : 0;
+            mPlayed   = 0;
+        }
+
+    //
+    // Returns true if the play time specified in restart() has elapsed
+    //
+    bool expired() const
+        {
+            return mLimit != 0 && mPlayed >= mLimit;
+        }
+
+    //
+    // Return the segment to play in this tick, or NULL if there is nothing to play
+    //
+    const VAL* next()
+        {
+            if (expired()) return nullptr;
+
+            const VAL* val = (mHave) ? step(mCursor, mCurrent, !mQueue.empty()) : nullptr;
+            while (val == nullptr) {
+                if (mQueue.empty()) {
+                    mHave = false;
+                    return nullptr;
+                }
+
+                mFadeLeft = 0;
+                if (mHave && mQueue.front().fade) {
+                    mPrevious   = std::move(mCurrent);
+                    mPrevCursor = mCursor;
+                    mFadeLeft   = mQueue.front().fade;
+                }
+                mCurrent = std::move(mQueue.front());
+                mQueue.pop_front();
+                mHave    = true;
+                mCursor  = start(mCurrent);
+                mPower   = mCurrent.power;
+
+                val = step(mCursor, mCurrent, !mQueue.empty());
+            }
+            mPlayed++;
+
+            if (mFadeLeft) {
+                auto from = step(mPrevCursor, mPrevious, false, true);
+                if (from != nullptr) {
+                    mMixed.emplace(val->fadeFrom(*from, mCurrent.fade - mFadeLeft + 1, mCurrent.fade + 1));
+                    val = &*mMixed;
+                }
+                mFadeLeft--;
+            }
+
+            return val;
+        }
+
+    //
+    // Returns true, and the power to set, if a new entry with a power setting just started
+    //
+    bool newPower(uint8_t& power)
+        {
+            power  = mPower;
+            mPower = 0;
+            return power != 0;
+        }
+
+private:
+    struct Cursor {
+        size_t        idx;
+        uint32_t      left;
+        unsigned      loop;
+        unsigned long elapsed;
+
+        Cursor()
+            : idx(0)
+            , left(0)
+            , loop(0)
+            , elapsed(0)
+            {}
+
+        Cursor(const Entry& e)
+            : idx(0)
+            , left((e.gen) ? 0 : e.steps[0].ticks)
+            , loop(0)
+            , elapsed(0)
+            {}
+    };
+
+    //
+    // Start playing the specified entry from the beginning
+    //
+    static Cursor start(Entry& e)
+        {
+            if (e.gen) e.gen->reset();
+            return Cursor(e);
+        }
+
+    //
+    // Return the segment of the specified entry for this tick and advance the cursor,
+    // or NULL if the entry is complete. A looping entry without a limit completes at the
+    // end of a pass if 'yield' is true.
+    //
+    const VAL* step(Cursor& c, Entry& e, bool yield, bool forever = false)
+        {
+            if (!forever && e.ticks && c.elapsed >= e.ticks) return nullptr;
+
+            if (e.gen) {
+                Generator::Sample s;
+
+                if (!forever && !e.ticks && yield) return nullptr;
+                if (!e.gen->next(mTickMs, s)) return nullptr;
+
+                c.elapsed++;
+                e.out.emplace(Generator::encode<VAL>(s));
+
+                return &*e.out;
+            }
+
+            if (c.left == 0) {
+                if (++c.idx == e.steps.size()) {
+                    c.idx = 0;
+                    c.loop++;
+                    if (!forever) {
+                        if (e.loops && c.loop >= e.loops) return nullptr;
+                        if (!e.loops && !e.ticks && yield) return nullptr;
+                    }
+                }
+                c.left = e.steps[c.idx].ticks;
+            }
+
+            c.left--;
+            c.elapsed++;
+
+            return &e.steps[c.idx].val;
+        }
+
+#ifdef CONFIG_NIMBLE_DEVICE_STATIC_ALLOC
+    typedef FixedDeque<Entry, CONFIG_NIMBLE_DEVICE_MAX_QUEUE> Queue;
+#else
+    typedef std::deque<Entry, Accounting::Allocator<Entry>> Queue;
+#endif
+
+    unsigned           mTickMs;
+    Queue              mQueue;
+    Entry              mCurrent;
+    Entry              mPrevious;
+    bool               mHave;
+    Cursor             mCursor;
+    Cursor             mPrevCursor;
+    unsigned           mFadeLeft;
+    std::optional<VAL> mMixed;
+    uint8_t            mPower;
+    unsigned long      mLimit;
+    unsigned long      mPlayed;
+};
+
+}
+}
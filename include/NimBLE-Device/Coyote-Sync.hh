@@ -0,0 +1,147 @@
+//
+// Synchronized playback across multiple Dungeon Labs Coyote devices
+//
+// WARNING: USE AT YOUR OWN RISK
+//
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device/Coyote.hh"
+
+
+namespace NimBLE {
+
+namespace COYOTE {
+
+//
+// A group of Coyote devices transmitting on a shared clock.
+//
+// All member devices send their 100ms frames on the same tick boundaries, counted from a
+// common epoch. Each device wakes up early by its measured write latency, so that frames
+// reach all devices at the same time. Commands scheduled on the group's channels take
+// effect on the same tick on every device.
+//
+class SyncGroup
+{
+public:
+    SyncGroup();
+    ~SyncGroup();
+
+    //
+    // Add a device, and both its channels, to the group. A device can be in at most one group.
+    // Returns false if the device is already in another group.
+    //
+    bool add(Device& dev);
+
+    //
+    // Add a channel to the group, adding its device if necessary
+    //
+    bool add(Channel& ch);
+
+    //
+    // Remove a device, and its channels, from the group.
+    // Waits for the device's transmit task to be done with the group, i.e. for at most a tick.
+    //
+    void remove(Device& dev);
+
+    //
+    // Start the shared clock, with the first tick in 'leadMs' ms.
+    // Devices already running realign on the new clock.
+    //
+    void start(unsigned leadMs = 1000);
+
+    //
+    // Returns true if the shared clock was started
+    //
+    bool isRunning();
+
+    //
+    // Run an action on the specified channel at the specified tick.
+    // If the tick is 0, use the earliest tick that no device in the group can have reached yet.
+    // Returns the tick at which the action will run.
+    //
+    uint32_t schedule(Channel& ch, std::function<void(Channel&)> action, uint32_t tick = 0);
+
+    //
+    // Run an action on all the channels in the group at the same tick.
+    // Returns the tick at which the action will run.
+    //
+    uint32_t scheduleAll(std::function<void(Channel&)> action, uint32_t tick = 0);
+
+    //
+    // Start, stop, or change the waveform on all the channels in the group at the same tick
+    //
+    uint32_t start(long secs);
+    uint32_t stop();
+    uint32_t setWaveform(const V2::Waveform& wave, uint8_t power = 0);
+    uint32_t setWaveform(const V3::Waveform& wave, uint8_t power = 0);
+
+    //
+    // Synchronization statistics
+    //
+    struct Stats {
+        unsigned      devices;      // Number of devices in the group
+        uint32_t      tick;         // Most recent tick sent by any device
+        long          skewMs;       // Spread of frame write completion times, relative to their tick
+        long          maxSkewMs;    // Worst spread seen so far
+        unsigned long late;         // Number of actions that ran after their scheduled tick
+    };
+
+    Stats getStats();
+
+    //
+    // Measured write latency of a device in the group, in ms (-1 if not in the group)
+    //
+    long getLatency(Device& dev);
+
+private:
+    struct Member {
+        Device*  dev;
+        bool     allChannels;   // Added with add(Device&): its channels may be created later
+        uint32_t tick;
+        long     offsetMs;
+        long     latencyMs;
+    };
+
+    struct Action {
+        Channel*                      ch;
+        uint32_t                      tick;
+        std::function<void(Channel&)> fct;
+    };
+
+    SemaphoreHandle_t     mMutex;
+    std::vector<Member>   mMembers;
+    std::vector<Channel*> mChannels;
+    std::vector<Action>   mActions;
+    bool                  mRunning;
+    TickType_t            mEpoch;
+    long                  mEpochMs;
+    long                  mMaxSkew;
+    unsigned long         mLate;
+
+    Member*  find(Device* dev);
+    bool     join(Device& dev, bool allChannels);
+    void     addChannel(Channel* ch);
+    uint32_t nextTick();
+
+    //
+    // Called by member devices from their run task
+    //
+    void apply(Device& dev, uint32_t tick);
+    void sent(Device& dev, uint32_t tick, long startMs, long endMs);
+    bool wait(Device& dev, TaskPolicy::Task* task, TickType_t& lastWake, uint32_t& tick);
+
+    friend class Device;
+};
+
+}
+}
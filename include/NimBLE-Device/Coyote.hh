@@ -17,8 +17,13 @@
 
 
 #include "NimBLE-Device.hh"
+#include "NimBLE-Device/Coyote-Codec.hh"
+#include "NimBLE-Device/Arena.hh"
+#include "NimBLE-Device/TaskPolicy.hh"
+#include "NimBLE-Device/Seqlock.hh"
 
 #include <freertos/FreeRTOS.h>
+#include <atomic>
 #include <string>
 
 namespace NimBLE {
@@ -27,6 +32,8 @@ namespace COYOTE {
 
 class Channel;
 class Device;
+class Generator;
+class SyncGroup;
 
 namespace V3 {
     class WaveVal;
@@ -60,15 +67,20 @@ public:
     uint16_t getRepeat() const;
 
     //
-    // Return the wave segment in transmit order
+    // Return this segment with its intensity blended 'num'/'den' of the way from the intensity of 'from'
     //
-    operator uint8_t*() const;
+    WaveVal fadeFrom(const WaveVal& from, unsigned num, unsigned den) const;
+
+    //
+    // Encode the wave segment in transmit order into the specified buffer.
+    // Returns the number of bytes written, 0 if the buffer is too small.
+    //
+    size_t encode(uint8_t* buf, size_t len) const;
     
 private:
-    uint32_t   x    :  5;
-    uint32_t   y    : 10;
-    uint32_t   z    :  5;
-    uint32_t   rsvd : 12;
+    uint8_t    x;
+    uint16_t   y;
+    uint8_t    z;
 
     uint16_t   repeat;
 
@@ -101,6 +113,11 @@ public:
     //
     WaveVal(V2::WaveVal v2);
 
+    //
+    // Convert 'n' V2 waveform segments into V3 segments in one pass
+    //
+    static void convert(const V2::WaveVal* in, size_t n, WaveVal* out);
+
     //
     // Total length, in ms, of this waveform segment
     //
@@ -116,6 +133,11 @@ public:
     //
     uint8_t getFreq() const;
     uint8_t getInt() const;
+
+    //
+    // Return this segment with its intensity blended 'num'/'den' of the way from the intensity of 'from'
+    //
+    WaveVal fadeFrom(const WaveVal& from, unsigned num, unsigned den) const;
     
 private:
     uint8_t xy;
@@ -129,6 +151,11 @@ private:
 //
 typedef std::vector<WaveVal>  Waveform;
 
+//
+// Convert a V2 waveform into a V3 waveform
+//
+Waveform convert(const V2::Waveform& wave);
+
 };  // COYOTE::V3
 
 
@@ -141,7 +168,12 @@ public:
     //
     // Return the channel name
     //
-    std::string getName();
+    const char* getName() const;
+
+    //
+    // Return the device this channel belongs to
+    //
+    Device& getDevice();
     
     //
     // Set output power
@@ -158,6 +190,23 @@ public:
     //
     uint8_t getPower();
 
+    //
+    // Power state of the channel
+    //
+    struct State {
+        uint16_t power;         // As reported by the device
+        uint16_t setPower;      // As requested
+        uint16_t sentPower;     // As last sent to the device
+        uint16_t maxPower;
+        bool     safeMode;
+        bool     latched;       // Stopped by an emergency stop: power settings are rejected
+    };
+
+    //
+    // Return a coherent snapshot of the power state, without locking
+    //
+    State getState() const;
+
     //
     // Set waveform balance parameters (V3 only)
     //
@@ -180,6 +229,51 @@ public:
     //
     virtual void setWaveform(const V3::Waveform& wave, uint8_t power = 0) {};
 
+    //
+    // Append the specified V2 waveform to the playlist, to be played at the specified power
+    // (current power if 0) for the specified number of ms or loops through the waveform.
+    // If neither is specified, the waveform loops until another one is queued.
+    // The transition to the next waveform happens on a tick boundary, optionally crossfading
+    // the intensity over the specified number of ms.
+    // Returns false if the waveform cannot be played on this channel.
+    //
+    virtual bool queueWaveform(const V2::Waveform& wave, uint8_t power = 0, long ms = 0, unsigned loops = 0, long fadeMs = 0)
+    {
+        return false;
+    }
+
+    //
+    // Append the specified V3 waveform to the playlist (V3 only)
+    //
+    virtual bool queueWaveform(const V3::Waveform& wave, uint8_t power = 0, long ms = 0, unsigned loops = 0, long fadeMs = 0)
+    {
+        return false;
+    }
+
+    //
+    // Play the specified generator, at the specified power.
+    // If power is not specified, use current power
+    //
+    virtual bool setGenerator(Generator& gen, uint8_t power = 0)
+    {
+        return false;
+    }
+
+    //
+    // Append the specified generator to the playlist, to be played at the specified power
+    // (current power if 0) for the specified number of ms.
+    // If 'ms' is 0, the generator plays until it ends or until another waveform is queued.
+    //
+    virtual bool queueGenerator(Generator& gen, uint8_t power = 0, long ms = 0, long fadeMs = 0)
+    {
+        return false;
+    }
+
+    //
+    // Remove all waveforms from the playlist, including the one currently playing
+    //
+    virtual void clearPlaylist() {};
+
     //
     // Start playing the waveform (if any) for the specified number of secs (forever if 0)
     //
@@ -196,20 +290,21 @@ protected:
     {}
 
     Device*     mDevice;
-    std::string mName;
+    char        mName[32];
 
-    uint16_t mMaxPower;
-    uint16_t mSetPower;
-    uint16_t mSentPower;
-    uint16_t mPower;
-    bool     mSafeMode;
+    Seqlock<State> mState;
 
     std::function<void(uint8_t)> mPowerCb;
 
     void updatePower(uint8_t power);
     bool powerUpdateReq(uint8_t& power);
+    void powerSent(uint8_t power);
+    void limitPower(uint16_t max);
+    void latch(bool on);
 
     friend class Device;
+    friend class SyncGroup;
+    friend class NimBLE::Arena;
 };
 class V2Channel;
 class V3Channel;
@@ -246,6 +341,19 @@ public:
     //
     virtual void serviceLoop(long nowInMs)  override;
 
+    //
+    // Measure the latency from an input event, that occurred at 'inputMs', to the end of the write
+    // of the next frame. Only the earliest input event not yet reflected in a frame is measured.
+    //
+    void traceInput(long inputMs);
+
+    //
+    // Subscribe to input-to-frame latency measurements, in ms (optional). There can be multiple subscribers.
+    // Subscriptions made on behalf of an 'owner' are cancelled with unsubscribeLatency().
+    //
+    void subscribeLatency(std::function<void(long latencyMs)> fct, const void* owner = nullptr);
+    void unsubscribeLatency(const void* owner);
+
 
 protected:
     //
@@ -260,15 +368,51 @@ private:
 
     virtual bool doInitDevice()  override final;
 
-    TaskHandle_t mTaskHandle;
-    static void  runTask(void* pvParameter);
+    //
+    // Emergency stop: channels are latched at 0 and power writes refused until released
+    //
+    virtual bool latchStop()  override final;
+    virtual void releaseStop()  override final;
+
+    //
+    // Transmit task, placed according to the TaskPolicy for the "Coyote" class or this device
+    //
+    TaskHandle_t       mTaskHandle;
+    TaskPolicy::Task*  mTask;
+    static void        runTask(void* pvParameter);
     virtual void run() = 0;
 
-    void notifyBattery(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify);
+    //
+    // Transmit tick management, used by run().
+    // beginTick() runs scheduled actions, frameSent() reports the write of the frame that
+    // started at 'startMs' and was due 'phaseMs' after the start of the tick, and waitTick()
+    // waits 'ms' or, if the device is in a sync group, until the next tick of the shared clock.
+    // The transmit task holds mSyncMutex while using the group, so a group can leave between ticks.
+    //
+    TickType_t              mLastWake;
+    uint32_t                mTick;
+    std::atomic<SyncGroup*> mSync;
+    SemaphoreHandle_t       mSyncMutex;
+
+    void beginTick();
+    void frameSent(long startMs, long phaseMs = 0);
+    void waitTick(unsigned ms);
+
+    struct LatencyListener {
+        const void*               owner;
+        std::function<void(long)> fct;
+    };
+
+    std::atomic<long>            mInputMs;
+    SemaphoreHandle_t            mLatencyMutex;
+    std::vector<LatencyListener> mLatencyListeners;
+
+    void notifyBattery(const uint8_t* pData, size_t length);
 
     friend class Channel;
     friend class V2Channel;
     friend class V3Channel;
+    friend class SyncGroup;
 };
 
 
@@ -296,7 +440,8 @@ private:
 
     virtual bool initCoyoteDevice()  override;
     virtual void run() override;
-    void notifyPower(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify);
+    virtual bool sendStop() override;
+    void notifyPower(const uint8_t* pData, size_t length);
 };
 
 
@@ -313,10 +458,14 @@ public:
 private:
     NimBLERemoteCharacteristic* mCharac;
     uint8_t                     mNextSerial;
-    uint8_t                     mPendingSerial;
-    uint8_t                     mFreqBal[7];
+    std::atomic<uint8_t>        mPendingSerial;     // Also cleared by the host and service tasks
+    CODEC::V3::Limits           mLimits;
 
-    void notifyResp(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify);
+    //
+    // Responses, dispatched by opcode
+    //
+    void notifyAck(const uint8_t* pData, size_t length);
+    void notifyLimits(const uint8_t* pData, size_t length);
 
     virtual float getVersion() override
     {
@@ -325,6 +474,8 @@ private:
 
     virtual bool initCoyoteDevice()  override;
     virtual void run() override;
+    virtual bool sendStop() override;
+    virtual void resetHeartbeat(Watchdog::Heartbeat_t hb) override;
 
     friend class V3Channel;
 };
@@ -0,0 +1,112 @@
+//
+// HID-over-GATT report decoding for keyboards, remotes, buttons and gamepads
+//
+// Copyright (c) 2023 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+
+namespace NimBLE {
+
+namespace HID {
+
+//
+// Usage pages that carry key and button events
+//
+enum UsagePage_t : uint16_t {KEYBOARD = 0x07, BUTTON = 0x09, CONSUMER = 0x0C};
+
+//
+// A key or button changing state: the usage page, the usage within that page, and whether it is now pressed
+//
+typedef std::function<void(uint16_t page, uint16_t usage, bool pressed)> KeyHandler_t;
+
+
+//
+// A HID Report Map, compiled into a flat extraction plan for each input report.
+//
+// The Report Map is parsed once. Each incoming input report is then decoded by extracting its
+// key and button fields at precomputed bit offsets and comparing them with the previous report
+// with the same identifier. Decoding does not allocate memory.
+//
+class ReportMap
+{
+public:
+    ReportMap();
+
+    //
+    // Compile the specified Report Map.
+    // Returns false if it is malformed or does not describe any key or button.
+    //
+    bool compile(const uint8_t* desc, size_t len);
+
+    //
+    // Returns true if the Report Map has been compiled successfully
+    //
+    bool isValid() const;
+
+    //
+    // Decode an input report with the specified report identifier (0 if the Report Map does not use identifiers),
+    // calling the handler for each key or button that changed state since the previous report.
+    // Returns false if the report is not described by the Report Map.
+    //
+    bool decode(uint8_t reportId, const uint8_t* data, size_t len, const KeyHandler_t& fct);
+
+    //
+    // Forget the previous reports, e.g. after a disconnect.
+    // Keys still pressed in the previous reports are released.
+    //
+    void reset(const KeyHandler_t& fct);
+
+private:
+    //
+    // One element of the extraction plan.
+    // A variable field is a single key, pressed when its value is not 0.
+    // An array field is a list of 'count' indices, each selecting a pressed key, from the usage range or the usage table.
+    //
+    struct Field {
+        uint16_t bitOffset;
+        uint8_t  bitSize;
+        uint8_t  count;
+        bool     array;
+        uint16_t page;
+        uint16_t usage;         // Variable: the usage. Array: the first usage of the range.
+        uint16_t nUsages;       // Array: number of usages in the range, or in the table
+        int16_t  usageIdx;      // Array: index of the usage table, or -1 if a range
+        int32_t  logMin;
+    };
+
+    struct Report {
+        uint8_t  id;
+        uint16_t bits;
+        uint16_t firstField;
+        uint16_t nFields;
+        uint16_t prevOffset;    // Previous report content in mPrev
+        uint16_t prevLen;
+    };
+
+    std::vector<Field>    mFields;
+    std::vector<Report>   mReports;
+    std::vector<uint16_t> mUsages;
+    std::vector<uint8_t>  mPrev;
+
+    Report* find(uint8_t reportId);
+    void    diff(const Report& rpt, const uint8_t* prev, size_t prevLen, const uint8_t* data, size_t len, const KeyHandler_t& fct);
+
+    static uint32_t extract(const uint8_t* data, size_t len, unsigned bitOffset, unsigned bitSize);
+};
+
+}
+}
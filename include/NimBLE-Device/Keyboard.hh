@@ -14,6 +14,9 @@
 
 
 #include "NimBLE-Device.hh"
+#include "NimBLE-Device/HID.hh"
+
+#include <bitset>
 
 namespace NimBLE {
 
@@ -34,7 +37,13 @@ public:
     virtual ~Device();
 
     //
-    // Optionally remap the physical device keys
+    // By default, any HID-over-GATT device (keyboard, remote, button, gamepad) is decoded using its Report Map
+    //
+    bool doInitDevice()  override;
+
+    //
+    // Optionally remap the physical device keys.
+    // Keys decoded from HID reports are the usage IDs within their usage page (e.g. 0x28 for Enter, 0xE9 for Volume Up).
     //
     virtual void setKeyMap(const uint8_t map[]);       // Remap all the keys (e.g. map[0x20] = 0x32 remaps device key 0x20 to Keyboard key 0x32)
     virtual void setKeyMap(uint8_t from, uint8_t to);  // Remap a single key
@@ -54,20 +63,110 @@ public:
     //
     void subscribe(std::function<void(uint8_t key, Event_t e)> fct);
 
+    //
+    // Types of key/button gestures.
+    // A TAP is reported only once it cannot become a DOUBLE_TAP.
+    // REPEAT is reported periodically while a key remains pressed after a LONG_PRESS.
+    // CHORD is reported, with the chord identifier instead of a key, when all the keys of a chord are pressed together.
+    //
+    typedef enum {TAP, DOUBLE_TAP, LONG_PRESS, REPEAT, CHORD} Gesture_t;
+
+    //
+    // Gesture timing parameters, in ms
+    //
+    struct GestureTiming {
+        long tapMaxMs;          // Longest press that is a tap
+        long doubleTapGapMs;    // Longest release between the two taps of a double-tap
+        long longPressMs;       // Shortest press that is a long-press
+        long repeatMs;          // Interval between repeats after a long-press
+        long chordWindowMs;     // Longest interval between the presses of the keys in a chord
+    };
+
+    void          setGestureTiming(const GestureTiming& timing);
+    GestureTiming getGestureTiming();
+
+    //
+    // Subscribe to gestures (optional). There can be multiple subscribers.
+    //
+    void subscribeGestures(std::function<void(uint8_t key, Gesture_t g)> fct);
+
+    //
+    // Define a chord of up to 4 keys, reported as the specified identifier
+    //
+    bool addChord(uint8_t id, std::initializer_list<uint8_t> keys);
+
+    //
+    // Report gestures whose deadline has passed.
+    // Cheap to call often: returns immediately if no deadline is due.
+    //
+    void serviceGestures(long nowInMs);
+
+    //
+    // Report a key/button event that occurred at the specified time (in ms), e.g. to replay input.
+    // Gestures are recognized on that clock: serviceGestures() must then be called on the same clock.
+    //
+    void publish(uint8_t key, Event_t e, long nowInMs);
+
+    virtual void serviceLoop(long nowInMs)  override;
+
 protected:
     //
-    // Report a key/button event
+    // Report a key/button event, now
     //
     void publish(uint8_t key, Event_t e);
 
+    //
+    // Discover the HID service, compile its Report Map, and subscribe to all its input reports.
+    // Returns true if successful.
+    //
+    bool initHID();
+
+    virtual void notifyEvent(uint8_t event)  override;
+
 private:
-    uint8_t      mKeyMap[256];
-    bool         mPressed[256];
+    uint8_t          mKeyMap[256];
+    std::bitset<256> mPressed;
 
     struct Listener {
         std::function<void(uint8_t key, Event_t e)> fct;
     };
     std::vector<Listener> mListeners;
+
+    HID::ReportMap    mReportMap;
+    HID::KeyHandler_t mKeyHandler;
+
+    void notifyReport(uint8_t reportId, const uint8_t* pData, size_t length);
+
+    //
+    // Gesture recognition state, for a few keys at a time
+    //
+    typedef enum {IDLE, DOWN, UP, DOWN_AGAIN, HELD, CONSUMED} KeyState_t;
+
+    struct KeyTrack {
+        uint8_t    key;
+        KeyState_t state;
+        long       downMs;
+        long       deadline;
+    };
+
+    struct Chord {
+        uint8_t id;
+        uint8_t nKeys;
+        uint8_t keys[4];
+    };
+
+    SemaphoreHandle_t  mGestureMutex;
+    GestureTiming      mTiming;
+    KeyTrack           mTracks[8];
+    long               mNextDeadline;
+    std::vector<Chord> mChords;
+
+    std::vector<std::function<void(uint8_t key, Gesture_t g)>> mGestureListeners;
+
+    KeyTrack* track(uint8_t key, bool alloc);
+    void      gesture(uint8_t key, Gesture_t g);
+    void      checkChords(long nowInMs);
+    void      updateDeadline();
 };
 
 }
@@ -0,0 +1,76 @@
+//
+// NimBLE-Device link liveness probing
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include <atomic>
+
+
+namespace NimBLE {
+
+//
+// Liveness of a link from periodic probes (e.g. reads) answered asynchronously.
+//
+// A probe is due every 'periodMs'. It is missed if not answered within 'maxMs', and the link is lost
+// after 'missed' consecutive missed probes. Probes are answered in the order they were sent, as
+// ATT requests are. Answers can be reported from any task (e.g. the NimBLE host task): everything
+// else must be done from a single task, which never waits for an answer.
+//
+class LinkProbe
+{
+public:
+    LinkProbe();
+
+    void setTiming(long periodMs, long maxMs, unsigned missed);
+
+    //
+    // Start probing afresh, e.g. on (re)connection, as if answered now
+    //
+    void restart(long nowInMs);
+
+    //
+    // Check the probe in flight, if any.
+    // Returns PROBE if a probe is due: call sent() then send it, and answered(false) if it cannot be sent.
+    //
+    typedef enum {WAIT, PROBE, ANSWERED, MISSED, LOST} Status_t;
+
+    Status_t check(long nowInMs);
+    void     sent(long nowInMs);
+
+    //
+    // Report the answer to the oldest probe not yet answered, from any task
+    //
+    void answered(bool ok, long nowInMs);
+
+    //
+    // Time of the last answer received in time, or of restart()
+    //
+    long getLastHeard() const;
+
+private:
+    long     mPeriodMs;
+    long     mMaxMs;
+    unsigned mMissed;
+
+    unsigned mMisses;
+    bool     mInFlight;
+    long     mSentMs;
+    long     mNextMs;
+    long     mLastHeardMs;
+    unsigned mSent;
+
+    std::atomic<long>     mAnswerMs;    // 0 if the last answer was a failure
+    std::atomic<unsigned> mAnswered;
+};
+
+}
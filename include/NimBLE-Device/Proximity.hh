@@ -0,0 +1,156 @@
+//
+// NimBLE-Device proximity tracking from signal strength (RSSI)
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device.hh"
+
+
+namespace NimBLE {
+
+//
+// Track the proximity of a set of interesting devices.
+//
+// The RSSI of connected devices is sampled round-robin, a bounded number of devices per call
+// to service(), so the sampling overhead does not grow with the number of tracked devices.
+// The RSSI of advertisements of unconnected devices is reported from the scan callback.
+// Each device's RSSI is filtered in a fixed-size slot, and changes of proximity zone are
+// reported with hysteresis.
+//
+class Proximity
+{
+public:
+    //
+    // Track up to the specified number of devices
+    //
+    Proximity(unsigned maxDevices = 50);
+    ~Proximity();
+
+    //
+    // Start tracking the specified device. Returns false if the table is full.
+    //
+    bool track(InterestingDevice& dev);
+
+    //
+    // Stop tracking the specified device
+    //
+    void untrack(InterestingDevice& dev);
+
+    //
+    // RSSI filtering. EMA uses 'alpha' as the weight of a new sample.
+    // KALMAN uses 'q' as the process noise and 'r' as the measurement noise, in dBm^2.
+    //
+    typedef enum {EMA, KALMAN} Filter_t;
+
+    void setFilter(Filter_t filter, float alpha = 0.25, float q = 0.5, float r = 16);
+
+    //
+    // Proximity zones. A device becomes NEAR once its filtered RSSI is at least 'nearDbm',
+    // and FAR once it is below 'farDbm' (with farDbm < nearDbm). It becomes LOST if it
+    // has not been heard of for 'lostMs'.
+    //
+    typedef enum {UNKNOWN, NEAR, FAR, LOST} Zone_t;
+
+    void setZones(int nearDbm = -60, int farDbm = -75, long lostMs = 10000);
+
+    //
+    // Sample each connected device at most every 'periodMs', and at most 'maxPerService'
+    // devices per call to service()
+    //
+    void setSampling(long periodMs = 1000, unsigned maxPerService = 2);
+
+    //
+    // Subscribe to zone changes (optional)
+    //
+    void subscribe(std::function<void(InterestingDevice& dev, Zone_t zone, int rssi)> fct);
+
+    //
+    // Report the RSSI of an advertisement. To be called from the scan callback.
+    //
+    void advertised(NimBLEAdvertisedDevice* adv, long nowInMs);
+
+    //
+    // Report an RSSI measurement, in dBm, for a tracked device.
+    // Returns false if the device is not tracked.
+    //
+    bool report(InterestingDevice& dev, int rssi, long nowInMs);
+
+    //
+    // Sample the next due connected devices and detect lost devices.
+    // To be called periodically.
+    //
+    void service(long nowInMs);
+
+    //
+    // Current zone and filtered RSSI of a tracked device
+    //
+    Zone_t getZone(InterestingDevice& dev);
+    int    getRssi(InterestingDevice& dev);
+
+    //
+    // Sampling statistics
+    //
+    struct Stats {
+        unsigned      tracked;      // Devices tracked
+        unsigned long connSamples;  // RSSI readings or reports of connected devices
+        unsigned long advSamples;   // Advertisement RSSI reports, or reports of unconnected devices
+        unsigned long services;     // Calls to service()
+        unsigned long events;       // Zone changes reported
+        long          elapsedMs;    // Time since the statistics were reset
+
+        float samplesPerSec() const
+        {
+            return (elapsedMs > 0) ? (connSamples + advSamples) * 1000.0 / elapsedMs : 0;
+        }
+    };
+
+    Stats getStats(long nowInMs);
+    void  resetStats(long nowInMs);
+
+private:
+    struct Slot {
+        InterestingDevice* dev;
+        float              est;
+        float              var;
+        int                raw;
+        long               lastMs;      // Last sample
+        long               nextMs;      // Next connected sample due
+        Zone_t             zone;
+    };
+
+    SemaphoreHandle_t  mMutex;
+    std::vector<Slot>  mSlots;
+    unsigned           mNumSlots;
+    unsigned           mCursor;
+
+    Filter_t mFilter;
+    float    mAlpha;
+    float    mQ;
+    float    mR;
+    int      mNearDbm;
+    int      mFarDbm;
+    long     mLostMs;
+    long     mPeriodMs;
+    unsigned mMaxPerService;
+
+    Stats mStats;
+    long  mStatsStartMs;
+
+    std::function<void(InterestingDevice& dev, Zone_t zone, int rssi)> mEventCb;
+
+    Slot* find(InterestingDevice* dev);
+    void  sample(Slot& slot, int rssi, long nowInMs);
+    void  changeZone(Slot& slot, Zone_t zone);
+};
+
+}
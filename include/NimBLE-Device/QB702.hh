@@ -35,8 +35,42 @@ public:
     bool doInitDevice()             override;
     void serviceLoop(long nowInMs)  override;
 
+    //
+    // Each click increments a counter on the ring. Clicks are reported exactly once,
+    // even if notifications are lost or repeated, including across reconnects.
+    // Clicks recovered from a gap are reported as separate taps, one double-tap gap apart.
+    //
+    struct Stats {
+        unsigned long clicks;       // Clicks reported, including recovered ones
+        unsigned long recovered;    // Clicks recovered from a gap in the counter
+        unsigned long dropped;      // Clicks in a gap too large to be recovered
+        unsigned long duplicates;   // Notifications ignored because the counter did not change
+        unsigned long stale;        // Notifications ignored because the counter went backward
+        unsigned long resets;       // Times the counter restarted (e.g. reset on the ring)
+    };
+
+    Stats getStats();
+
+    //
+    // Last counter value seen, or -1 if none yet
+    //
+    long getCounter();
+
+protected:
+    virtual void notifyEvent(uint8_t event)  override;
+
 private:
-    void notifyButton(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify);
+    SemaphoreHandle_t mMutex;
+    bool              mHaveCounter;
+    bool              mReconnected;     // The counter may have been reset while disconnected
+    uint16_t          mCounter;
+    unsigned          mPending;         // Clicks not reported yet
+    long              mNextClickMs;     // Earliest time of the next pending click
+    Stats             mStats;
+
+    void notifyButton(const uint8_t* pData, size_t length);
+    void click(long nowInMs);
+    void publishPending(long nowInMs);
 };
 
 }
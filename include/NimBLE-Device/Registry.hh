@@ -0,0 +1,107 @@
+//
+// NimBLE-Device persistent registry of known devices
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device.hh"
+
+
+namespace NimBLE {
+
+//
+// Devices bound on a previous run, by unique name.
+//
+// When the registry is open, InterestingDevice::initFoundDevices() connects directly to
+// the known devices that were not yet found by a scan, falling back to scanning for
+// those that cannot be connected to. Every successfully initialized device is recorded.
+//
+// The registry is stored in NVS on the target and in a memory-mapped file on the host.
+//
+class Registry
+{
+public:
+    static const unsigned MAX_ENTRIES = 16;
+
+    //
+    // A known device
+    //
+    struct Entry {
+        char     name[32];      // Unique name
+        char     bleName[32];   // Advertised name
+        uint64_t addr;
+        uint8_t  addrType;
+        int8_t   rssi;          // Connection RSSI when last initialized
+        uint16_t failures;      // Consecutive failed direct connections
+        uint32_t connects;      // Successful initializations
+        uint32_t seq;           // Higher is more recent
+    };
+
+    //
+    // Open the registry in the specified NVS namespace (target) or file (host).
+    // Returns false if it cannot be opened. An invalid registry is cleared.
+    //
+    static bool open(const char* where = "nimble-dev");
+    static void close();
+    static bool isOpen();
+
+    //
+    // Find the entry for the specified unique name
+    //
+    static bool lookup(const char* name, Entry& entry);
+
+    //
+    // Record a device that was successfully initialized, replacing the least recent entry if full.
+    // The entry is only written back if the device is new or its address or name changed:
+    // its RSSI and counters are otherwise written with the next change, or when closed.
+    //
+    static bool remember(const char* name, const char* bleName, const NimBLEAddress& addr, int rssi);
+
+    //
+    // Record a failed direct connection. The entry is forgotten after 3 consecutive failures.
+    //
+    static void failed(const char* name);
+
+    //
+    // Forget the specified device, or all devices
+    //
+    static void forget(const char* name);
+    static void clear();
+
+    //
+    // Return all entries, most recent first
+    //
+    static std::vector<Entry> getEntries();
+
+    //
+    // Return the address of an entry
+    //
+    static NimBLEAddress address(const Entry& entry);
+
+private:
+    struct Image {
+        uint32_t magic;
+        uint32_t count;
+        uint32_t seq;
+        Entry    entries[MAX_ENTRIES];
+    };
+
+    static Image* sImage;
+    static bool   sDirty;       // Changes not written back yet
+
+    static Entry* find(const char* name);
+    static bool   flush();
+    static bool   load(const char* where);
+    static void   unload();
+};
+
+}
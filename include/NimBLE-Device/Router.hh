@@ -0,0 +1,134 @@
+//
+// NimBLE-Device notification router
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLEDevice.h"
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace NimBLE {
+
+//
+// Dispatch the notifications of a client connection to typed handlers.
+//
+// Notifications are routed by attribute handle through a dense array, then, for characteristics
+// multiplexing several messages, by their first byte (opcode) through a 256-entry table built
+// at compile time. Handlers receive the whole payload, opcode included.
+//
+// Routes are cleared whenever the device is initialized again, as handles may have changed.
+//
+class Router
+{
+public:
+    static const unsigned MAX_ROUTES  = 8;
+    static const unsigned MAX_HANDLES = 128;    // Handles above are found by a linear search
+
+    //
+    // A handler, called with the context and tag of its route
+    //
+    typedef void (*Handler)(void* ctx, uint8_t tag, const uint8_t* data, size_t len);
+
+    //
+    // Handlers calling C::FCT(data, len) or C::FCT(tag, data, len)
+    //
+    template<class C, void (C::*FCT)(const uint8_t*, size_t)>
+    static void handler(void* ctx, uint8_t tag, const uint8_t* data, size_t len)
+        {
+            (static_cast<C*>(ctx)->*FCT)(data, len);
+        }
+
+    template<class C, void (C::*FCT)(uint8_t, const uint8_t*, size_t)>
+    static void taggedHandler(void* ctx, uint8_t tag, const uint8_t* data, size_t len)
+        {
+            (static_cast<C*>(ctx)->*FCT)(tag, data, len);
+        }
+
+    //
+    // Opcode dispatch table
+    //
+    struct Op {
+        uint8_t op;
+        Handler fct;
+    };
+
+    struct OpTable {
+        Handler fct[256];
+    };
+
+    template<size_t N>
+    static constexpr OpTable table(const Op (&ops)[N])
+        {
+            OpTable t = {};
+            for (size_t i = 0; i < N; i++) t.fct[ops[i].op] = ops[i].fct;
+            return t;
+        }
+
+    Router();
+
+    //
+    // Subscribe to the notifications of the specified characteristic, routed to the specified handler,
+    // or through the specified opcode table (which must outlive the router).
+    // Returns false if there is no room for another route or the subscription failed.
+    //
+    bool subscribe(NimBLERemoteCharacteristic* chr, void* ctx, Handler fct, uint8_t tag = 0);
+    bool subscribe(NimBLERemoteCharacteristic* chr, void* ctx, const OpTable& ops, uint8_t tag = 0);
+
+    //
+    // Route the notifications of the specified handle without subscribing to them,
+    // e.g. for notifications received by other means. Returns false if there is no room for another route.
+    //
+    bool route(uint16_t handle, void* ctx, Handler fct, uint8_t tag = 0);
+    bool route(uint16_t handle, void* ctx, const OpTable& ops, uint8_t tag = 0);
+
+    //
+    // Forget all routes
+    //
+    void clear();
+
+    //
+    // Dispatch a notification
+    //
+    void dispatch(uint16_t handle, const uint8_t* data, size_t len);
+
+    struct Stats {
+        unsigned long dispatched;
+        unsigned long dropped;      // Notifications on a handle without a route, or without an opcode
+        unsigned long unknown;      // Opcodes without a handler
+    };
+
+    Stats getStats() const;
+    void  resetStats();
+
+private:
+    struct Route {
+        uint16_t       handle;
+        uint8_t        tag;
+        void*          ctx;
+        Handler        fct;
+        const OpTable* ops;
+    };
+
+    Route    mRoutes[MAX_ROUTES];
+    unsigned mNumRoutes;
+    uint8_t  mIndex[MAX_HANDLES];   // Route + 1 for each handle, 0 if none
+
+    Stats    mStats;
+
+    bool add(NimBLERemoteCharacteristic* chr, const Route& route);
+    bool insert(const Route& route);
+};
+
+}
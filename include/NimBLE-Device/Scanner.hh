@@ -0,0 +1,153 @@
+//
+// NimBLE-Device scan engine for the pool of interesting devices
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device.hh"
+
+
+namespace NimBLE {
+
+//
+// Scan for the interesting devices in the pool.
+//
+// Advertisements are filtered through a fixed-size cache of recently seen (address, payload)
+// pairs, so repeats of the same advertisement are dropped before being matched against the
+// pool. Once all must-find devices are found, scanning stops, or continues at a reduced duty
+// cycle. It resumes when a must-find device is no longer connected: one that lost its link is
+// forgotten, so it can be found again.
+//
+class Scanner : public NimBLEAdvertisedDeviceCallbacks
+{
+public:
+    //
+    // A scanner remembering up to 'cacheSize' recent advertisements for 'cacheMs'
+    //
+    Scanner(unsigned cacheSize = 32, long cacheMs = 2000);
+    virtual ~Scanner();
+
+    //
+    // Scan parameters, in ms
+    //
+    void setParams(uint16_t intervalMs = 100, uint16_t windowMs = 50, bool active = true);
+
+    //
+    // Once all must-find devices are found, scan for 'onMs' every 'onMs + offMs' (stop scanning if 'onMs' is 0)
+    //
+    void setDutyCycle(long onMs = 0, long offMs = 0);
+
+    //
+    // Let the controller filter advertisements using the white list of the addresses of the not-yet-found devices.
+    // Open scanning is used instead while any not-yet-found device is a wildcard.
+    //
+    void setWhiteList(bool enable = true);
+
+    //
+    // Start or stop scanning
+    //
+    void start();
+    void stop();
+
+    bool isScanning();
+
+    //
+    // Apply the duty cycle, and resume scanning if a must-find device is missing.
+    // Scanning pauses while a device is being connected.
+    // To be called periodically.
+    //
+    void service(long nowInMs);
+
+    //
+    // Subscribe to all advertisements, including repeats (optional), e.g. to track their RSSI
+    //
+    void subscribe(std::function<void(NimBLEAdvertisedDevice* adv)> fct);
+
+    //
+    // Advertisement processing statistics
+    //
+    struct Stats {
+        unsigned long processed;    // Advertisements matched against the pool
+        unsigned long dropped;      // Repeated advertisements dropped by the cache
+        unsigned long found;        // Advertisements that matched a device in the pool
+        unsigned long restarts;     // Times scanning resumed because a must-find device was missing
+        bool          whiteList;    // Currently scanning with the white list
+        long          elapsedMs;    // Time since the statistics were reset
+
+        //
+        // Host callbacks per second, to compare scanning with and without the white list
+        //
+        float callbacksPerSec() const
+        {
+            return (elapsedMs > 0) ? (processed + dropped) * 1000.0 / elapsedMs : 0;
+        }
+
+        float processedPerSec() const
+        {
+            return (elapsedMs > 0) ? processed * 1000.0 / elapsedMs : 0;
+        }
+
+        float droppedPerSec() const
+        {
+            return (elapsedMs > 0) ? dropped * 1000.0 / elapsedMs : 0;
+        }
+    };
+
+    Stats getStats(long nowInMs);
+    void  resetStats(long nowInMs);
+
+    virtual void onResult(NimBLEAdvertisedDevice* adv)  override;
+
+private:
+    typedef enum {STOPPED, SCANNING, DUTY_ON, DUTY_OFF} State_t;
+
+    struct Entry {
+        uint64_t addr;
+        uint32_t hash;
+        long     seenMs;
+    };
+
+    std::vector<Entry> mCache;
+    long               mCacheMs;
+
+    uint16_t mIntervalMs;
+    uint16_t mWindowMs;
+    bool     mActive;
+    bool     mUseWhiteList;
+    bool     mWhiteListed;
+    uint32_t mGeneration;
+    long     mDutyOnMs;
+    long     mDutyOffMs;
+
+    State_t mState;
+    long    mNextMs;
+
+    // Updated from the NimBLE host task
+    struct Counters {
+        std::atomic<unsigned long> processed;
+        std::atomic<unsigned long> dropped;
+        std::atomic<unsigned long> found;
+        std::atomic<unsigned long> restarts;
+    };
+
+    Counters mStats;
+    long     mStatsStartMs;
+
+    std::function<void(NimBLEAdvertisedDevice* adv)> mAdvCb;
+
+    bool seen(uint64_t addr, uint32_t hash, long nowInMs);
+    void scan(bool on);
+
+    static uint32_t hash(const uint8_t* data, size_t len);
+};
+
+}
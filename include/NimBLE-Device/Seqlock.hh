@@ -0,0 +1,110 @@
+//
+// NimBLE-Device lock-free snapshots of small state records
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "freertos/FreeRTOS.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+
+namespace NimBLE {
+
+//
+// A state record that can be read from any task or core without locking.
+//
+// Writers are serialized, and cannot be preempted while updating the record: on the target,
+// updates run in a critical section, so they must be short and must not block, log or call back.
+// Readers retry until they copy the record without a concurrent update.
+//
+template<class T>
+class Seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock records must be trivially copyable");
+
+public:
+    Seqlock()
+        : mSeq(0)
+        , mValue()
+#if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_LINUX)
+        , mMux(portMUX_INITIALIZER_UNLOCKED)
+#endif
+        {}
+
+    //
+    // Return a coherent copy of the record
+    //
+    T read() const
+        {
+            T        val;
+            uint32_t before;
+            uint32_t after;
+
+            do {
+                before = mSeq.load(std::memory_order_acquire);
+                memcpy(&val, (const void*) &mValue, sizeof(T));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = mSeq.load(std::memory_order_relaxed);
+            } while ((before & 1) || before != after);
+
+            return val;
+        }
+
+    //
+    // Modify the record by calling 'fct(T&)'
+    //
+    template<class FCT>
+    void update(FCT fct)
+        {
+            lock();
+
+            uint32_t seq = mSeq.load(std::memory_order_relaxed);
+            mSeq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            fct(mValue);
+
+            mSeq.store(seq + 2, std::memory_order_release);
+
+            unlock();
+        }
+
+    //
+    // Number of updates so far
+    //
+    uint32_t version() const
+        {
+            return mSeq.load(std::memory_order_acquire) >> 1;
+        }
+
+private:
+    std::atomic<uint32_t> mSeq;
+    T                     mValue;
+
+#if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_LINUX)
+    portMUX_TYPE          mMux;
+
+    void lock()   { portENTER_CRITICAL(&mMux); }
+    void unlock() { portEXIT_CRITICAL(&mMux); }
+#else
+    std::atomic_flag      mLock = ATOMIC_FLAG_INIT;
+
+    void lock()   { while (mLock.test_and_set(std::memory_order_acquire)); }
+    void unlock() { mLock.clear(std::memory_order_release); }
+#endif
+};
+
+}
@@ -0,0 +1,103 @@
+//
+// NimBLE-Device placement of device tasks
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <cstdint>
+
+
+namespace NimBLE {
+
+//
+// Core, priority and stack size of the tasks created by devices (e.g. the Coyote transmit task),
+// configurable per device class and per device instance.
+//
+// Placements must be set before the devices are initialized: they are looked up when the task is created.
+// On the target, the task is pinned to its core when created. On Linux, the task thread sets its own
+// CPU affinity and SCHED_FIFO priority when it starts (the priority requires CAP_SYS_NICE).
+//
+// When measuring, the lateness of every periodic wake-up relative to its vTaskDelayUntil() target is
+// recorded for each task, to compare placements. Enabling the measurements waits for the next tick.
+//
+class TaskPolicy
+{
+public:
+    static const int      ANY_CORE     = -1;
+    static const unsigned MAX_POLICIES = 16;
+    static const unsigned MAX_TASKS    = 8;
+
+    struct Placement {
+        int         core;       // ANY_CORE for no affinity
+        UBaseType_t priority;
+        uint32_t    stackSize;
+    };
+
+    //
+    // Set the placement of the tasks of all devices of the specified class (e.g. "Coyote"),
+    // or of the device with the specified unique name. Device placements have precedence.
+    //
+    static bool setForClass(const char* cls, const Placement& placement);
+    static bool setForDevice(const char* name, const Placement& placement);
+
+    //
+    // Return the placement for the specified device, 'builtin' if none was set
+    //
+    static Placement get(const char* cls, const char* name, const Placement& builtin);
+
+    //
+    // A task created with a placement
+    //
+    struct Task;
+
+    //
+    // Create a task with the specified placement. '*task' is set before the task starts.
+    // Returns false if it cannot be created.
+    //
+    static bool createTask(TaskFunction_t fct, const char* name, void* arg, const Placement& placement,
+                           TaskHandle_t* handle, Task** task);
+
+    //
+    // To be called first thing in the task body
+    //
+    static void enter(Task* task);
+
+    //
+    // vTaskDelayUntil(), measuring the lateness of the wake-up if enabled
+    //
+    static void delayUntil(Task* task, TickType_t* lastWake, TickType_t ticks);
+
+    //
+    // Enable or disable the lateness measurements
+    //
+    static void measure(bool enable);
+
+    struct Report {
+        const char*   name;
+        Placement     placement;
+        unsigned long samples;
+        unsigned long overruns;     // Wake-ups whose target had already passed
+        long          avgLateUs;
+        long          maxLateUs;
+    };
+
+    //
+    // Fill up to 'max' entries, one per task. Returns the number of entries filled.
+    //
+    static unsigned report(Report* reports, unsigned max);
+    static void     resetStats();
+};
+
+}
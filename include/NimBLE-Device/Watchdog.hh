@@ -0,0 +1,120 @@
+//
+// NimBLE-Device health watchdog
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+
+namespace NimBLE {
+
+//
+// Heartbeats of a device, checked against their expected cadence.
+//
+// A periodic heartbeat (e.g. a completed transmit tick) is late if none was seen for 'lateMs',
+// and stalled after 'stallMs'. An awaited heartbeat (e.g. the acknowledgement of a power change)
+// is only checked while a response is awaited. Heartbeats are not checked until they are expected,
+// and periodic ones until the first beat.
+//
+// Beats can be recorded from any task. Checks must be done from a single task, other than the ones
+// being watched: a check only compares a few timestamps, so it can be done on every tick.
+//
+class Watchdog
+{
+public:
+    typedef enum {TICK, ACK, BATTERY} Heartbeat_t;
+    typedef enum {OK, LATE, STALLED} Status_t;
+
+    //
+    // What to do when a heartbeat stalls.
+    // RESET calls the device's recovery for that heartbeat (e.g. forget the awaited acknowledgement),
+    // RECONNECT disconnects the device, to be initialized again, EMERGENCY_STOP stops all devices.
+    //
+    typedef enum {REPORT, RESET, RECONNECT, EMERGENCY_STOP} Action_t;
+
+    static const unsigned NUM_HEARTBEATS = 3;
+
+    Watchdog();
+
+    //
+    // Expect the specified heartbeat. A 'lateMs' of 0 stops checking it.
+    //
+    void expect(Heartbeat_t hb, long lateMs, long stallMs, Action_t action, bool awaited = false);
+
+    //
+    // Record a heartbeat, which also answers an awaited one
+    //
+    void beat(Heartbeat_t hb);
+
+    //
+    // Await a heartbeat from now, unless already awaited. Forget an awaited heartbeat.
+    //
+    void await(Heartbeat_t hb);
+    void forget(Heartbeat_t hb);
+
+    //
+    // Forget all heartbeats seen so far, e.g. after a reconnection
+    //
+    void restart();
+
+    //
+    // Check all heartbeats. Returns the heartbeats that stalled since the last check, one bit each.
+    //
+    unsigned check(long nowInMs);
+
+    Status_t getStatus(Heartbeat_t hb) const;
+    Action_t getAction(Heartbeat_t hb) const;
+
+    static const char* getName(Heartbeat_t hb);
+
+    //
+    // Subscribe to status changes (optional). Called from the checking task.
+    //
+    void subscribe(std::function<void(Heartbeat_t hb, Status_t status, long elapsedMs)> fct);
+
+    struct Stats {
+        unsigned long beats;
+        unsigned long late;
+        unsigned long stalls;
+        long          maxGapMs;     // Largest interval between periodic beats, or response time
+    };
+
+    Stats getStats(Heartbeat_t hb) const;
+    void  resetStats();
+
+private:
+    struct Heart {
+        long                       lateMs;
+        long                       stallMs;
+        Action_t                   action;
+        bool                       awaited;
+
+        std::atomic<long>          lastMs;      // 0 if not seen yet
+        std::atomic<long>          sinceMs;     // Awaited since, 0 if not awaited
+        std::atomic<unsigned long> beats;
+        std::atomic<long>          maxGapMs;
+
+        // Only updated by check()
+        Status_t                   status;
+        unsigned long              late;
+        unsigned long              stalls;
+    };
+
+    Heart mHearts[NUM_HEARTBEATS];
+
+    std::function<void(Heartbeat_t, Status_t, long)> mStatusCb;
+};
+
+}
@@ -0,0 +1,125 @@
+//
+// NimBLE-Device prioritized write queue
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLEDevice.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace NimBLE {
+
+//
+// Writes to the characteristics of a connection, queued from any task and issued by a single writer.
+//
+// Writes are issued highest class first, in posting order within a class. A write can replace
+// the pending write of the same class to the same characteristic (latest value wins): it keeps
+// the place, and the posting time, of the write it replaces.
+//
+// Writes are cleared whenever the device is initialized again, as characteristics may have changed.
+//
+class WriteQueue
+{
+public:
+    typedef enum {SAFETY, POWER, WAVEFORM, CONFIG} Class_t;
+
+    static const unsigned NUM_CLASSES = 4;
+    static const unsigned MAX_PENDING = 4;      // Per class
+    static const size_t   MAX_DATA    = 20;     // Default ATT MTU payload
+
+    WriteQueue();
+    ~WriteQueue();
+
+    //
+    // Queue a write of 'len' bytes to the specified characteristic.
+    // If 'coalesce', replace the pending write of the same class to the same characteristic, if any.
+    // Returns false if the data is too long or the queue of that class is full.
+    //
+    bool post(Class_t cls, NimBLERemoteCharacteristic* chr, const uint8_t* data, size_t len,
+              bool coalesce = true, bool response = false);
+
+    //
+    // Issue all pending writes, including those posted meanwhile. Writes are issued by one task at a time:
+    // if another task is already flushing, it issues the pending writes instead.
+    // Returns the number of writes issued by the calling task.
+    //
+    unsigned flush();
+
+    //
+    // Drop all pending writes
+    //
+    void clear();
+
+    //
+    // Drop all pending writes and refuse power writes until release()
+    //
+    void hold();
+    void release();
+    bool isHeld() const;
+
+    //
+    // Issue a safety write right away from the calling task, after the write in progress (if any).
+    // Returns false if the write failed.
+    //
+    bool writeNow(NimBLERemoteCharacteristic* chr, const uint8_t* data, size_t len, bool response = false);
+
+    struct Stats {
+        unsigned long posted;
+        unsigned long coalesced;    // Writes replaced by a later one before being issued
+        unsigned long dropped;      // Writes posted while the queue was full or held, or dropped by hold()
+        unsigned long written;
+        unsigned long failed;
+        unsigned      depth;        // Currently pending
+        unsigned      maxDepth;
+        long          avgLatencyUs; // From posting to the end of the write
+        long          maxLatencyUs;
+    };
+
+    Stats getStats(Class_t cls) const;
+    void  resetStats();
+
+private:
+    struct Write {
+        NimBLERemoteCharacteristic* chr;
+        uint8_t                     data[MAX_DATA];
+        uint8_t                     len;
+        bool                        response;
+        int64_t                     postedUs;
+    };
+
+    struct Queue {
+        Write    writes[MAX_PENDING];
+        unsigned head;
+        unsigned size;
+        Stats    stats;
+        int64_t  sumLatencyUs;
+    };
+
+    SemaphoreHandle_t mMutex;
+    SemaphoreHandle_t mLink;        // Held while writing
+    std::atomic<bool> mFlushing;
+    Queue             mQueue[NUM_CLASSES];
+    bool              mHeld;
+
+    bool pop(Write& w, unsigned& cls);
+    bool pending() const;
+    void dropped(unsigned cls);
+    void written(unsigned cls, bool ok, int64_t latencyUs);
+};
+
+}
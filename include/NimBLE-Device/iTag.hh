@@ -14,6 +14,7 @@
 
 
 #include "NimBLE-Device.hh"
+#include "NimBLE-Device/LinkProbe.hh"
 
 namespace NimBLE {
 
@@ -40,13 +41,73 @@ public:
     //
     void setAlarm(AlarmSetting_t level);
 
+    //
+    // Link loss detection parameters.
+    // A short supervision timeout makes the link drop quickly once the tag is out of range (0 keeps the default connection parameters).
+    // In addition, the link is considered lost after 'missed' consecutive heartbeats, every 'heartbeatMs', are
+    // not answered within 'heartbeatMaxMs'. A heartbeat is a read of the battery level, answered on the host task:
+    // the service loop never waits for it. The tag sounds its own alarm at 'alertLevel' when it loses the link.
+    //
+    // Loss is detected at most 'missed' * 'heartbeatMs' + 'heartbeatMaxMs' after the last answer (1250ms by default),
+    // and by the supervision timeout otherwise: 2.56s with NimBLE's initial connection parameters.
+    // When the tag comes back, the alarm is raised for 'alarmMs' (never if 0).
+    //
+    struct LinkLoss {
+        long           supervisionMs;
+        long           intervalMs;
+        long           heartbeatMs;
+        long           heartbeatMaxMs;
+        unsigned       missed;
+        AlarmSetting_t alertLevel;
+        long           alarmMs;
+    };
+
+    void setLinkLoss(const LinkLoss& params);
+
+    //
+    // Subscribe to link loss (true) and return (false) events (optional)
+    //
+    void subscribeLinkLoss(std::function<void(bool lost)> fct);
+
+    //
+    // Link loss detection statistics, in ms from the last heartbeat answered
+    //
+    struct Stats {
+        unsigned long losses;           // Link losses detected, by heartbeat or disconnect
+        unsigned long heartbeats;       // Heartbeats answered
+        unsigned long missed;           // Heartbeats not answered in time
+        unsigned long returns;          // Reconnections after a loss
+        long          detectMs;         // Latency of the last loss detection
+        long          maxDetectMs;      // Worst loss detection latency
+        long          disconnectMs;     // Latency of the last disconnect notification, for comparison
+    };
+
+    Stats getStats();
+
+protected:
+    virtual void notifyEvent(uint8_t event)  override;
+
 private:
     bool doInitDevice()             override;
     void serviceLoop(long nowInMs)  override;
 
-    void notifyBattery(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify);
+    void notifyBattery(const uint8_t* pData, size_t length);
 
     NimBLERemoteCharacteristic* mAlarmChr;
+    NimBLERemoteCharacteristic* mBatteryChr;
+
+    LinkLoss  mParams;
+    bool      mLost;
+    LinkProbe mProbe;
+    long      mAlarmOffMs;
+    Stats     mStats;
+
+    std::function<void(bool lost)> mLinkLossCb;
+
+    void linkLost(long nowInMs);
+    void probe(long nowInMs);
+
+    static int onProbe(uint16_t connHandle, const ble_gatt_error* error, ble_gatt_attr* attr, void* arg);
 };
 
 }
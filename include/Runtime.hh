@@ -9,6 +9,14 @@
 
 #pragma once
 
+#include <cstdint>
+
+#if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_LINUX)
+#include "esp_timer.h"
+#else
+#include <chrono>
+#endif
+
 //
 // Abstract run-time functions.
 //
@@ -24,6 +32,20 @@ namespace RUNTIME {
 long nowInMs();
 
 
+//
+// Return a monotonic time, in usecs, for measurements. Provided on all platforms.
+//
+inline int64_t
+nowInUs()
+{
+#if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_LINUX)
+    return esp_timer_get_time();
+#else
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
 //
 // Mutex meeting the Lockable requirements
 //
@@ -0,0 +1,199 @@
+#include "NimBLE-Device/Accounting.hh"
+
+#include <atomic>
+#include <cstring>
+
+#if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_LINUX)
+#include "esp_heap_caps.h"
+#endif
+
+
+namespace {
+
+struct Account {
+    std::atomic<const NimBLE::InterestingDevice*> dev;
+    char                                         name[32];
+    std::atomic<size_t>                          containers;
+    std::atomic<size_t>                          peak;
+    size_t                                       heap;
+    unsigned                                     services;
+    unsigned                                     characteristics;
+    unsigned                                     descriptors;
+    size_t                                       attributes;
+    TaskHandle_t                                 task;
+    size_t                                       stackSize;
+};
+
+// Account 0 is the library itself
+Account sAccounts[NimBLE::Accounting::MAX_ACCOUNTS];
+
+thread_local uint8_t sCurrent = 0;
+
+// Allocations are prefixed with the index of the account they are charged to
+const size_t sHeader = alignof(std::max_align_t);
+
+
+//
+// Find the account of the specified device, opening one if necessary.
+// Returns 0 if all accounts are in use.
+//
+uint8_t
+account(const NimBLE::InterestingDevice* dev)
+{
+    for (uint8_t i = 1; i < NimBLE::Accounting::MAX_ACCOUNTS; i++) {
+        auto owner = sAccounts[i].dev.load();
+        if (owner == dev) return i;
+        if (owner != nullptr) continue;
+
+        if (sAccounts[i].dev.compare_exchange_strong(owner, dev)) {
+            strncpy(sAccounts[i].name, dev->getName(), sizeof(sAccounts[i].name) - 1);
+            return i;
+        }
+        if (owner == dev) return i;
+    }
+    return 0;
+}
+
+}
+
+
+NimBLE::Accounting::Scope::Scope(const InterestingDevice& dev)
+    : mPrevious(sCurrent)
+{
+    sCurrent = account(&dev);
+}
+
+
+NimBLE::Accounting::Scope::~Scope()
+{
+    sCurrent = mPrevious;
+}
+
+
+void*
+NimBLE::Accounting::allocate(size_t size)
+{
+    auto p = (uint8_t*) ::operator new(size + sHeader);
+    auto& acc = sAccounts[sCurrent];
+
+    *p = sCurrent;
+    size_t now  = (acc.containers += size);
+    size_t peak = acc.peak.load();
+    while (now > peak && !acc.peak.compare_exchange_weak(peak, now));
+
+    return p + sHeader;
+}
+
+
+void
+NimBLE::Accounting::deallocate(void* p, size_t size) noexcept
+{
+    if (p == nullptr) return;
+
+    auto base = (uint8_t*) p - sHeader;
+    sAccounts[*base].containers -= size;
+
+    ::operator delete(base);
+}
+
+
+size_t
+NimBLE::Accounting::freeHeap()
+{
+#if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_LINUX)
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+#else
+    return 0;
+#endif
+}
+
+
+void
+NimBLE::Accounting::connected(const InterestingDevice& dev, NimBLEClient* client, size_t freeHeapBefore)
+{
+    auto idx = account(&dev);
+    if (idx == 0) return;
+
+    auto&  acc  = sAccounts[idx];
+    size_t free = freeHeap();
+
+    acc.heap            = (freeHeapBefore > free) ? freeHeapBefore - free : 0;
+    acc.services        = 0;
+    acc.characteristics = 0;
+    acc.descriptors     = 0;
+    acc.attributes      = 0;
+    if (client == nullptr) return;
+
+    // Only walk what was already discovered
+    acc.attributes = sizeof(NimBLEClient);
+    for (auto svc : *client->getServices(false)) {
+        acc.services++;
+        acc.attributes += sizeof(NimBLERemoteService);
+        for (auto chr : *svc->getCharacteristics(false)) {
+            acc.characteristics++;
+            acc.attributes += sizeof(NimBLERemoteCharacteristic);
+
+            auto descs = chr->getDescriptors(false);
+            acc.descriptors += descs->size();
+            acc.attributes  += descs->size() * sizeof(NimBLERemoteDescriptor);
+        }
+    }
+}
+
+
+void
+NimBLE::Accounting::trackTask(const InterestingDevice& dev, TaskHandle_t task, size_t stackSize)
+{
+    auto idx = account(&dev);
+    if (idx == 0) return;
+
+    sAccounts[idx].task      = task;
+    sAccounts[idx].stackSize = stackSize;
+}
+
+
+unsigned
+NimBLE::Accounting::report(Usage* usage, unsigned max)
+{
+    unsigned n = 0;
+    for (unsigned i = 0; i < MAX_ACCOUNTS && n < max; i++) {
+        const auto& acc = sAccounts[i];
+        if (i > 0 && acc.dev.load() == nullptr) break;
+
+        Usage& u = usage[n++];
+        u.name            = (i == 0) ? "(library)" : acc.name;
+        u.heap            = acc.heap;
+        u.containers      = acc.containers;
+        u.containersPeak  = acc.peak;
+        u.services        = acc.services;
+        u.characteristics = acc.characteristics;
+        u.descriptors     = acc.descriptors;
+        u.attributes      = acc.attributes;
+        u.stackSize       = acc.stackSize;
+        u.stackFree       = (acc.task != nullptr) ? uxTaskGetStackHighWaterMark(acc.task) * sizeof(StackType_t) : 0;
+    }
+    return n;
+}
+
+
+NimBLE::Accounting::Usage
+NimBLE::Accounting::total()
+{
+    Usage usage[MAX_ACCOUNTS];
+    unsigned n = report(usage, MAX_ACCOUNTS);
+
+    Usage sum = {};
+    sum.name = "(total)";
+    for (unsigned i = 0; i < n; i++) {
+        sum.heap            += usage[i].heap;
+        sum.containers      += usage[i].containers;
+        sum.containersPeak  += usage[i].containersPeak;
+        sum.services        += usage[i].services;
+        sum.characteristics += usage[i].characteristics;
+        sum.descriptors     += usage[i].descriptors;
+        sum.attributes      += usage[i].attributes;
+        sum.stackSize       += usage[i].stackSize;
+        sum.stackFree       += usage[i].stackFree;
+    }
+    return sum;
+}
@@ -0,0 +1,170 @@
+
+#include "NimBLE-Device/Arena.hh"
+#include "esp_log.h"
+
+#include <atomic>
+#include <cstdlib>
+
+
+static std::atomic<bool>          sSealed(false);
+static std::atomic<unsigned long> sLate(0);
+static std::atomic<size_t>        sLateBytes(0);
+static std::atomic<unsigned long> sExhausted(0);
+static void                     (*sLateCb)(size_t) = nullptr;
+
+
+#ifdef CONFIG_NIMBLE_DEVICE_STATIC_ALLOC
+
+alignas(std::max_align_t) static unsigned char sArena[CONFIG_NIMBLE_DEVICE_ARENA_SIZE];
+static std::atomic<size_t>                     sUsed(0);
+
+
+void*
+NimBLE::Arena::allocate(size_t size, size_t align)
+{
+    size_t used = sUsed.load();
+    size_t start;
+    do {
+        start = (used + align - 1) & ~(align - 1);
+        if (start + size > sizeof(sArena)) {
+            sExhausted++;
+            ESP_LOGE("Arena", "Cannot allocate %u bytes: %u of %u used.", (unsigned) size, (unsigned) used, (unsigned) sizeof(sArena));
+            return nullptr;
+        }
+    } while (!sUsed.compare_exchange_weak(used, start + size));
+
+    return sArena + start;
+}
+
+
+bool
+NimBLE::Arena::createTask(TaskFunction_t fct, const char* name, uint32_t stackSize, void* arg, UBaseType_t prio, TaskHandle_t* handle,
+                          BaseType_t core)
+{
+    auto tcb   = (StaticTask_t*) allocate(sizeof(StaticTask_t), alignof(StaticTask_t));
+    auto stack = (StackType_t*) allocate(stackSize * sizeof(StackType_t), alignof(StackType_t));
+    if (tcb == nullptr || stack == nullptr) return false;
+
+#if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_LINUX)
+    *handle = xTaskCreateStaticPinnedToCore(fct, name, stackSize, arg, prio, stack, tcb, core);
+#else
+    *handle = xTaskCreateStatic(fct, name, stackSize, arg, prio, stack, tcb);
+#endif
+
+    return *handle != nullptr;
+}
+
+
+//
+// Count the heap allocations made after the initialization.
+// Only allocations through operator new are seen: C code calling malloc() directly is not.
+//
+void*
+operator new(size_t size)
+{
+    if (sSealed) {
+        sLate++;
+        sLateBytes += size;
+        if (sLateCb != nullptr) sLateCb(size);
+    }
+
+    void* p = malloc((size > 0) ? size : 1);
+    if (p == nullptr) abort();
+
+    return p;
+}
+
+
+void*
+operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+
+void
+operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+
+void
+operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+
+void
+operator delete(void* p, size_t size) noexcept
+{
+    free(p);
+}
+
+
+void
+operator delete[](void* p, size_t size) noexcept
+{
+    free(p);
+}
+
+#else
+
+void*
+NimBLE::Arena::allocate(size_t size, size_t align)
+{
+    return malloc(size);
+}
+
+
+bool
+NimBLE::Arena::createTask(TaskFunction_t fct, const char* name, uint32_t stackSize, void* arg, UBaseType_t prio, TaskHandle_t* handle,
+                          BaseType_t core)
+{
+#if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_LINUX)
+    return xTaskCreatePinnedToCore(fct, name, stackSize, arg, prio, handle, core) == pdPASS;
+#else
+    return xTaskCreate(fct, name, stackSize, arg, prio, handle) == pdPASS;
+#endif
+}
+
+#endif
+
+
+void
+NimBLE::Arena::seal()
+{
+    sSealed = true;
+}
+
+
+bool
+NimBLE::Arena::isSealed()
+{
+    return sSealed;
+}
+
+
+void
+NimBLE::Arena::subscribeLateAllocation(void (*fct)(size_t size))
+{
+    sLateCb = fct;
+}
+
+
+NimBLE::Arena::Stats
+NimBLE::Arena::getStats()
+{
+    Stats stats = {};
+
+#ifdef CONFIG_NIMBLE_DEVICE_STATIC_ALLOC
+    stats.used     = sUsed;
+    stats.capacity = sizeof(sArena);
+#endif
+    stats.exhausted = sExhausted;
+    stats.late      = sLate;
+    stats.lateBytes = sLateBytes;
+
+    return stats;
+}
@@ -0,0 +1,263 @@
+#include "NimBLE-Device/ConnectionBudget.hh"
+#include "Runtime.hh"
+
+
+NimBLE::ConnectionBudget::ConnectionBudget(unsigned maxConnections)
+    : mMutex(xSemaphoreCreateRecursiveMutex())
+    , mMembers()
+    , mMax(maxConnections)
+    , mCursor(0)
+    , mSliceMs(10000)
+    , mIdleMs(5000)
+    , mStats()
+    , mSumMs()
+{
+}
+
+
+NimBLE::ConnectionBudget::~ConnectionBudget()
+{
+    vSemaphoreDelete(mMutex);
+}
+
+
+NimBLE::ConnectionBudget::Member*
+NimBLE::ConnectionBudget::find(InterestingDevice* dev)
+{
+    for (auto& it : mMembers) {
+        if (it.dev == dev) return &it;
+    }
+    return nullptr;
+}
+
+
+void
+NimBLE::ConnectionBudget::add(InterestingDevice& dev, Priority_t prio)
+{
+    SemLockGuard lk(mMutex);
+
+    auto m = find(&dev);
+    if (m != nullptr) {
+        m->prio = prio;
+        return;
+    }
+    mMembers.push_back({&dev, prio, RUNTIME::nowInMs(), 0});
+}
+
+
+void
+NimBLE::ConnectionBudget::setSlices(long sliceMs, long idleMs)
+{
+    SemLockGuard lk(mMutex);
+
+    mSliceMs = sliceMs;
+    mIdleMs  = idleMs;
+}
+
+
+void
+NimBLE::ConnectionBudget::request(InterestingDevice& dev)
+{
+    SemLockGuard lk(mMutex);
+
+    auto m = find(&dev);
+    if (m == nullptr) return;
+
+    long now = RUNTIME::nowInMs();
+    if (devConnected(*m->dev)) {
+        // Extend its stay
+        if (m->prio == ON_DEMAND) m->sinceMs = now + mIdleMs;
+        return;
+    }
+    if (m->requestMs == 0) m->requestMs = (now != 0) ? now : 1;
+}
+
+
+bool
+NimBLE::ConnectionBudget::connect(Member& m, long nowInMs)
+{
+    long since = (m.requestMs != 0) ? m.requestMs : m.sinceMs;
+    auto& stats = mStats[m.prio];
+
+    // Connecting blocks: the time it takes is added to the caller's clock
+    long start = RUNTIME::nowInMs();
+    bool ok    = devInit(*m.dev);
+    long now   = nowInMs + (RUNTIME::nowInMs() - start);
+
+    if (!ok) {
+        stats.failures++;
+        // Try again later, behind the others
+        m.sinceMs = now;
+        return false;
+    }
+
+    long latency = now - since;
+
+    stats.connects++;
+    mSumMs[m.prio] += latency;
+    stats.avgLatencyMs = mSumMs[m.prio] / (long) stats.connects;
+    if (latency > stats.maxLatencyMs) stats.maxLatencyMs = latency;
+
+    m.requestMs = 0;
+    m.sinceMs   = now + ((m.prio == ON_DEMAND) ? mIdleMs : mSliceMs);
+
+    return true;
+}
+
+
+void
+NimBLE::ConnectionBudget::park(Member& m, long nowInMs)
+{
+    if (!devPark(*m.dev)) return;
+
+    mStats[m.prio].parks++;
+    m.sinceMs = nowInMs;
+}
+
+
+bool
+NimBLE::ConnectionBudget::parkVictim(Member* except, long nowInMs)
+{
+    // The connected device closest to the end of its time slice, if any
+    Member* victim = nullptr;
+    for (auto& it : mMembers) {
+        if (&it == except || it.prio == ALWAYS || it.requestMs != 0) continue;
+        if (!devConnected(*it.dev) || devParked(*it.dev)) continue;
+        if (victim == nullptr || it.sinceMs - victim->sinceMs < 0) victim = &it;
+    }
+    if (victim == nullptr) return false;
+
+    park(*victim, nowInMs);
+
+    return true;
+}
+
+
+void
+NimBLE::ConnectionBudget::service(long nowInMs)
+{
+    SemLockGuard lk(mMutex);
+
+    // Parked devices hold their connection until the disconnection completes
+    unsigned used = 0;
+    for (auto& it : mMembers) {
+        if (devLinkUp(*it.dev)) used++;
+    }
+
+    auto waiting = [this](Member& m) {
+        return devFound(*m.dev) && !devLinkUp(*m.dev);
+    };
+
+    // Devices that must always be connected, then requested devices, preempt the others
+    for (int pass = 0; pass < 2; pass++) {
+        for (auto& it : mMembers) {
+            if (!waiting(it)) continue;
+            if (pass == 0 && it.prio != ALWAYS) continue;
+            if (pass == 1 && it.requestMs == 0) continue;
+
+            if (used >= mMax) {
+                // Connect once a connection has been freed
+                parkVictim(&it, nowInMs);
+                return;
+            }
+            if (connect(it, nowInMs)) used++;
+        }
+    }
+
+    // Park idle on-demand devices
+    for (auto& it : mMembers) {
+        if (it.prio != ON_DEMAND || !devConnected(*it.dev) || devParked(*it.dev)) continue;
+        if (nowInMs - it.sinceMs >= 0) park(it, nowInMs);
+    }
+
+    // Rotate time-sliced devices
+    if (mMembers.empty()) return;
+    for (unsigned n = 0; n < mMembers.size(); n++) {
+        Member& m = mMembers[mCursor % mMembers.size()];
+
+        if (m.prio != TIME_SLICED || !waiting(m)) {
+            mCursor = (mCursor + 1) % mMembers.size();
+            continue;
+        }
+
+        if (used < mMax) {
+            if (connect(m, nowInMs)) used++;
+            mCursor = (mCursor + 1) % mMembers.size();
+            continue;
+        }
+
+        // Take the turn of a device whose time slice has expired.
+        // The cursor stays on this device: the freed connection is its own once the disconnection completes.
+        for (auto& it : mMembers) {
+            if (it.prio != TIME_SLICED || !devConnected(*it.dev) || devParked(*it.dev)) continue;
+            if (nowInMs - it.sinceMs < 0) continue;
+
+            park(it, nowInMs);
+            break;
+        }
+        break;
+    }
+}
+
+
+NimBLE::ConnectionBudget::Stats
+NimBLE::ConnectionBudget::getStats(Priority_t prio)
+{
+    SemLockGuard lk(mMutex);
+
+    return mStats[prio];
+}
+
+
+void
+NimBLE::ConnectionBudget::resetStats()
+{
+    SemLockGuard lk(mMutex);
+
+    for (unsigned i = 0; i < 3; i++) {
+        mStats[i] = {};
+        mSumMs[i] = 0;
+    }
+}
+
+
+bool
+NimBLE::ConnectionBudget::devFound(InterestingDevice& dev)
+{
+    return dev.wasFound();
+}
+
+
+bool
+NimBLE::ConnectionBudget::devLinkUp(InterestingDevice& dev)
+{
+    return dev.isLinkUp();
+}
+
+
+bool
+NimBLE::ConnectionBudget::devConnected(InterestingDevice& dev)
+{
+    return dev.isConnected();
+}
+
+
+bool
+NimBLE::ConnectionBudget::devParked(InterestingDevice& dev)
+{
+    return dev.isParked();
+}
+
+
+bool
+NimBLE::ConnectionBudget::devInit(InterestingDevice& dev)
+{
+    return dev.initDevice();
+}
+
+
+bool
+NimBLE::ConnectionBudget::devPark(InterestingDevice& dev)
+{
+    return dev.park();
+}
@@ -14,6 +14,10 @@
 //
 
 #include "NimBLE-Device/Coyote.hh"
+#include "NimBLE-Device/Coyote-Sync.hh"
+#include "NimBLE-Device/Accounting.hh"
+#include "NimBLE-Device/TaskPolicy.hh"
+#include "Runtime.hh"
 
 
 using namespace NimBLE::COYOTE;
@@ -21,65 +25,100 @@ using namespace NimBLE::COYOTE;
 
 NimBLE::COYOTE::Channel::Channel(Device *parent, const char* name)
     : mDevice(parent)
-    , mName(name)
-    , mMaxPower(100)
-    , mSetPower(0)
-    , mSentPower(0)
-    , mPower()
-    , mSafeMode(true)
+    , mName()
+    , mState()
 {
+    snprintf(mName, sizeof(mName), "%s.%s", parent->getName(), name);
+
+    mState.update([](State& s) {
+        s = {0, 0, 0, 100, true, false};
+    });
 }
 
 
-std::string
-NimBLE::COYOTE::Channel::getName()
+const char*
+NimBLE::COYOTE::Channel::getName() const
 {
-    return std::string(mDevice->getName()) + "." + mName;
+    return mName;
+}
+
+
+NimBLE::COYOTE::Device&
+NimBLE::COYOTE::Channel::getDevice()
+{
+    return *mDevice;
 }
 
 
 void
 NimBLE::COYOTE::Channel::setPower(uint8_t val, bool unsafe)
 {
-    if (val > mMaxPower) {
-        ESP_LOGI(getName().c_str(), "Rejecting power setting %d > MAX.", val);
-        return;
-    }
+    typedef enum {SET, LATCHED, ABOVE_MAX, JUMP_SET, JUMP_POWER} Check_t;
 
-    mSafeMode = !unsafe;
+    bool    safe  = !unsafe;
+    Check_t check = SET;
+    State   state;
 
-    if (mSafeMode) {
-        // If we ask for too much of a jump, it's probably a bug
-        if (mSetPower < val && val > 50 && mSetPower - val > 10) {
-            ESP_LOGI(getName().c_str(), "(1) Rejecting power setting %d -> %d.", mSetPower, val);
-            return;
-        }
+    // Checked and set at once: an emergency stop in between would have its power setting overwritten.
+    // Updates cannot log, so rejections are reported once done.
+    mState.update([val, safe, &check, &state](State& s) {
+        state = s;
+
+        if (s.latched) check = LATCHED;
+        else if (val > s.maxPower) check = ABOVE_MAX;
         // If we ask for too much of a jump, it's probably a bug
-        if (mPower < val && val > 50 && mPower - val > 10) {
-            ESP_LOGI(getName().c_str(), "(2) Rejecting power setting %d -> %d.", mSetPower, val);
-            return;
-        }
+        else if (safe && s.setPower < val && val > 50 && s.setPower - val > 10) check = JUMP_SET;
+        else if (safe && s.power < val && val > 50 && s.power - val > 10) check = JUMP_POWER;
+        if (check != SET) return;
+
+        s.setPower = val;
+        s.safeMode = safe;
+    });
+
+    switch (check) {
+    case LATCHED:
+        ESP_LOGI(getName(), "Rejecting power setting %d: emergency stop.", val);
+        return;
+    case ABOVE_MAX:
+        ESP_LOGI(getName(), "Rejecting power setting %d > MAX.", val);
+        return;
+    case JUMP_SET:
+        ESP_LOGI(getName(), "(1) Rejecting power setting %d -> %d.", state.setPower, val);
+        return;
+    case JUMP_POWER:
+        ESP_LOGI(getName(), "(2) Rejecting power setting %d -> %d.", state.setPower, val);
+        return;
+    case SET:
+        break;
     }
-    
-    ESP_LOGI(getName().c_str(), "power set to %d", val);
-    mSetPower = val;
+
+    ESP_LOGI(getName(), "power set to %d", val);
 }
 
 
 void
 NimBLE::COYOTE::Channel::incrementPower(int delta)
 {
-    if (delta < 0 && -delta > mPower) setPower(0);
-    else setPower(mSetPower + delta);
+    auto state = mState.read();
 
-    ESP_LOGI(getName().c_str(), "Incremented power by %d: %d", delta, mSetPower);
+    if (delta < 0 && -delta > state.power) setPower(0);
+    else setPower(state.setPower + delta);
+
+    ESP_LOGI(getName(), "Incremented power by %d: %d", delta, mState.read().setPower);
 }
 
 
 uint8_t
 NimBLE::COYOTE::Channel::getPower()
 {
-    return mPower;
+    return mState.read().power;
+}
+
+
+NimBLE::COYOTE::Channel::State
+NimBLE::COYOTE::Channel::getState() const
+{
+    return mState.read();
 }
 
 
@@ -93,15 +132,45 @@ NimBLE::COYOTE::Channel::subscribePower(std::function<void(uint8_t)> fct)
 void
 NimBLE::COYOTE::Channel::updatePower(uint8_t power)
 {
+    // Subscribers see the new power in the state
+    mState.update([power](State& s) {
+        s.power = power;
+    });
     if (mPowerCb) mPowerCb(power);
-    mPower = power;
 }
 
 bool
 NimBLE::COYOTE::Channel::powerUpdateReq(uint8_t& pow)
 {
-    pow = mSetPower;
-    return pow != mSentPower;
+    auto state = mState.read();
+
+    pow = state.setPower;
+    return pow != state.sentPower;
+}
+
+void
+NimBLE::COYOTE::Channel::powerSent(uint8_t pow)
+{
+    mState.update([pow](State& s) {
+        s.sentPower = pow;
+    });
+}
+
+void
+NimBLE::COYOTE::Channel::limitPower(uint16_t max)
+{
+    mState.update([max](State& s) {
+        s.maxPower = max;
+    });
+}
+
+void
+NimBLE::COYOTE::Channel::latch(bool on)
+{
+    mState.update([on](State& s) {
+        s.latched = on;
+        if (on) s.setPower = 0;
+    });
 }
 
 void
@@ -119,15 +188,32 @@ NimBLE::COYOTE::Channel::stop()
 NimBLE::COYOTE::Device::Device(const char* uniqueName, const char* bleName, const char* macAddr)
     : InterestingDevice(uniqueName, bleName, macAddr, 1)
     , mChannel{nullptr, nullptr}
+    , mTaskHandle(nullptr)
+    , mTask(nullptr)
+    , mLastWake(0)
+    , mTick(0)
+    , mSync(nullptr)
+    , mSyncMutex(xSemaphoreCreateRecursiveMutex())
+    , mInputMs(0)
+    , mLatencyMutex(xSemaphoreCreateRecursiveMutex())
+    , mLatencyListeners()
 {
     ESP_LOGI("Coyote", "%s %s %s", uniqueName, bleName, macAddr);
+
+    // A tick every 100 ms. Disconnecting would leave the device idle until reinitialized:
+    // only report a stalled transmit task, the application can choose another action.
+    mWatchdog.expect(Watchdog::TICK, 250, 2000, Watchdog::REPORT);
 }
 
 
 NimBLE::COYOTE::Device::~Device()
 {
-    if (mChannel[0] != nullptr) delete mChannel[0];
-    if (mChannel[1] != nullptr) delete mChannel[1];
+    auto sync = mSync.load();
+    if (sync != nullptr) sync->remove(*this);
+    Arena::destroy(mChannel[0]);
+    Arena::destroy(mChannel[1]);
+    vSemaphoreDelete(mSyncMutex);
+    vSemaphoreDelete(mLatencyMutex);
 }
 
 
@@ -137,8 +223,24 @@ NimBLE::COYOTE::Device::doInitDevice()
     mClient->discoverAttributes();
     if (!initCoyoteDevice()) return false;
 
+    // Channels created since an emergency stop are latched too
+    if (mWrites.isHeld()) {
+        mChannel[0]->latch(true);
+        mChannel[1]->latch(true);
+    }
+
     ESP_LOGI(getName(), "Connected!");
-    xTaskCreate(&runTask, getName(), 8192, this, 5, &mTaskHandle);
+
+    // The transmit task outlives disconnections: it is only created on the first connection
+    if (mTaskHandle != nullptr) return true;
+
+    auto placement = TaskPolicy::get("Coyote", getName(), {TaskPolicy::ANY_CORE, 5, 8192});
+    if (!TaskPolicy::createTask(&runTask, getName(), this, placement, &mTaskHandle, &mTask)) {
+        ESP_LOGE(getName(), "Cannot create transmit task.");
+        mTaskHandle = nullptr;
+        return false;
+    }
+    Accounting::trackTask(*this, mTaskHandle, placement.stackSize);
 
     return true;
 }
@@ -158,9 +260,33 @@ NimBLE::COYOTE::Device::getChannelB()
 }
 
 
+bool
+NimBLE::COYOTE::Device::latchStop()
+{
+    for (auto it : mChannel) {
+        if (it != nullptr) it->latch(true);
+    }
+    mWrites.hold();
+
+    return true;
+}
+
+
 void
-NimBLE::COYOTE::Device::notifyBattery(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify)
+NimBLE::COYOTE::Device::releaseStop()
 {
+    mWrites.release();
+    for (auto it : mChannel) {
+        if (it != nullptr) it->latch(false);
+    }
+}
+
+
+void
+NimBLE::COYOTE::Device::notifyBattery(const uint8_t* pData, size_t length)
+{
+    if (length < 1) return;
+
     uint8_t battery = pData[0];
 
     notifyBatteryLevel(battery);
@@ -171,16 +297,103 @@ void
 NimBLE::COYOTE::Device::runTask(void *pvParameter)
 {
     auto dev = (NimBLE::COYOTE::Device*) pvParameter;
+
+    TaskPolicy::enter(dev->mTask);
     
-    auto xLastWakeTime = xTaskGetTickCount();
+    dev->mLastWake = xTaskGetTickCount();
+    dev->mTick     = 0;
+
+    // There is no point in starting right away... let's wait 1 sec, or for the shared clock
+    bool synced;
+    {
+        SemLockGuard lk(dev->mSyncMutex);
 
-    // There is no point in starting right away... let's wait 1 sec
-    vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(1000));
+        auto sync = dev->mSync.load();
+        synced    = sync != nullptr && sync->wait(*dev, dev->mTask, dev->mLastWake, dev->mTick);
+    }
+    if (!synced) vTaskDelayUntil(&dev->mLastWake, pdMS_TO_TICKS(1000));
 
     dev->run();
 }
 
 
+void
+NimBLE::COYOTE::Device::beginTick()
+{
+    SemLockGuard lk(mSyncMutex);
+
+    auto sync = mSync.load();
+    if (sync != nullptr) sync->apply(*this, mTick);
+}
+
+
+void
+NimBLE::COYOTE::Device::frameSent(long startMs, long phaseMs)
+{
+    long endMs = RUNTIME::nowInMs();
+
+    mWatchdog.beat(Watchdog::TICK);
+
+    {
+        SemLockGuard lk(mSyncMutex);
+
+        auto sync = mSync.load();
+        if (sync != nullptr) sync->sent(*this, mTick, startMs, endMs - phaseMs);
+    }
+
+    long inputMs = mInputMs.exchange(0);
+    if (inputMs != 0) {
+        SemLockGuard lk(mLatencyMutex);
+
+        for (auto& it : mLatencyListeners) it.fct(endMs - inputMs);
+    }
+}
+
+
+void
+NimBLE::COYOTE::Device::waitTick(unsigned ms)
+{
+    {
+        SemLockGuard lk(mSyncMutex);
+
+        auto sync = mSync.load();
+        if (sync != nullptr && sync->wait(*this, mTask, mLastWake, mTick)) return;
+    }
+
+    TaskPolicy::delayUntil(mTask, &mLastWake, pdMS_TO_TICKS(ms));
+    mTick++;
+}
+
+
+void
+NimBLE::COYOTE::Device::traceInput(long inputMs)
+{
+    long none = 0;
+    mInputMs.compare_exchange_strong(none, inputMs);
+}
+
+
+void
+NimBLE::COYOTE::Device::subscribeLatency(std::function<void(long latencyMs)> fct, const void* owner)
+{
+    SemLockGuard lk(mLatencyMutex);
+
+    mLatencyListeners.push_back({owner, fct});
+}
+
+
+void
+NimBLE::COYOTE::Device::unsubscribeLatency(const void* owner)
+{
+    SemLockGuard lk(mLatencyMutex);
+
+    for (auto it = mLatencyListeners.begin(); it != mLatencyListeners.end();) {
+        if (it->owner == owner) it = mLatencyListeners.erase(it);
+        else it++;
+    }
+}
+
+
 void
 NimBLE::COYOTE::Device::serviceLoop(long nowInMs)
 {
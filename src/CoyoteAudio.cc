@@ -0,0 +1,242 @@
+//
+// Implementation of audio-to-intensity streaming for Dungeon Labs Coyote channels
+//
+// WARNING: USE AT YOUR OWN RISK
+//
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#include "NimBLE-Device/Coyote-Audio.hh"
+#include "Runtime.hh"
+
+
+NimBLE::COYOTE::AudioStream::AudioStream(unsigned sampleRate, unsigned maxSlots, unsigned slotMs)
+    : mMutex(xSemaphoreCreateRecursiveMutex())
+    , mSlotLen(sampleRate * slotMs / 1000)
+    , mSlotMs(slotMs)
+    , mQuiet(100)
+    , mLoud(10)
+    , mPartial()
+    , mRing((maxSlots) ? maxSlots : 1)
+    , mHead(0)
+    , mCount(0)
+    , mStats()
+{
+    if (mSlotLen == 0) mSlotLen = 1;
+    mPartial.reserve(mSlotLen);
+
+    for (unsigned i = 0; i < 256; i++) mCurve[i] = (i < 8) ? 0 : i * 100 / 255;
+}
+
+
+NimBLE::COYOTE::AudioStream::~AudioStream()
+{
+    vSemaphoreDelete(mMutex);
+}
+
+
+void
+NimBLE::COYOTE::AudioStream::setCurve(const uint8_t curve[256])
+{
+    SemLockGuard lk(mMutex);
+
+    for (unsigned i = 0; i < 256; i++) mCurve[i] = (curve[i] > 100) ? 100 : curve[i];
+}
+
+
+void
+NimBLE::COYOTE::AudioStream::setPeriod(uint16_t quiet, uint16_t loud)
+{
+    SemLockGuard lk(mMutex);
+
+    mQuiet = quiet;
+    mLoud  = loud;
+}
+
+
+uint8_t
+NimBLE::COYOTE::AudioStream::level(const int16_t* pcm, size_t n)
+{
+    if (n == 0) return 0;
+
+    // Kept branch-free so the compiler can vectorize it
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += (int32_t) pcm[i] * pcm[i];
+
+    uint32_t meanSq = sum / n;
+
+    // Integer square root
+    uint32_t rms = 0;
+    for (uint32_t bit = 1u << 30; bit != 0; bit >>= 2) {
+        if (meanSq >= rms + bit) {
+            meanSq -= rms + bit;
+            rms     = (rms >> 1) + bit;
+        } else {
+            rms >>= 1;
+        }
+    }
+
+    return (rms > 32767) ? 255 : rms >> 7;
+}
+
+
+size_t
+NimBLE::COYOTE::AudioStream::push(const int16_t* pcm, size_t n)
+{
+    SemLockGuard lk(mMutex);
+
+    // A 25ms block takes well under a ms to process
+    long    start   = RUNTIME::nowInMs();
+    int64_t startUs = RUNTIME::nowInUs();
+
+    size_t left = n;
+
+    // Complete a partial slot first
+    if (mPartial.size() > 0) {
+        size_t k = mSlotLen - mPartial.size();
+        if (k > left) k = left;
+        mPartial.insert(mPartial.end(), pcm, pcm + k);
+        pcm  += k;
+        left -= k;
+
+        if (mPartial.size() == mSlotLen) {
+            addSlot(level(mPartial.data(), mSlotLen), start);
+            mPartial.clear();
+        }
+    }
+
+    // Whole slots are processed in place
+    while (left >= mSlotLen) {
+        addSlot(level(pcm, mSlotLen), start);
+        pcm  += mSlotLen;
+        left -= mSlotLen;
+    }
+
+    mPartial.insert(mPartial.end(), pcm, pcm + left);
+
+    mStats.samples   += n;
+    mStats.processUs += RUNTIME::nowInUs() - startUs;
+
+    return n;
+}
+
+
+size_t
+NimBLE::COYOTE::AudioStream::push(FILE* fp, size_t maxSamples)
+{
+    int16_t buf[256];
+    size_t  total = 0;
+
+    size_t max = room() * mSlotLen;
+    if (max > maxSamples) max = maxSamples;
+
+    while (total < max) {
+        size_t k = max - total;
+        if (k > sizeof(buf) / sizeof(buf[0])) k = sizeof(buf) / sizeof(buf[0]);
+
+        k = fread(buf, sizeof(buf[0]), k, fp);
+        if (k == 0) break;
+
+        push(buf, k);
+        total += k;
+    }
+
+    return total;
+}
+
+
+unsigned
+NimBLE::COYOTE::AudioStream::room()
+{
+    SemLockGuard lk(mMutex);
+
+    return mRing.size() - mCount;
+}
+
+
+void
+NimBLE::COYOTE::AudioStream::addSlot(uint8_t level, long stamp)
+{
+    if (mCount == mRing.size()) {
+        // Drop the oldest slot to bound the latency
+        mHead = (mHead + 1) % mRing.size();
+        mCount--;
+        mStats.overruns++;
+    }
+
+    mRing[(mHead + mCount) % mRing.size()] = {level, stamp};
+    mCount++;
+    mStats.slots++;
+}
+
+
+void
+NimBLE::COYOTE::AudioStream::reset()
+{
+    SemLockGuard lk(mMutex);
+
+    mPartial.clear();
+    mHead  = 0;
+    mCount = 0;
+}
+
+
+bool
+NimBLE::COYOTE::AudioStream::next(unsigned tickMs, Sample& s)
+{
+    SemLockGuard lk(mMutex);
+
+    // A tick longer than a slot plays the loudest of the slots it covers
+    unsigned n = (tickMs > mSlotMs) ? tickMs / mSlotMs : 1;
+    int      lvl = -1;
+    long     stamp = 0;
+
+    while (n-- && mCount > 0) {
+        auto& slot = mRing[mHead];
+        if (slot.level > lvl) lvl = slot.level;
+        stamp = slot.stamp;
+
+        mHead = (mHead + 1) % mRing.size();
+        mCount--;
+        mStats.played++;
+    }
+
+    if (lvl < 0) {
+        mStats.underruns++;
+        s.period    = mQuiet;
+        s.intensity = 0;
+        return true;
+    }
+
+    s.period    = mQuiet + ((int) mLoud - (int) mQuiet) * lvl / 255;
+    s.intensity = mCurve[lvl];
+
+    mStats.latencyMs = RUNTIME::nowInMs() - stamp;
+    if (mStats.latencyMs > mStats.maxLatencyMs) mStats.maxLatencyMs = mStats.latencyMs;
+
+    return true;
+}
+
+
+NimBLE::COYOTE::AudioStream::Stats
+NimBLE::COYOTE::AudioStream::getStats()
+{
+    SemLockGuard lk(mMutex);
+
+    return mStats;
+}
+
+
+void
+NimBLE::COYOTE::AudioStream::resetStats()
+{
+    SemLockGuard lk(mMutex);
+
+    mStats = Stats();
+}
@@ -0,0 +1,260 @@
+//
+// Implementation of input bindings to Dungeon Labs Coyote controls
+//
+// WARNING: USE AT YOUR OWN RISK
+//
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#include "NimBLE-Device/Coyote-Bindings.hh"
+#include "Runtime.hh"
+
+#include <algorithm>
+#include <climits>
+
+
+using namespace NimBLE::COYOTE;
+
+
+static uint32_t
+tableKey(unsigned idx, uint8_t key, uint8_t trigger)
+{
+    return (idx << 16) | (key << 8) | trigger;
+}
+
+
+NimBLE::COYOTE::Bindings::Bindings()
+    : mMutex(xSemaphoreCreateRecursiveMutex())
+    , mInputs()
+    , mDevices()
+    , mTable()
+    , mV2Waves()
+    , mV3Waves()
+    , mFcts()
+    , mStats()
+    , mSumMs(0)
+{
+    resetStats();
+}
+
+
+NimBLE::COYOTE::Bindings::~Bindings()
+{
+    for (auto it : mDevices) it->unsubscribeLatency(this);
+    vSemaphoreDelete(mMutex);
+}
+
+
+int
+NimBLE::COYOTE::Bindings::inputIdx(Keyboard::Device& input)
+{
+    for (unsigned i = 0; i < mInputs.size(); i++) {
+        if (mInputs[i] == &input) return i;
+    }
+    if (mInputs.size() > 0xFFFF) return -1;
+
+    // First binding on this input device: route its events and gestures through the table
+    unsigned idx = mInputs.size();
+    mInputs.push_back(&input);
+
+    input.subscribe([this, idx](uint8_t key, Keyboard::Device::Event_t e) {
+        dispatch(idx, key, (e == Keyboard::Device::PRESSED) ? PRESS : RELEASE);
+    });
+    input.subscribeGestures([this, idx](uint8_t key, Keyboard::Device::Gesture_t g) {
+        dispatch(idx, key, (Trigger_t) (TAP + (g - Keyboard::Device::TAP)));
+    });
+
+    return idx;
+}
+
+
+bool
+NimBLE::COYOTE::Bindings::add(Keyboard::Device& input, uint8_t key, Trigger_t trigger, Channel* ch, Op_t op, int arg, unsigned idx)
+{
+    SemLockGuard lk(mMutex);
+
+    int in = inputIdx(input);
+    if (in < 0) return false;
+
+    if (ch != nullptr) {
+        Device* dev = &ch->getDevice();
+        if (std::find(mDevices.begin(), mDevices.end(), dev) == mDevices.end()) {
+            mDevices.push_back(dev);
+            dev->subscribeLatency([this](long ms) {latency(ms);}, this);
+        }
+    }
+
+    // Keep the table sorted, with bindings for the same trigger in the order they were added
+    Binding b = {tableKey(in, key, trigger), op, ch, arg, idx};
+    auto pos = std::upper_bound(mTable.begin(), mTable.end(), b.key,
+                                [](uint32_t k, const Binding& it) {return k < it.key;});
+    mTable.insert(pos, b);
+
+    return true;
+}
+
+
+bool
+NimBLE::COYOTE::Bindings::bind(Keyboard::Device& input, uint8_t key, Trigger_t trigger, Channel& ch, Action_t action, int arg)
+{
+    switch (action) {
+    case INCREMENT_POWER: return add(input, key, trigger, &ch, POWER_INC, arg);
+    case SET_POWER:
+        if (arg < 0 || arg > 200) return false;
+        return add(input, key, trigger, &ch, POWER_SET, arg);
+    case START:           return add(input, key, trigger, &ch, PLAY, arg);
+    case STOP:            return add(input, key, trigger, &ch, HALT, arg);
+    case EMERGENCY_STOP:  return add(input, key, trigger, &ch, ESTOP, arg);
+    }
+    return false;
+}
+
+
+bool
+NimBLE::COYOTE::Bindings::bind(Keyboard::Device& input, uint8_t key, Trigger_t trigger, Channel& ch, const V2::Waveform& wave, uint8_t power)
+{
+    if (wave.empty()) return false;
+
+    SemLockGuard lk(mMutex);
+
+    mV2Waves.push_back(wave);
+    return add(input, key, trigger, &ch, WAVE_V2, power, mV2Waves.size() - 1);
+}
+
+
+bool
+NimBLE::COYOTE::Bindings::bind(Keyboard::Device& input, uint8_t key, Trigger_t trigger, Channel& ch, const V3::Waveform& wave, uint8_t power)
+{
+    if (wave.empty()) return false;
+
+    SemLockGuard lk(mMutex);
+
+    mV3Waves.push_back(wave);
+    return add(input, key, trigger, &ch, WAVE_V3, power, mV3Waves.size() - 1);
+}
+
+
+bool
+NimBLE::COYOTE::Bindings::bind(Keyboard::Device& input, uint8_t key, Trigger_t trigger, std::function<void()> fct)
+{
+    if (!fct) return false;
+
+    SemLockGuard lk(mMutex);
+
+    mFcts.push_back(fct);
+    return add(input, key, trigger, nullptr, CALL, 0, mFcts.size() - 1);
+}
+
+
+void
+NimBLE::COYOTE::Bindings::unbind(Keyboard::Device& input, uint8_t key, Trigger_t trigger)
+{
+    SemLockGuard lk(mMutex);
+
+    int in = inputIdx(input);
+    if (in < 0) return;
+
+    // Waveforms and functions are left in their tables: indices of other bindings remain valid
+    uint32_t k = tableKey(in, key, trigger);
+    mTable.erase(std::remove_if(mTable.begin(), mTable.end(), [k](const Binding& it) {return it.key == k;}), mTable.end());
+}
+
+
+void
+NimBLE::COYOTE::Bindings::dispatch(unsigned idx, uint8_t key, Trigger_t trigger)
+{
+    long now = RUNTIME::nowInMs();
+
+    SemLockGuard lk(mMutex);
+
+    uint32_t k = tableKey(idx, key, trigger);
+    auto it = std::lower_bound(mTable.begin(), mTable.end(), k,
+                               [](const Binding& b, uint32_t k) {return b.key < k;});
+    if (it == mTable.end() || it->key != k) {
+        mStats.unbound++;
+        return;
+    }
+
+    mStats.dispatched++;
+    for (; it != mTable.end() && it->key == k; it++) execute(*it, now);
+}
+
+
+void
+NimBLE::COYOTE::Bindings::execute(const Binding& b, long nowInMs)
+{
+    mStats.actions++;
+
+    switch (b.op) {
+    case POWER_INC: b.ch->incrementPower(b.arg);               break;
+    case POWER_SET: b.ch->setPower(b.arg);                     break;
+    case WAVE_V2:   b.ch->setWaveform(mV2Waves[b.idx], b.arg); break;
+    case WAVE_V3:   b.ch->setWaveform(mV3Waves[b.idx], b.arg); break;
+    case PLAY:      b.ch->start(b.arg);                        break;
+    case HALT:      b.ch->stop();                              break;
+    case ESTOP:     emergencyStop();                           break;
+    case CALL:      mFcts[b.idx]();                            break;
+    }
+
+    if (b.ch != nullptr) b.ch->getDevice().traceInput(nowInMs);
+}
+
+
+void
+NimBLE::COYOTE::Bindings::emergencyStop()
+{
+    long now = RUNTIME::nowInMs();
+
+    InterestingDevice::emergencyStop();
+
+    SemLockGuard lk(mMutex);
+
+    for (auto& it : mTable) {
+        if (it.ch == nullptr) continue;
+        it.ch->stop();
+        it.ch->getDevice().traceInput(now);
+    }
+}
+
+
+void
+NimBLE::COYOTE::Bindings::latency(long ms)
+{
+    SemLockGuard lk(mMutex);
+
+    mStats.measured++;
+    mStats.lastMs = ms;
+    if (ms < mStats.minMs) mStats.minMs = ms;
+    if (ms > mStats.maxMs) mStats.maxMs = ms;
+    mSumMs += ms;
+    mStats.avgMs = mSumMs / (long) mStats.measured;
+}
+
+
+NimBLE::COYOTE::Bindings::Stats
+NimBLE::COYOTE::Bindings::getStats()
+{
+    SemLockGuard lk(mMutex);
+
+    Stats stats = mStats;
+    if (stats.measured == 0) stats.minMs = 0;
+
+    return stats;
+}
+
+
+void
+NimBLE::COYOTE::Bindings::resetStats()
+{
+    SemLockGuard lk(mMutex);
+
+    mStats       = {};
+    mStats.minMs = LONG_MAX;
+    mSumMs       = 0;
+}
@@ -0,0 +1,375 @@
+//
+// Implementation of synchronized playback across multiple Dungeon Labs Coyote devices
+//
+// WARNING: USE AT YOUR OWN RISK
+//
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#include "NimBLE-Device/Coyote-Sync.hh"
+#include "Runtime.hh"
+
+
+using namespace NimBLE::COYOTE;
+
+
+// All Coyote devices send one frame every 100ms
+static const unsigned sTickMs = 100;
+
+
+NimBLE::COYOTE::SyncGroup::SyncGroup()
+    : mMutex(xSemaphoreCreateRecursiveMutex())
+    , mMembers()
+    , mChannels()
+    , mActions()
+    , mRunning(false)
+    , mEpoch(0)
+    , mEpochMs(0)
+    , mMaxSkew(0)
+    , mLate(0)
+{
+}
+
+
+NimBLE::COYOTE::SyncGroup::~SyncGroup()
+{
+    // Each device leaves once its transmit task is done with the group
+    while (true) {
+        Device* dev;
+        {
+            SemLockGuard lk(mMutex);
+
+            if (mMembers.empty()) break;
+            dev = mMembers.front().dev;
+        }
+        remove(*dev);
+    }
+    vSemaphoreDelete(mMutex);
+}
+
+
+NimBLE::COYOTE::SyncGroup::Member*
+NimBLE::COYOTE::SyncGroup::find(Device* dev)
+{
+    for (auto& it : mMembers) {
+        if (it.dev == dev) return &it;
+    }
+    return nullptr;
+}
+
+
+bool
+NimBLE::COYOTE::SyncGroup::join(Device& dev, bool allChannels)
+{
+    // Always lock the device before the group, as its transmit task does
+    SemLockGuard dl(dev.mSyncMutex);
+    SemLockGuard lk(mMutex);
+
+    auto m = find(&dev);
+    if (m == nullptr) {
+        if (dev.mSync.load() != nullptr) return false;
+
+        mMembers.push_back({&dev, false, 0, 0, 0});
+        dev.mSync = this;
+        m = &mMembers.back();
+    }
+    if (!allChannels) return true;
+
+    m->allChannels = true;
+    for (auto it : dev.mChannel) addChannel(it);
+
+    return true;
+}
+
+
+void
+NimBLE::COYOTE::SyncGroup::addChannel(Channel* ch)
+{
+    if (ch == nullptr) return;
+
+    for (auto it : mChannels) {
+        if (it == ch) return;
+    }
+    mChannels.push_back(ch);
+}
+
+
+bool
+NimBLE::COYOTE::SyncGroup::add(Device& dev)
+{
+    return join(dev, true);
+}
+
+
+bool
+NimBLE::COYOTE::SyncGroup::add(Channel& ch)
+{
+    if (!join(*ch.mDevice, false)) return false;
+
+    SemLockGuard lk(mMutex);
+
+    addChannel(&ch);
+
+    return true;
+}
+
+
+void
+NimBLE::COYOTE::SyncGroup::remove(Device& dev)
+{
+    // Waits for the transmit task to be out of the group
+    SemLockGuard dl(dev.mSyncMutex);
+    SemLockGuard lk(mMutex);
+
+    for (auto it = mChannels.begin(); it != mChannels.end();) {
+        if ((*it)->mDevice == &dev) it = mChannels.erase(it);
+        else it++;
+    }
+    for (auto it = mActions.begin(); it != mActions.end();) {
+        if (it->ch->mDevice == &dev) it = mActions.erase(it);
+        else it++;
+    }
+    for (auto it = mMembers.begin(); it != mMembers.end(); it++) {
+        if (it->dev == &dev) {
+            mMembers.erase(it);
+            dev.mSync = nullptr;
+            break;
+        }
+    }
+}
+
+
+void
+NimBLE::COYOTE::SyncGroup::start(unsigned leadMs)
+{
+    SemLockGuard lk(mMutex);
+
+    mEpoch   = xTaskGetTickCount() + pdMS_TO_TICKS(leadMs);
+    mEpochMs = RUNTIME::nowInMs() + leadMs;
+    mMaxSkew = 0;
+    for (auto& it : mMembers) {
+        it.tick     = 0;
+        it.offsetMs = 0;
+    }
+    mRunning = true;
+
+    ESP_LOGI("SyncGroup", "Starting %u devices in %u ms", (unsigned) mMembers.size(), leadMs);
+}
+
+
+bool
+NimBLE::COYOTE::SyncGroup::isRunning()
+{
+    return mRunning;
+}
+
+
+uint32_t
+NimBLE::COYOTE::SyncGroup::nextTick()
+{
+    // The most advanced device may already be preparing the tick following its last one
+    uint32_t tick = 0;
+    for (auto& it : mMembers) {
+        if (it.tick > tick) tick = it.tick;
+    }
+    tick += 2;
+
+    // Devices that have not ticked yet are waiting for the tick following now, as in wait()
+    if (mRunning) {
+        int32_t  since = (int32_t) (xTaskGetTickCount() - mEpoch);
+        uint32_t k     = (since < 0) ? 1 : since / pdMS_TO_TICKS(sTickMs) + 2;
+        if (k + 1 > tick) tick = k + 1;
+    }
+
+    return tick;
+}
+
+
+uint32_t
+NimBLE::COYOTE::SyncGroup::schedule(Channel& ch, std::function<void(Channel&)> action, uint32_t tick)
+{
+    SemLockGuard lk(mMutex);
+
+    if (tick == 0) tick = nextTick();
+    mActions.push_back({&ch, tick, action});
+
+    return tick;
+}
+
+
+uint32_t
+NimBLE::COYOTE::SyncGroup::scheduleAll(std::function<void(Channel&)> action, uint32_t tick)
+{
+    SemLockGuard lk(mMutex);
+
+    // Channels are created on the first connection, possibly after their device was added
+    for (auto& it : mMembers) {
+        if (!it.allChannels) continue;
+        for (auto ch : it.dev->mChannel) addChannel(ch);
+    }
+
+    if (tick == 0) tick = nextTick();
+    for (auto it : mChannels) mActions.push_back({it, tick, action});
+
+    return tick;
+}
+
+
+uint32_t
+NimBLE::COYOTE::SyncGroup::start(long secs)
+{
+    return scheduleAll([secs](Channel& ch) {ch.start(secs);});
+}
+
+
+uint32_t
+NimBLE::COYOTE::SyncGroup::stop()
+{
+    return scheduleAll([](Channel& ch) {ch.stop();});
+}
+
+
+uint32_t
+NimBLE::COYOTE::SyncGroup::setWaveform(const V2::Waveform& wave, uint8_t power)
+{
+    return scheduleAll([wave, power](Channel& ch) {ch.setWaveform(wave, power);});
+}
+
+
+uint32_t
+NimBLE::COYOTE::SyncGroup::setWaveform(const V3::Waveform& wave, uint8_t power)
+{
+    return scheduleAll([wave, power](Channel& ch) {ch.setWaveform(wave, power);});
+}
+
+
+void
+NimBLE::COYOTE::SyncGroup::apply(Device& dev, uint32_t tick)
+{
+    std::vector<Action> due;
+
+    {
+        SemLockGuard lk(mMutex);
+
+        for (auto it = mActions.begin(); it != mActions.end();) {
+            if (it->ch->mDevice != &dev || it->tick > tick) {
+                it++;
+                continue;
+            }
+            if (it->tick < tick) mLate++;
+            due.push_back(std::move(*it));
+            it = mActions.erase(it);
+        }
+    }
+
+    for (auto& it : due) it.fct(*it.ch);
+}
+
+
+void
+NimBLE::COYOTE::SyncGroup::sent(Device& dev, uint32_t tick, long startMs, long endMs)
+{
+    SemLockGuard lk(mMutex);
+
+    auto m = find(&dev);
+    if (m == nullptr) return;
+
+    // Smooth out the write latency
+    long latency = endMs - startMs;
+    m->latencyMs = (m->latencyMs == 0) ? latency : (m->latencyMs * 7 + latency) / 8;
+
+    if (!mRunning || tick == 0) return;
+
+    m->offsetMs = endMs - (mEpochMs + (long) (tick - 1) * sTickMs);
+
+    long lo = m->offsetMs;
+    long hi = m->offsetMs;
+    for (auto& it : mMembers) {
+        if (it.tick == 0) continue;
+        if (it.offsetMs < lo) lo = it.offsetMs;
+        if (it.offsetMs > hi) hi = it.offsetMs;
+    }
+    if (hi - lo > mMaxSkew) mMaxSkew = hi - lo;
+}
+
+
+bool
+NimBLE::COYOTE::SyncGroup::wait(Device& dev, TaskPolicy::Task* task, TickType_t& lastWake, uint32_t& tick)
+{
+    TickType_t now;
+    TickType_t target;
+
+    {
+        SemLockGuard lk(mMutex);
+
+        if (!mRunning) return false;
+
+        auto m = find(&dev);
+        if (m == nullptr) return false;
+
+        // Wake up early by the write latency so the frame arrives on the tick boundary
+        TickType_t period = pdMS_TO_TICKS(sTickMs);
+        TickType_t comp   = pdMS_TO_TICKS(m->latencyMs);
+
+        now = xTaskGetTickCount();
+
+        // Tick 1 is at the epoch
+        int32_t  since = (int32_t) (now + comp - mEpoch);
+        uint32_t k     = (since < 0) ? 1 : since / period + 2;
+
+        // Never send the same tick twice
+        if (k <= m->tick) k = m->tick + 1;
+
+        target  = mEpoch + (k - 1) * period - comp;
+        m->tick = k;
+        tick    = k;
+    }
+
+    // Measured like any other tick: a target already passed is an overrun
+    if ((int32_t) (target - lastWake) > 0) TaskPolicy::delayUntil(task, &lastWake, target - lastWake);
+
+    return true;
+}
+
+
+NimBLE::COYOTE::SyncGroup::Stats
+NimBLE::COYOTE::SyncGroup::getStats()
+{
+    SemLockGuard lk(mMutex);
+
+    Stats stats = {};
+
+    stats.devices   = mMembers.size();
+    stats.maxSkewMs = mMaxSkew;
+    stats.late      = mLate;
+
+    long lo = 0;
+    long hi = 0;
+    bool any = false;
+    for (auto& it : mMembers) {
+        if (it.tick > stats.tick) stats.tick = it.tick;
+        if (it.tick == 0) continue;
+        if (!any || it.offsetMs < lo) lo = it.offsetMs;
+        if (!any || it.offsetMs > hi) hi = it.offsetMs;
+        any = true;
+    }
+    stats.skewMs = hi - lo;
+
+    return stats;
+}
+
+
+long
+NimBLE::COYOTE::SyncGroup::getLatency(Device& dev)
+{
+    SemLockGuard lk(mMutex);
+
+    auto m = find(&dev);
+    return (m) ? m->latencyMs : -1;
+}
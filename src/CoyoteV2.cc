@@ -14,6 +14,11 @@
 //
 
 #include "NimBLE-Device/Coyote.hh"
+#include "NimBLE-Device/Coyote-Sequencer.hh"
+#include "NimBLE-Device/Coyote-Codec.hh"
+#include "NimBLE-Device/Accounting.hh"
+#include "NimBLE-Device/TaskPolicy.hh"
+#include "Runtime.hh"
 
 
 using namespace NimBLE::COYOTE;
@@ -30,22 +35,22 @@ public:
         SemaphoreHandle_t            mutex;
         bool                         start;
         bool                         run;
-        V2::Waveform                 wave;
-        V2::Waveform::const_iterator iter;
-        unsigned int                 nLeft;
+        Sequencer<V2::WaveVal>       seq;
 
         Playing()
         : mutex(xSemaphoreCreateRecursiveMutex())
         , start(false)
         , run(false)
-        , wave({})
-        , iter()
-        , nLeft(0)
+        , seq(100)
         {}
 
     } mPlaying;
 
     virtual void setWaveform(const V2::Waveform& wave, uint8_t power = 0) override;
+    virtual bool queueWaveform(const V2::Waveform& wave, uint8_t power = 0, long ms = 0, unsigned loops = 0, long fadeMs = 0) override;
+    virtual bool setGenerator(Generator& gen, uint8_t power = 0) override;
+    virtual bool queueGenerator(Generator& gen, uint8_t power = 0, long ms = 0, long fadeMs = 0) override;
+    virtual void clearPlaylist() override;
     virtual void start(long secs = 0) override;
     virtual void stop() override;
 
@@ -79,9 +84,10 @@ NimBLE::COYOTE::Device::V2::initCoyoteDevice()
     ESP_LOGI(getName(), "Firmware %02x.%02x", fw & 0x00FF, fw >> 8);
 
     auto battery  = pSvc->getCharacteristic("955A1500-0FE2-F5AA-A094-84B8D4F3E8AD");
-    if (battery != nullptr) battery->subscribe(true, std::bind(&Device::notifyBattery, this,
-                                                               std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
-    notifyBatteryLevel(battery->readValue<uint8_t>());
+    if (battery != nullptr) {
+        mRouter.subscribe(battery, this, &Router::handler<Device, &Device::notifyBattery>);
+        notifyBatteryLevel(battery->readValue<uint8_t>());
+    }
     
     pSvc = mClient->getService("955A180B-0FE2-F5AA-A094-84B8D4F3E8AD");
     if (pSvc == NULL) {
@@ -98,81 +104,95 @@ NimBLE::COYOTE::Device::V2::initCoyoteDevice()
         notifyEvent(ERROR);
         return false;
     }
-    mChannel[0] = new NimBLE::COYOTE::V2Channel(this, "A", pSvc->getCharacteristic("955A1506-0FE2-F5AA-A094-84B8D4F3E8AD"));
-    mChannel[1] = new NimBLE::COYOTE::V2Channel(this, "B", pSvc->getCharacteristic("955A1505-0FE2-F5AA-A094-84B8D4F3E8AD"));
-
-    struct CFGval {
-        uint32_t   step    :  8;
-        uint32_t   maxPwr  : 11;
-        uint32_t   rsvd    : 13;
-    };
-    
-    auto cfg = *((CFGval*) cfgChar->readValue().data());
+    auto charA = pSvc->getCharacteristic("955A1506-0FE2-F5AA-A094-84B8D4F3E8AD");
+    auto charB = pSvc->getCharacteristic("955A1505-0FE2-F5AA-A094-84B8D4F3E8AD");
+
+    // Channels are kept across reconnections: only their characteristic changes
+    if (mChannel[0] == nullptr) mChannel[0] = Arena::create<NimBLE::COYOTE::V2Channel>(this, "A", charA);
+    if (mChannel[1] == nullptr) mChannel[1] = Arena::create<NimBLE::COYOTE::V2Channel>(this, "B", charB);
+    if (mChannel[0] == nullptr || mChannel[1] == nullptr) {
+        ESP_LOGE(getName(), "Cannot create channels.\n");
+        notifyEvent(ERROR);
+        return false;
+    }
+    ((NimBLE::COYOTE::V2Channel*) mChannel[0])->mChar = charA;
+    ((NimBLE::COYOTE::V2Channel*) mChannel[1])->mChar = charB;
+
+    CODEC::V2::Config cfg;
+    auto val = cfgChar->readValue();
+    if (!CODEC::V2::decode(val.data(), val.size(), cfg) || cfg.step == 0) {
+        ESP_LOGE(getName(), "Invalid power configuration.\n");
+        notifyEvent(ERROR);
+        return false;
+    }
     mPower.step = cfg.step;
     mPower.max  = cfg.maxPwr / cfg.step;
     ESP_LOGI("ESTIM", "Power = %d / %d -> %d", cfg.maxPwr, cfg.step, mPower.max);
-    mPower.charac->subscribe(true, std::bind(&Device::V2::notifyPower, this,
-                                             std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_3));
+    mRouter.subscribe(mPower.charac, this, &Router::handler<Device::V2, &Device::V2::notifyPower>);
 
     return true;
 }
 
 
-struct PowerVal {
-    uint32_t  B    : 11;
-    uint32_t  A    : 11;
-    uint32_t  rsvd : 10;
+void NimBLE::COYOTE::Device::V2::notifyPower(const uint8_t* pData, size_t length)
+{
+    CODEC::V2::Power pow;
+    if (!CODEC::V2::decode(pData, length, pow)) {
+        ESP_LOGD(getName(), "Short power notification (%u bytes).", (unsigned) length);
+        return;
+    }
 
-    PowerVal(uint16_t a = 0, uint16_t b = 0)
-        : B(b)
-        , A(a)
-        , rsvd(0)
-        {}
+    getChannelA().updatePower(pow.A/mPower.step);
+    getChannelB().updatePower(pow.B/mPower.step);
 
-    // Values are sent in little-endian order
-    operator uint8_t*() const
-        {
-            return (uint8_t*) this;
-        }
-};
+    auto a = getChannelA().getState();
+    auto b = getChannelB().getState();
+    ESP_LOGI(getName(), "Power Setting  A:%3d -> %d   B:%3d -> %d", a.power, a.setPower, b.power, b.setPower);
+}
 
 
-void NimBLE::COYOTE::Device::V2::notifyPower(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify)
+bool
+NimBLE::COYOTE::Device::V2::sendStop()
 {
-    auto pow = (PowerVal*) pData;
+    uint8_t msg[CODEC::V2::PowerLen];
+    auto    len = CODEC::V2::encode(CODEC::V2::Power{0, 0}, msg, sizeof(msg));
 
-    getChannelA().updatePower(pow->A/mPower.step);
-    getChannelB().updatePower(pow->B/mPower.step);
+    if (!mWrites.writeNow(mPower.charac, msg, len)) return false;
 
-    ESP_LOGI(getName(), "Power Setting  A:%3d -> %d   B:%3d -> %d",
-             getChannelA().mPower, getChannelA().mSetPower,
-             getChannelB().mPower, getChannelB().mSetPower);
+    getChannelA().powerSent(0);
+    getChannelB().powerSent(0);
+
+    return true;
 }
 
 
 void
 NimBLE::COYOTE::Device::V2::run()
 {
-    auto xLastWakeTime = xTaskGetTickCount();
-
     while (1) {
+        beginTick();
+
         uint8_t powA;
         uint8_t powB;
-        bool    newPower = getChannelA().powerUpdateReq(powA) ||
-                        getChannelB().powerUpdateReq(powB);
+        bool    newPowerA = getChannelA().powerUpdateReq(powA);
+        bool    newPowerB = getChannelB().powerUpdateReq(powB);
+        bool    newPower  = newPowerA || newPowerB;
 
         // Only update power if there was a change requested
         if (newPower) {
             ESP_LOGD(getName(), "Set power to A:%d->%d->%d  B:%d->%d->%d",
-                        (uint16_t)getChannelA().getPower(), (uint16_t)getChannelA().mSentPower, powA,
-                        (uint16_t)getChannelB().getPower(), (uint16_t)getChannelB().mSentPower, powB);
-
-            PowerVal pwr(powA * mPower.step, powB * mPower.step);
-
-            mPower.charac->writeValue(pwr, 3, false);
-
-            getChannelA().mSentPower = powA;
-            getChannelB().mSentPower = powB;
+                        getChannelA().getState().power, getChannelA().getState().sentPower, powA,
+                        getChannelB().getState().power, getChannelB().getState().sentPower, powB);
+
+            uint8_t msg[CODEC::V2::PowerLen];
+            auto    len = CODEC::V2::encode(CODEC::V2::Power{(uint16_t) (powA * mPower.step), (uint16_t) (powB * mPower.step)}, msg, sizeof(msg));
+
+            // Refused during an emergency stop
+            if (mWrites.post(WriteQueue::POWER, mPower.charac, msg, len)) {
+                getChannelA().powerSent(powA);
+                getChannelB().powerSent(powB);
+            }
+            mWrites.flush();
         }
 
         //
@@ -183,19 +203,23 @@ NimBLE::COYOTE::Device::V2::run()
 
         // Check if a new waveform was started (t=0)
         for (auto& it : mChannel) ((NimBLE::COYOTE::V2Channel*) it)->startNewWaveform();
-        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(50));
+        mWrites.flush();
+        TaskPolicy::delayUntil(mTask, &mLastWake, pdMS_TO_TICKS(50));
 
+        long start = RUNTIME::nowInMs();
         for (auto& it : mChannel) ((NimBLE::COYOTE::V2Channel*) it)->sendNextSegment();
-        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(50));
+        mWrites.flush();
+        frameSent(start, 50);
+
+        waitTick(50);
     }
 }
 
 
 NimBLE::COYOTE::V2::WaveVal::WaveVal(uint8_t X, uint16_t Y, uint8_t Z, uint16_t rpt)
-    : x(X)
-    , y(Y)
-    , z(Z)
-    , rsvd(0)
+    : x(X & 0x1F)
+    , y(Y & 0x3FF)
+    , z(Z & 0x1F)
     , repeat(rpt)
 {
 }
@@ -205,11 +229,14 @@ NimBLE::COYOTE::V2::WaveVal::WaveVal(const std::vector<uint8_t> vals, uint16_t r
     : x(0)
     , y(0)
     , z(0)
-    , rsvd(0)
     , repeat(rpt)
 {
-    auto b = (uint8_t*) this;
-    for (auto it : vals) *b++ = it;
+    CODEC::V2::Wave val;
+    if (!CODEC::V2::decode(vals.data(), vals.size(), val)) return;
+
+    x = val.x;
+    y = val.y;
+    z = val.z;
 }
 
 
@@ -232,9 +259,21 @@ NimBLE::COYOTE::V2::WaveVal::getRepeat() const
 }
 
 
-NimBLE::COYOTE::V2::WaveVal::operator uint8_t*() const
+NimBLE::COYOTE::V2::WaveVal
+NimBLE::COYOTE::V2::WaveVal::fadeFrom(const WaveVal& from, unsigned num, unsigned den) const
+{
+    WaveVal val(*this);
+
+    val.z = (from.z * (den - num) + z * num) / den;
+
+    return val;
+}
+
+
+size_t
+NimBLE::COYOTE::V2::WaveVal::encode(uint8_t* buf, size_t len) const
 {
-    return (uint8_t*) this;
+    return CODEC::V2::encode(CODEC::V2::Wave{x, y, z}, buf, len);
 }
 
 
@@ -249,28 +288,88 @@ NimBLE::COYOTE::V2Channel::V2Channel(Device *parent, const char* name, NimBLERem
 void
 NimBLE::COYOTE::V2Channel::setWaveform(const V2::Waveform& wave, uint8_t power)
 {
+    Accounting::Scope scope(*mDevice);
+
+    Sequencer<V2::WaveVal>::Entry entry;
+    bool ok = mPlaying.seq.compile(entry, wave, 0, 0, 0, 0);
+
     SemLockGuard lk(mPlaying.mutex);
-    
-    mPlaying.wave  = wave;
-    mPlaying.iter  = mPlaying.wave.end();
-    mPlaying.nLeft = 0;
+
+    if (ok) mPlaying.seq.replace(std::move(entry));
+    else mPlaying.seq.clear();
     mPlaying.start = true;
 
     setPower(power);
 }
 
 
+bool
+NimBLE::COYOTE::V2Channel::queueWaveform(const V2::Waveform& wave, uint8_t power, long ms, unsigned loops, long fadeMs)
+{
+    Accounting::Scope scope(*mDevice);
+
+    // Compile outside of the lock so the transmit loop is never held up
+    Sequencer<V2::WaveVal>::Entry entry;
+    if (!mPlaying.seq.compile(entry, wave, power, ms, loops, fadeMs)) return false;
+
+    SemLockGuard lk(mPlaying.mutex);
+
+    return mPlaying.seq.push(std::move(entry));
+}
+
+
+bool
+NimBLE::COYOTE::V2Channel::setGenerator(Generator& gen, uint8_t power)
+{
+    Accounting::Scope scope(*mDevice);
+
+    Sequencer<V2::WaveVal>::Entry entry;
+    mPlaying.seq.compile(entry, gen, 0, 0, 0);
+
+    SemLockGuard lk(mPlaying.mutex);
+
+    mPlaying.seq.replace(std::move(entry));
+    mPlaying.start = true;
+
+    setPower(power);
+
+    return true;
+}
+
+
+bool
+NimBLE::COYOTE::V2Channel::queueGenerator(Generator& gen, uint8_t power, long ms, long fadeMs)
+{
+    Accounting::Scope scope(*mDevice);
+
+    Sequencer<V2::WaveVal>::Entry entry;
+    mPlaying.seq.compile(entry, gen, power, ms, fadeMs);
+
+    SemLockGuard lk(mPlaying.mutex);
+
+    return mPlaying.seq.push(std::move(entry));
+}
+
+
+void
+NimBLE::COYOTE::V2Channel::clearPlaylist()
+{
+    SemLockGuard lk(mPlaying.mutex);
+
+    mPlaying.seq.clear();
+}
+
+
 void
 NimBLE::COYOTE::V2Channel::start(long secs)
 {
     NimBLE::COYOTE::Channel::start(secs);
 
-    if (mPlaying.wave.size() == 0 || mPlaying.run) return;
-
     SemLockGuard lk(mPlaying.mutex);
 
-    mPlaying.iter  = mPlaying.wave.end();
-    mPlaying.nLeft = 0;
+    if (mPlaying.seq.empty() || mPlaying.run) return;
+
+    mPlaying.seq.restart(secs * 1000);
     mPlaying.start = true;
     mPlaying.run   = true;
 }
@@ -302,22 +401,24 @@ NimBLE::COYOTE::V2Channel::startNewWaveform()
 void
 NimBLE::COYOTE::V2Channel::sendNextSegment()
 {
+    SemLockGuard lk(mPlaying.mutex);
+
     if (!mPlaying.run) return;
-    
-    if (mPlaying.nLeft == 0) {
-        if (mPlaying.iter == mPlaying.wave.end()) {
-            mPlaying.iter = mPlaying.wave.begin();
-        }
-        if (mPlaying.iter == mPlaying.wave.end()) return;
 
-        mPlaying.nLeft = (((mPlaying.iter->duration() - 1) / 100) + 1) * mPlaying.iter->getRepeat();
+    auto seg = mPlaying.seq.next();
+    if (seg == nullptr) {
+        // Stop once the requested play time has elapsed
+        if (mPlaying.seq.expired()) mPlaying.run = false;
+        return;
     }
+
+    uint8_t power;
+    if (mPlaying.seq.newPower(power)) setPower(power);
     
-    // ESP_LOGI("ESTIM", "Segment: %d %d %d x %d (%d)", mPlaying.iter->x, mPlaying.iter->y, mPlaying.iter->z, mPlaying.iter->repeat, mPlaying.nLeft);
-    mChar->writeValue(*mPlaying.iter, 3, false);
+    uint8_t msg[CODEC::V2::WaveLen];
+    auto    len = seg->encode(msg, sizeof(msg));
 
-    mPlaying.nLeft--;
-    if (mPlaying.nLeft == 0) mPlaying.iter++;
+    mDevice->mWrites.post(WriteQueue::WAVEFORM, mChar, msg, len);
 }
 
 
@@ -327,6 +428,6 @@ NimBLE::COYOTE::Device::V2::setMaxPower(uint8_t A, uint8_t B)
     if (A > mPower.max) A = mPower.max;
     if (B > mPower.max) B = mPower.max;
 
-    getChannelA().mMaxPower = A;
-    getChannelB().mMaxPower = B;
+    getChannelA().limitPower(A);
+    getChannelB().limitPower(B);
 }
\ No newline at end of file
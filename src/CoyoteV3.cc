@@ -14,6 +14,13 @@
 //
 
 #include "NimBLE-Device/Coyote.hh"
+#include "NimBLE-Device/Coyote-Sequencer.hh"
+#include "NimBLE-Device/Coyote-Codec.hh"
+#include "NimBLE-Device/Accounting.hh"
+#include "Runtime.hh"
+
+#include <algorithm>
+#include <array>
 
 
 using namespace NimBLE::COYOTE;
@@ -28,16 +35,12 @@ public:
     {
         SemaphoreHandle_t            mutex;
         bool                         run;
-        V3::Waveform                 wave;
-        V3::Waveform::const_iterator iter;
-        unsigned int                 nLeft;
+        Sequencer<V3::WaveVal>       seq;
 
         Playing()
         : mutex(xSemaphoreCreateRecursiveMutex())
         , run(false)
-        , wave({})
-        , iter()
-        , nLeft(0)
+        , seq(25)
         {}
 
     } mPlaying;
@@ -45,6 +48,11 @@ public:
     virtual void setFreqBalance(uint8_t bal1, uint8_t bal2) override;
     virtual void setWaveform(const V2::Waveform& wave, uint8_t power = 0) override;
     virtual void setWaveform(const V3::Waveform& wave, uint8_t power = 0) override;
+    virtual bool queueWaveform(const V2::Waveform& wave, uint8_t power = 0, long ms = 0, unsigned loops = 0, long fadeMs = 0) override;
+    virtual bool queueWaveform(const V3::Waveform& wave, uint8_t power = 0, long ms = 0, unsigned loops = 0, long fadeMs = 0) override;
+    virtual bool setGenerator(Generator& gen, uint8_t power = 0) override;
+    virtual bool queueGenerator(Generator& gen, uint8_t power = 0, long ms = 0, long fadeMs = 0) override;
+    virtual void clearPlaylist() override;
     virtual void start(long secs = 0) override;
     virtual void stop() override;
 
@@ -57,7 +65,10 @@ NimBLE::COYOTE::Device::V3::V3(const char* uniqueName, const char* macAddr)
 , mCharac(nullptr)
 , mNextSerial(0x10)
 , mPendingSerial(0x00)
+, mLimits()
 {
+    // Without an acknowledgement, no other power change is sent
+    mWatchdog.expect(Watchdog::ACK, 500, 2000, Watchdog::RESET, true);
 }
 
 
@@ -76,8 +87,7 @@ NimBLE::COYOTE::Device::V3::initCoyoteDevice()
     // ESP_LOGI(getName(), "Firmware %02x.%02x", fw & 0x00FF, fw >> 8);
 
     auto battery  = pSvc->getCharacteristic("00001500-0000-1000-8000-00805f9b34fb");
-    if (battery != nullptr) battery->subscribe(true, std::bind(&Device::notifyBattery, this,
-                                                               std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+    if (battery != nullptr) mRouter.subscribe(battery, this, &Router::handler<Device, &Device::notifyBattery>);
     
     pSvc = mClient->getService("0000180C-0000-1000-8000-00805f9b34fb");
     if (pSvc == NULL) {
@@ -89,11 +99,20 @@ NimBLE::COYOTE::Device::V3::initCoyoteDevice()
     mCharac = pSvc->getCharacteristic("0000150A-0000-1000-8000-00805f9b34fb");
 
     auto resp  = pSvc->getCharacteristic("0000150B-0000-1000-8000-00805f9b34fb");
-    if (resp != nullptr) resp->subscribe(true, std::bind(&Device::V3::notifyResp, this,
-                                                         std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+    static constexpr Router::Op      sOps[] = {{0xB1, &Router::handler<Device::V3, &Device::V3::notifyAck>},
+                                               {0xBE, &Router::handler<Device::V3, &Device::V3::notifyLimits>}};
+    static constexpr Router::OpTable sResp  = Router::table(sOps);
+
+    if (resp != nullptr) mRouter.subscribe(resp, this, sResp);
 
-    mChannel[0] = new NimBLE::COYOTE::V3Channel(this, "A");
-    mChannel[1] = new NimBLE::COYOTE::V3Channel(this, "B");
+    // Channels are kept across reconnections
+    if (mChannel[0] == nullptr) mChannel[0] = Arena::create<NimBLE::COYOTE::V3Channel>(this, "A");
+    if (mChannel[1] == nullptr) mChannel[1] = Arena::create<NimBLE::COYOTE::V3Channel>(this, "B");
+    if (mChannel[0] == nullptr || mChannel[1] == nullptr) {
+        ESP_LOGE(getName(), "Cannot create channels.\n");
+        notifyEvent(ERROR);
+        return false;
+    }
 
     return true;
 }
@@ -104,36 +123,43 @@ NimBLE::COYOTE::Device::V3::setMaxPower(uint8_t A, uint8_t B)
     if (A > 200) A = 200;
     if (B > 200) B = 200;
 
-    getChannelA().mMaxPower = A;
-    getChannelB().mMaxPower = B;
+    getChannelA().limitPower(A);
+    getChannelB().limitPower(B);
 }
 
 void
 NimBLE::COYOTE::Device::V3::run()
 {
-    auto xLastWakeTime = xTaskGetTickCount();
-
-    uint8_t msg[20];
+    uint8_t       msg[CODEC::V3::B0Len];
+    CODEC::V3::B0 frame = {};
 
     // Set power to 0
-    bzero(msg, sizeof(msg));
-    msg[0] = 0xB0;
-    msg[1] = 0xFF;
-    mPendingSerial = 0x0F;
-    // ESP_LOGI("SEND", "%s", image(msg, sizeof(msg)));
-    mCharac->writeValue(msg, sizeof(msg), false);
+    frame.serial   = 0x0F;
+    frame.modeA    = CODEC::V3::ABSOLUTE;
+    frame.modeB    = CODEC::V3::ABSOLUTE;
+    auto len = CODEC::V3::encode(frame, msg, sizeof(msg));
+    // ESP_LOGI("SEND", "%s", image(msg, len));
+
+    // Refused if already stopped: no acknowledgement will come
+    if (mWrites.post(WriteQueue::POWER, mCharac, msg, len, false)) {
+        mPendingSerial = frame.serial;
+        mWatchdog.await(Watchdog::ACK);
+    }
 
     // Set max power (200) and balance parameters (32, 32)
     mChannel[0]->setFreqBalance(32, 32);
     mChannel[1]->setFreqBalance(32, 32);
+    mWrites.flush();
     
     while (1) {
-        msg[0] = 0xB0;
+        beginTick();
 
         // No change in power
-        msg[1] = 0x00;
-        msg[2] = 0x00;
-        msg[3] = 0x00;
+        frame.serial = 0;
+        frame.modeA  = CODEC::V3::NONE;
+        frame.modeB  = CODEC::V3::NONE;
+        frame.powA   = 0;
+        frame.powB   = 0;
 
         uint8_t powA;
         uint8_t powB;
@@ -145,16 +171,17 @@ NimBLE::COYOTE::Device::V3::run()
             
             // Always use absolute values
             if (newPowerA) {
-                msg[1] |= mNextSerial | 0x0C;
-                msg[2] = powA;
+                frame.modeA = CODEC::V3::ABSOLUTE;
+                frame.powA  = powA;
             }
             if (newPowerB) {
-                msg[1] |= mNextSerial | 0x03;
-                msg[3] = powB;
+                frame.modeB = CODEC::V3::ABSOLUTE;
+                frame.powB  = powB;
             }
 
-            if (msg[1]) {
-                mPendingSerial = mNextSerial >> 4;
+            if (newPowerA || newPowerB) {
+                frame.serial   = mNextSerial >> 4;
+                mPendingSerial = frame.serial;
 
                 if (mNextSerial == 0xF0) mNextSerial = 0x10;
                 else mNextSerial += 0x10;
@@ -162,71 +189,122 @@ NimBLE::COYOTE::Device::V3::run()
                 ESP_LOGD(getName(), "Set power to A:%d->%d  B:%d->%d",
                          (uint16_t)getChannelA().getPower(), powA,
                          (uint16_t)getChannelB().getPower(), powB);
-
-                getChannelA().mSentPower = powA;
-                getChannelB().mSentPower = powB;
             }
         }
 
-        int k = 4;
-        for (auto& it : mChannel) {
-            for (unsigned i = 0; i < 4; i++) {
-                ((NimBLE::COYOTE::V3Channel*) it)->getNextSegment(msg[k], msg[k+4]);
-                k++;
-            }
-            k += 4;
+        for (unsigned i = 0; i < 4; i++) {
+            ((NimBLE::COYOTE::V3Channel*) mChannel[0])->getNextSegment(frame.freqA[i], frame.intA[i]);
+            ((NimBLE::COYOTE::V3Channel*) mChannel[1])->getNextSegment(frame.freqB[i], frame.intB[i]);
         }
 
-        // ESP_LOGI("SEND", "%s", image(msg, sizeof(msg)));
-        mCharac->writeValue(msg, sizeof(msg), false);
-        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(100));
+        // A frame carrying a power change must not be replaced: its acknowledgement is expected
+        len = CODEC::V3::encode(frame, msg, sizeof(msg));
+        // ESP_LOGI("SEND", "%s", image(msg, len));
+        if (frame.serial == 0) {
+            mWrites.post(WriteQueue::WAVEFORM, mCharac, msg, len);
+        } else if (mWrites.post(WriteQueue::POWER, mCharac, msg, len, false)) {
+            getChannelA().powerSent(powA);
+            getChannelB().powerSent(powB);
+            mWatchdog.await(Watchdog::ACK);
+        } else {
+            // Refused during an emergency stop: no acknowledgement will come
+            mPendingSerial = 0x00;
+        }
+
+        long start = RUNTIME::nowInMs();
+        mWrites.flush();
+        frameSent(start);
+
+        waitTick(100);
     }
 }
 
-void
-NimBLE::COYOTE::Device::V3::notifyResp(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify)
+bool
+NimBLE::COYOTE::Device::V3::sendStop()
 {
-    // ESP_LOGI("RECV", "%s", image(pData, length));
+    uint8_t       msg[CODEC::V3::B0Len];
+    CODEC::V3::B0 frame = {};
+
+    // Absolute 0 on both channels, without waveform data and without requesting an acknowledgement
+    frame.serial = 0;
+    frame.modeA  = CODEC::V3::ABSOLUTE;
+    frame.modeB  = CODEC::V3::ABSOLUTE;
+    for (unsigned i = 0; i < 4; i++) {
+        frame.freqA[i] = frame.intA[i] = 255;
+        frame.freqB[i] = frame.intB[i] = 255;
+    }
+    auto len = CODEC::V3::encode(frame, msg, sizeof(msg));
 
-    if (pData[0] == 0xB1) {
-        if (pData[1] != mPendingSerial) {
-            ESP_LOGE(getName(), "Unexpected response serial number 0x%02x instead of 0x%02x.", pData[1], mPendingSerial);
-            // Clear it so we can continue to update power
-            mPendingSerial = 0x00;
-            return;
-        }
-        mChannel[0]->mPower = pData[2];
-        mChannel[1]->mPower = pData[3];
+    if (!mWrites.writeNow(mCharac, msg, len)) return false;
 
-        mPendingSerial = 0x00;
+    // A power change refused by the write queue will never be acknowledged
+    mPendingSerial = 0x00;
+    mWatchdog.forget(Watchdog::ACK);
+    getChannelA().powerSent(0);
+    getChannelB().powerSent(0);
+
+    return true;
+}
+
+
+void
+NimBLE::COYOTE::Device::V3::notifyAck(const uint8_t* pData, size_t length)
+{
+    CODEC::V3::B1 ack;
+    if (!CODEC::V3::decode(pData, length, ack)) {
+        ESP_LOGD(getName(), "Short 0x%02x response (%u bytes) received.", pData[0], (unsigned) length);
         return;
     }
+    mWatchdog.beat(Watchdog::ACK);
 
-    if (pData[0] == 0xBE) {
-        memcpy(mFreqBal, pData, sizeof(mFreqBal));
-        ESP_LOGI(getName(), "MaxPow: %d %d   Balance Params: %d/%d %d/%d", pData[1], pData[2], pData[3], pData[5], pData[4], pData[6]);
+    if (ack.serial != mPendingSerial) {
+        ESP_LOGE(getName(), "Unexpected response serial number 0x%02x instead of 0x%02x.", ack.serial, mPendingSerial.load());
+        // Clear it so we can continue to update power
+        mPendingSerial = 0x00;
         return;
     }
+    mChannel[0]->updatePower(ack.powA);
+    mChannel[1]->updatePower(ack.powB);
 
-    ESP_LOGD(getName(), "Unexpected 0x%02x response received.", pData[0]);
+    mPendingSerial = 0x00;
 }
 
-NimBLE::COYOTE::V3::WaveVal::WaveVal(uint8_t freq, uint16_t intensity, uint16_t rpt)
-    : xy(freq)
-    , z(intensity)
-    , repeat(rpt)
+
+void
+NimBLE::COYOTE::Device::V3::resetHeartbeat(Watchdog::Heartbeat_t hb)
 {
-    if (xy <  10) xy = 10;
-    if (xy > 240) xy = 240;
-    if (z  > 100)  z = 100;
-    if (rpt == 0) rpt = 1;
+    if (hb != Watchdog::ACK) return;
+
+    ESP_LOGW(getName(), "No response to serial number 0x%02x.", mPendingSerial.load());
+
+    // Send the requested power again, unless the device already reports it
+    getChannelA().powerSent(getChannelA().getState().power);
+    getChannelB().powerSent(getChannelB().getState().power);
+    mPendingSerial = 0x00;
+    mWatchdog.forget(Watchdog::ACK);
 }
 
 
-uint8_t V2freqToV3(uint32_t x, uint32_t y)
+void
+NimBLE::COYOTE::Device::V3::notifyLimits(const uint8_t* pData, size_t length)
 {
-    uint32_t xy = x + y;
+    CODEC::V3::Limits limits;
+    if (!CODEC::V3::decode(pData, length, limits)) {
+        ESP_LOGD(getName(), "Short 0x%02x response (%u bytes) received.", pData[0], (unsigned) length);
+        return;
+    }
+
+    mLimits = limits;
+    ESP_LOGI(getName(), "MaxPow: %d %d   Balance Params: %d/%d %d/%d", limits.limitA, limits.limitB,
+             limits.freqBalA, limits.intBalA, limits.freqBalB, limits.intBalB);
+}
 
+//
+// Reference (scalar) conversion of a V2 pulse period (X + Y) to a V3 frequency
+//
+static constexpr uint8_t
+V2freqToV3(uint32_t xy)
+{
     if (xy <= 10)  return 10;
     if (xy <= 100) return xy;
     if (xy <= 600) return (xy - 100) / 5 + 100;
@@ -234,20 +312,93 @@ uint8_t V2freqToV3(uint32_t x, uint32_t y)
     return 240;
 }
 
+
+//
+// Reference (scalar) conversion of a V3 frequency to a pulse period, in ms
+//
+static constexpr uint16_t
+V3freqToMs(uint32_t xy)
+{
+    if (xy <= 100) return xy;
+    if (xy <= 200) return (xy - 100) * 5 + 100;
+    if (xy <= 240) return (xy - 200) * 10 + 600;
+    return 1000;
+}
+
+
+//
+// Lookup tables covering every possible input: X (5 bits) + Y (10 bits) and any 8-bit V3 frequency
+//
+static constexpr unsigned sMaxV2Period = 31 + 1023;
+
+template<class T, size_t N, T (*FCT)(uint32_t)>
+static constexpr std::array<T, N>
+makeTable()
+{
+    std::array<T, N> t{};
+    for (size_t i = 0; i < N; i++) t[i] = FCT(i);
+    return t;
+}
+
+static constexpr auto sV2toV3 = makeTable<uint8_t,  sMaxV2Period + 1, V2freqToV3>();
+static constexpr auto sV3toMs = makeTable<uint16_t, 256,              V3freqToMs>();
+
+template<class T, size_t N, T (*FCT)(uint32_t)>
+static constexpr bool
+checkTable(const std::array<T, N>& t)
+{
+    for (size_t i = 0; i < N; i++) {
+        if (t[i] != FCT(i)) return false;
+    }
+    return true;
+}
+
+static_assert(checkTable<uint8_t,  sMaxV2Period + 1, V2freqToV3>(sV2toV3), "V2 to V3 frequency table does not match");
+static_assert(checkTable<uint16_t, 256,              V3freqToMs>(sV3toMs), "V3 frequency to period table does not match");
+
+
+NimBLE::COYOTE::V3::WaveVal::WaveVal(uint8_t freq, uint16_t intensity, uint16_t rpt)
+    : xy(std::min<uint8_t>(std::max<uint8_t>(freq, 10), 240))
+    , z(std::min<uint16_t>(intensity, 100))
+    , repeat((rpt) ? rpt : 1)
+{
+}
+
+
 NimBLE::COYOTE::V3::WaveVal::WaveVal(V2::WaveVal v2)
-    : xy(V2freqToV3(v2.x, v2.y))
+    : xy(sV2toV3[v2.x + v2.y])
     , z(v2.z * 5)
     , repeat(v2.repeat * 4)
 {}
 
 
+void
+NimBLE::COYOTE::V3::WaveVal::convert(const V2::WaveVal* in, size_t n, WaveVal* out)
+{
+    // Straight-line loop body: no branches, only table lookups
+    for (size_t i = 0; i < n; i++) {
+        out[i].xy     = sV2toV3[in[i].x + in[i].y];
+        out[i].z      = in[i].z * 5;
+        out[i].repeat = in[i].repeat * 4;
+    }
+}
+
+
+NimBLE::COYOTE::V3::Waveform
+NimBLE::COYOTE::V3::convert(const V2::Waveform& wave)
+{
+    Waveform out(wave.size(), WaveVal(10, 0));
+
+    WaveVal::convert(wave.data(), wave.size(), out.data());
+
+    return out;
+}
+
+
 unsigned int
 NimBLE::COYOTE::V3::WaveVal::duration() const
 {
-    if (xy <= 100) return xy;
-    if (xy <= 200) return (xy - 100) * 5 + 100;
-    if (xy <= 240) return (xy - 200) * 10 + 600;
-    return 1000;
+    return sV3toMs[xy];
 }
 
 
@@ -271,6 +422,17 @@ NimBLE::COYOTE::V3::WaveVal::getInt() const
     return z;
 }
 
+
+NimBLE::COYOTE::V3::WaveVal
+NimBLE::COYOTE::V3::WaveVal::fadeFrom(const WaveVal& from, unsigned num, unsigned den) const
+{
+    WaveVal val(*this);
+
+    val.z = (from.z * (den - num) + z * num) / den;
+
+    return val;
+}
+
 NimBLE::COYOTE::V3Channel::V3Channel(Device *parent, const char* name)
     : Channel(parent, name)
     , mPlaying()
@@ -282,32 +444,38 @@ NimBLE::COYOTE::V3Channel::setFreqBalance(uint8_t bal1, uint8_t bal2)
 {
     auto pDev = (Device::V3*) mDevice;
     
-    pDev->mFreqBal[0] = 0xBF;
-    pDev->mFreqBal[1] = 0xC8;
-    pDev->mFreqBal[2] = 0xC8;
+    pDev->mLimits.limitA = 200;
+    pDev->mLimits.limitB = 200;
 
     if (pDev->mChannel[0] == this) {
-        pDev->mFreqBal[3] = bal1;
-        pDev->mFreqBal[4] = bal2;
+        pDev->mLimits.freqBalA = bal1;
+        pDev->mLimits.intBalA  = bal2;
     } else {
-        pDev->mFreqBal[5] = bal1;
-        pDev->mFreqBal[6] = bal2;
+        pDev->mLimits.freqBalB = bal1;
+        pDev->mLimits.intBalB  = bal2;
     }
 
-    // ESP_LOGI("SEND", "%s", pDev->image(pDev->mFreqBal, sizeof(pDev->mFreqBal)));
-    pDev->mCharac->writeValue(pDev->mFreqBal, sizeof(pDev->mFreqBal), false);
+    uint8_t msg[CODEC::V3::LimitsLen];
+    auto    len = CODEC::V3::encode(pDev->mLimits, msg, sizeof(msg));
+
+    // ESP_LOGI("SEND", "%s", pDev->image(msg, len));
+    // Issued by the transmit task
+    pDev->mWrites.post(WriteQueue::CONFIG, pDev->mCharac, msg, len);
 }
 
 
 void
 NimBLE::COYOTE::V3Channel::setWaveform(const V2::Waveform& wave, uint8_t power)
 {
+    Accounting::Scope scope(*mDevice);
+
+    Sequencer<V3::WaveVal>::Entry entry;
+    bool ok = mPlaying.seq.compile(entry, wave, 0, 0, 0, 0);
+
     SemLockGuard lk(mPlaying.mutex);
 
-    mPlaying.wave  = {};
-    for (auto it : wave) mPlaying.wave.push_back(it);
-    mPlaying.iter  = mPlaying.wave.end();
-    mPlaying.nLeft = 0;
+    if (ok) mPlaying.seq.replace(std::move(entry));
+    else mPlaying.seq.clear();
 
     setPower(power);
 }
@@ -315,13 +483,87 @@ NimBLE::COYOTE::V3Channel::setWaveform(const V2::Waveform& wave, uint8_t power)
 void
 NimBLE::COYOTE::V3Channel::setWaveform(const V3::Waveform& wave, uint8_t power)
 {
+    Accounting::Scope scope(*mDevice);
+
+    Sequencer<V3::WaveVal>::Entry entry;
+    bool ok = mPlaying.seq.compile(entry, wave, 0, 0, 0, 0);
+
+    SemLockGuard lk(mPlaying.mutex);
+
+    if (ok) mPlaying.seq.replace(std::move(entry));
+    else mPlaying.seq.clear();
+
+    setPower(power);
+}
+
+
+bool
+NimBLE::COYOTE::V3Channel::queueWaveform(const V2::Waveform& wave, uint8_t power, long ms, unsigned loops, long fadeMs)
+{
+    Accounting::Scope scope(*mDevice);
+
+    // Compile (and convert) outside of the lock so the transmit loop is never held up
+    Sequencer<V3::WaveVal>::Entry entry;
+    if (!mPlaying.seq.compile(entry, wave, power, ms, loops, fadeMs)) return false;
+
+    SemLockGuard lk(mPlaying.mutex);
+
+    return mPlaying.seq.push(std::move(entry));
+}
+
+
+bool
+NimBLE::COYOTE::V3Channel::queueWaveform(const V3::Waveform& wave, uint8_t power, long ms, unsigned loops, long fadeMs)
+{
+    Accounting::Scope scope(*mDevice);
+
+    Sequencer<V3::WaveVal>::Entry entry;
+    if (!mPlaying.seq.compile(entry, wave, power, ms, loops, fadeMs)) return false;
+
     SemLockGuard lk(mPlaying.mutex);
 
-    mPlaying.wave  = wave;
-    mPlaying.iter  = mPlaying.wave.end();
-    mPlaying.nLeft = 0;
+    return mPlaying.seq.push(std::move(entry));
+}
+
+
+bool
+NimBLE::COYOTE::V3Channel::setGenerator(Generator& gen, uint8_t power)
+{
+    Accounting::Scope scope(*mDevice);
+
+    Sequencer<V3::WaveVal>::Entry entry;
+    mPlaying.seq.compile(entry, gen, 0, 0, 0);
+
+    SemLockGuard lk(mPlaying.mutex);
+
+    mPlaying.seq.replace(std::move(entry));
 
     setPower(power);
+
+    return true;
+}
+
+
+bool
+NimBLE::COYOTE::V3Channel::queueGenerator(Generator& gen, uint8_t power, long ms, long fadeMs)
+{
+    Accounting::Scope scope(*mDevice);
+
+    Sequencer<V3::WaveVal>::Entry entry;
+    mPlaying.seq.compile(entry, gen, power, ms, fadeMs);
+
+    SemLockGuard lk(mPlaying.mutex);
+
+    return mPlaying.seq.push(std::move(entry));
+}
+
+
+void
+NimBLE::COYOTE::V3Channel::clearPlaylist()
+{
+    SemLockGuard lk(mPlaying.mutex);
+
+    mPlaying.seq.clear();
 }
 
 
@@ -330,13 +572,12 @@ NimBLE::COYOTE::V3Channel::start(long secs)
 {
     NimBLE::COYOTE::Channel::start(secs);
 
-    if (mPlaying.wave.size() == 0 || mPlaying.run) return;
-
     SemLockGuard lk(mPlaying.mutex);
 
-    mPlaying.iter  = mPlaying.wave.end();
-    mPlaying.nLeft = 0;
-    mPlaying.run   = true;
+    if (mPlaying.seq.empty() || mPlaying.run) return;
+
+    mPlaying.seq.restart(secs * 1000);
+    mPlaying.run = true;
 }
 
 
@@ -356,21 +597,21 @@ NimBLE::COYOTE::V3Channel::getNextSegment(uint8_t &freq, uint8_t &intensity)
 {
     freq      = 255;
     intensity = 255;
-    if (!mPlaying.run) return;
 
-    if (mPlaying.nLeft == 0) {
-        if (mPlaying.iter == mPlaying.wave.end()) {
-            mPlaying.iter = mPlaying.wave.begin();
-        }
+    SemLockGuard lk(mPlaying.mutex);
 
-        if (mPlaying.iter == mPlaying.wave.end()) return;
+    if (!mPlaying.run) return;
 
-        mPlaying.nLeft = (((mPlaying.iter->duration() - 1) / 100) + 1) * mPlaying.iter->getRepeat();
+    auto seg = mPlaying.seq.next();
+    if (seg == nullptr) {
+        // Stop once the requested play time has elapsed
+        if (mPlaying.seq.expired()) mPlaying.run = false;
+        return;
     }
 
-    freq      = mPlaying.iter->getFreq();
-    intensity = mPlaying.iter->getInt();
+    uint8_t power;
+    if (mPlaying.seq.newPower(power)) setPower(power);
 
-    mPlaying.nLeft--;
-    if (mPlaying.nLeft == 0) mPlaying.iter++;
-}
\ No newline at end of file
+    freq      = seg->getFreq();
+    intensity = seg->getInt();
+}
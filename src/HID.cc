@@ -0,0 +1,317 @@
+
+#include "NimBLE-Device/HID.hh"
+
+#include <cstring>
+
+
+//
+// Short item types and tags, as per HID 1.11 section 6.2.2
+//
+enum {MAIN = 0, GLOBAL = 1, LOCAL = 2};
+
+enum {INPUT = 0x8, OUTPUT = 0x9, COLLECTION = 0xA, FEATURE = 0xB, END_COLLECTION = 0xC};
+enum {USAGE_PAGE = 0x0, LOGICAL_MIN = 0x1, LOGICAL_MAX = 0x2, REPORT_SIZE = 0x7, REPORT_ID = 0x8, REPORT_COUNT = 0x9, PUSH = 0xA, POP = 0xB};
+enum {USAGE = 0x0, USAGE_MIN = 0x1, USAGE_MAX = 0x2};
+
+// Input item flags
+static const uint32_t sConstant = 0x01;
+static const uint32_t sVariable = 0x02;
+
+// Keyboard page usages reporting too many keys pressed at once
+static const uint16_t sErrorRollOver = 0x01;
+static const uint16_t sErrorUndefined = 0x03;
+
+
+static bool
+isKeyPage(uint16_t page)
+{
+    return page == NimBLE::HID::KEYBOARD || page == NimBLE::HID::BUTTON || page == NimBLE::HID::CONSUMER;
+}
+
+
+NimBLE::HID::ReportMap::ReportMap()
+    : mFields()
+    , mReports()
+    , mUsages()
+    , mPrev()
+{
+}
+
+
+bool
+NimBLE::HID::ReportMap::compile(const uint8_t* desc, size_t len)
+{
+    struct Globals {
+        uint16_t page;
+        int32_t  logMin;
+        int32_t  logMax;
+        uint32_t reportSize;
+        uint32_t reportCount;
+        uint8_t  reportId;
+    };
+
+    Globals  globals = {};
+    Globals  stack[4];
+    unsigned depth = 0;
+
+    // Local items, reset after every main item
+    std::vector<uint32_t> usages;
+    uint32_t usageMin = 0;
+    uint32_t usageMax = 0;
+    bool     haveRange = false;
+
+    // Fields are collected per report, then laid out contiguously
+    std::vector<std::vector<Field>> fields;
+
+    mFields.clear();
+    mReports.clear();
+    mUsages.clear();
+    mPrev.clear();
+
+    auto report = [&](uint8_t id) -> Report& {
+        for (auto& it : mReports) {
+            if (it.id == id) return it;
+        }
+        mReports.push_back({id, 0, 0, 0, 0, 0});
+        fields.emplace_back();
+        return mReports.back();
+    };
+
+    // Full 32-bit usages carry their own page
+    auto pageOf  = [&](uint32_t usage) -> uint16_t {return (usage > 0xFFFF) ? (usage >> 16) : globals.page;};
+
+    size_t i = 0;
+    while (i < len) {
+        uint8_t prefix = desc[i++];
+
+        // Long items are not used by any known device: skip them
+        if (prefix == 0xFE) {
+            if (i + 2 > len) return false;
+            i += 2 + desc[i];
+            continue;
+        }
+
+        unsigned size = prefix & 0x03;
+        if (size == 3) size = 4;
+        if (i + size > len) return false;
+
+        uint32_t data = 0;
+        for (unsigned b = 0; b < size; b++) data |= (uint32_t) desc[i + b] << (8 * b);
+        int32_t sdata = (size == 0 || size == 4) ? (int32_t) data : (int32_t) (data << (32 - 8 * size)) >> (32 - 8 * size);
+        i += size;
+
+        unsigned type = (prefix >> 2) & 0x03;
+        unsigned tag  = prefix >> 4;
+
+        switch (type) {
+        case MAIN:
+            if (tag == INPUT) {
+                Report& rpt = report(globals.reportId);
+                auto&   out = fields[&rpt - &mReports[0]];
+
+                bool keys = (data & sConstant) == 0 && globals.reportSize > 0 && globals.reportSize <= 32;
+
+                if (keys && (data & sVariable)) {
+                    // One key per element
+                    for (uint32_t n = 0; n < globals.reportCount; n++) {
+                        uint32_t usage = 0;
+                        if (n < usages.size()) usage = usages[n];
+                        else if (haveRange && usageMin + n <= usageMax) usage = usageMin + n;
+                        else if (!usages.empty()) usage = usages.back();
+
+                        if (!isKeyPage(pageOf(usage)) || (usage & 0xFFFF) == 0) continue;
+
+                        out.push_back({(uint16_t) (rpt.bits + n * globals.reportSize), (uint8_t) globals.reportSize, 1, false,
+                                       pageOf(usage), (uint16_t) usage, 0, -1, 0});
+                    }
+                } else if (keys && globals.reportCount <= 0xFF) {
+                    // A list of pressed keys, as indices in the usage range or list
+                    Field f = {rpt.bits, (uint8_t) globals.reportSize, (uint8_t) globals.reportCount, true,
+                               globals.page, 0, 0, -1, globals.logMin};
+                    if (haveRange) {
+                        f.page    = pageOf(usageMin);
+                        f.usage   = usageMin;
+                        f.nUsages = (usageMax >= usageMin) ? (usageMax & 0xFFFF) - (usageMin & 0xFFFF) + 1 : 0;
+                    } else if (!usages.empty()) {
+                        f.page     = pageOf(usages[0]);
+                        f.nUsages  = usages.size();
+                        f.usageIdx = mUsages.size();
+                        for (auto it : usages) mUsages.push_back(it);
+                    }
+                    if (isKeyPage(f.page) && f.nUsages > 0) out.push_back(f);
+                }
+
+                rpt.bits += globals.reportSize * globals.reportCount;
+            }
+            // Output and feature reports are not decoded: only the input report layout matters
+
+            usages.clear();
+            haveRange = false;
+            break;
+
+        case GLOBAL:
+            switch (tag) {
+            case USAGE_PAGE:   globals.page        = data;  break;
+            case LOGICAL_MIN:  globals.logMin      = sdata; break;
+            case LOGICAL_MAX:  globals.logMax      = sdata; break;
+            case REPORT_SIZE:  globals.reportSize  = data;  break;
+            case REPORT_COUNT: globals.reportCount = data;  break;
+            case REPORT_ID:    globals.reportId    = data;  break;
+            case PUSH:
+                if (depth == sizeof(stack) / sizeof(stack[0])) return false;
+                stack[depth++] = globals;
+                break;
+            case POP:
+                if (depth == 0) return false;
+                globals = stack[--depth];
+                break;
+            }
+            break;
+
+        case LOCAL:
+            switch (tag) {
+            case USAGE:     usages.push_back(data); break;
+            case USAGE_MIN: usageMin = data; haveRange = true; break;
+            case USAGE_MAX: usageMax = data; haveRange = true; break;
+            }
+            break;
+        }
+    }
+
+    // Lay out the plan and the previous report buffers
+    size_t prevLen = 0;
+    for (size_t n = 0; n < mReports.size(); n++) {
+        Report& rpt = mReports[n];
+
+        rpt.firstField = mFields.size();
+        rpt.nFields    = fields[n].size();
+        rpt.prevOffset = prevLen;
+        rpt.prevLen    = (rpt.bits + 7) / 8;
+        prevLen       += rpt.prevLen;
+
+        mFields.insert(mFields.end(), fields[n].begin(), fields[n].end());
+    }
+    mPrev.assign(prevLen, 0);
+
+    if (!isValid()) {
+        mReports.clear();
+        return false;
+    }
+
+    return true;
+}
+
+
+bool
+NimBLE::HID::ReportMap::isValid() const
+{
+    return !mFields.empty();
+}
+
+
+NimBLE::HID::ReportMap::Report*
+NimBLE::HID::ReportMap::find(uint8_t reportId)
+{
+    for (auto& it : mReports) {
+        if (it.id == reportId) return &it;
+    }
+    return nullptr;
+}
+
+
+uint32_t
+NimBLE::HID::ReportMap::extract(const uint8_t* data, size_t len, unsigned bitOffset, unsigned bitSize)
+{
+    unsigned first  = bitOffset / 8;
+    unsigned shift  = bitOffset % 8;
+    unsigned nBytes = (shift + bitSize + 7) / 8;
+
+    // A field beyond the end of a short report reads as 0
+    if (first + nBytes > len) return 0;
+
+    uint64_t v = 0;
+    for (unsigned b = 0; b < nBytes; b++) v |= (uint64_t) data[first + b] << (8 * b);
+
+    return (v >> shift) & ((1ULL << bitSize) - 1);
+}
+
+
+void
+NimBLE::HID::ReportMap::diff(const Report& rpt, const uint8_t* prev, size_t prevLen, const uint8_t* data, size_t len, const KeyHandler_t& fct)
+{
+    const Field* end = mFields.data() + rpt.firstField + rpt.nFields;
+
+    for (const Field* f = mFields.data() + rpt.firstField; f != end; f++) {
+        if (!f->array) {
+            bool was = extract(prev, prevLen, f->bitOffset, f->bitSize) != 0;
+            bool is  = extract(data, len, f->bitOffset, f->bitSize) != 0;
+            if (was != is) fct(f->page, f->usage, is);
+            continue;
+        }
+
+        // Index to usage, with 0 meaning no key
+        auto usageAt = [f, this](uint32_t val) -> uint16_t {
+            int32_t idx = (int32_t) val - f->logMin;
+            if (idx < 0 || idx >= f->nUsages) return 0;
+            return (f->usageIdx < 0) ? f->usage + idx : mUsages[f->usageIdx + idx];
+        };
+
+        auto contains = [f](const uint8_t* buf, size_t bufLen, uint32_t val) {
+            for (unsigned n = 0; n < f->count; n++) {
+                if (extract(buf, bufLen, f->bitOffset + n * f->bitSize, f->bitSize) == val) return true;
+            }
+            return false;
+        };
+
+        for (unsigned n = 0; n < f->count; n++) {
+            uint32_t val = extract(prev, prevLen, f->bitOffset + n * f->bitSize, f->bitSize);
+            uint16_t usage = usageAt(val);
+            if (usage != 0 && !contains(data, len, val)) fct(f->page, usage, false);
+        }
+        for (unsigned n = 0; n < f->count; n++) {
+            uint32_t val = extract(data, len, f->bitOffset + n * f->bitSize, f->bitSize);
+            uint16_t usage = usageAt(val);
+            if (usage != 0 && !contains(prev, prevLen, val)) fct(f->page, usage, true);
+        }
+    }
+}
+
+
+bool
+NimBLE::HID::ReportMap::decode(uint8_t reportId, const uint8_t* data, size_t len, const KeyHandler_t& fct)
+{
+    Report* rpt = find(reportId);
+    if (rpt == nullptr) return false;
+
+    uint8_t* prev = mPrev.data() + rpt->prevOffset;
+
+    // A keyboard reporting a roll-over error does not say which keys are pressed: keep the previous state
+    const Field* end = mFields.data() + rpt->firstField + rpt->nFields;
+    for (const Field* f = mFields.data() + rpt->firstField; f != end; f++) {
+        if (!f->array || f->page != KEYBOARD) continue;
+
+        uint32_t val = extract(data, len, f->bitOffset, f->bitSize) - f->logMin;
+        uint16_t usage = (f->usageIdx < 0) ? f->usage + val : 0;
+        if (usage >= sErrorRollOver && usage <= sErrorUndefined) return true;
+    }
+
+    diff(*rpt, prev, rpt->prevLen, data, len, fct);
+
+    size_t n = (len < rpt->prevLen) ? len : rpt->prevLen;
+    memcpy(prev, data, n);
+    memset(prev + n, 0, rpt->prevLen - n);
+
+    return true;
+}
+
+
+void
+NimBLE::HID::ReportMap::reset(const KeyHandler_t& fct)
+{
+    for (auto& rpt : mReports) {
+        uint8_t* prev = mPrev.data() + rpt.prevOffset;
+
+        diff(rpt, prev, rpt.prevLen, nullptr, 0, fct);
+        memset(prev, 0, rpt.prevLen);
+    }
+}
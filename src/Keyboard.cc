@@ -1,17 +1,122 @@
 #include "NimBLE-Device/Keyboard.hh"
+#include "Runtime.hh"
+
+#include <climits>
+
+
+static const long sNoDeadline = LONG_MAX;
 
 
 NimBLE::Keyboard::Device::Device(const char* uniqueName, const char* bleName, const char* macAddr, uint8_t addrType)
     : NimBLE::InterestingDevice(uniqueName, bleName, macAddr, addrType)
+    , mPressed()
     , mListeners()
+    , mReportMap()
+    , mKeyHandler()
+    , mGestureMutex(xSemaphoreCreateRecursiveMutex())
+    , mTiming({250, 300, 600, 150, 80})
+    , mNextDeadline(sNoDeadline)
+    , mChords()
+    , mGestureListeners()
 {
     for (uint16_t i = 0; i < 256; i++) mKeyMap[i] = i;
-    bzero(mPressed, sizeof(mPressed));
+    for (auto& it : mTracks) it.state = IDLE;
+
+    mKeyHandler = [this](uint16_t page, uint16_t usage, bool pressed) {
+        // Keys are 8 bits: usages beyond that (e.g. some consumer controls) cannot be reported
+        if (usage > 0xFF) {
+            ESP_LOGD(getName(), "Ignoring usage 0x%02x:0x%04x", page, usage);
+            return;
+        }
+        publish(usage, (pressed) ? PRESSED : RELEASED);
+    };
 }
 
 
 NimBLE::Keyboard::Device::~Device()
 {
+    vSemaphoreDelete(mGestureMutex);
+}
+
+
+bool
+NimBLE::Keyboard::Device::doInitDevice()
+{
+    return initHID();
+}
+
+
+bool
+NimBLE::Keyboard::Device::initHID()
+{
+    mClient->discoverAttributes();
+
+    auto pSvc = mClient->getService(NimBLEUUID((uint16_t) 0x1812));
+    if (pSvc == nullptr) {
+        ESP_LOGE(getName(), "Cannot find HID service.");
+        return false;
+    }
+
+    auto pMap = pSvc->getCharacteristic(NimBLEUUID((uint16_t) 0x2A4B));
+    if (pMap == nullptr || !pMap->canRead()) {
+        ESP_LOGE(getName(), "Cannot find HID report map.");
+        return false;
+    }
+
+    auto desc = pMap->readValue();
+    if (!mReportMap.compile(desc.data(), desc.length())) {
+        ESP_LOGE(getName(), "Cannot decode HID report map: %s", image(desc.data(), desc.length()));
+        return false;
+    }
+
+    // Each input report characteristic has a Report Reference descriptor with its report ID and type
+    unsigned nReports = 0;
+    for (auto it : *(pSvc->getCharacteristics())) {
+        if (!it->canNotify()) continue;
+        if (it->getUUID() != (uint16_t) 0x2A4D) continue;
+
+        uint8_t id = 0;
+        auto ref = it->getDescriptor(NimBLEUUID((uint16_t) 0x2908));
+        if (ref != nullptr) {
+            auto val = ref->readValue();
+            if (val.length() >= 2) {
+                if (val.data()[1] != 0x01) continue;
+                id = val.data()[0];
+            }
+        }
+
+        if (!mRouter.subscribe(it, this, &Router::taggedHandler<Device, &Device::notifyReport>, id)) {
+            ESP_LOGE(getName(), "Cannot subscribe to HID input report %d.", id);
+            return false;
+        }
+        nReports++;
+    }
+
+    if (nReports == 0) {
+        ESP_LOGE(getName(), "Cannot find HID input reports.");
+        return false;
+    }
+
+    return true;
+}
+
+
+void
+NimBLE::Keyboard::Device::notifyReport(uint8_t reportId, const uint8_t* pData, size_t length)
+{
+    if (!mReportMap.decode(reportId, pData, length, mKeyHandler)) {
+        ESP_LOGD(getName(), "Unknown report %d: %s", reportId, image(pData, length));
+    }
+}
+
+
+void
+NimBLE::Keyboard::Device::notifyEvent(uint8_t event)
+{
+    // Do not leave keys stuck down
+    if (event == DISCONNECTED) mReportMap.reset(mKeyHandler);
+
+    NimBLE::InterestingDevice::notifyEvent(event);
 }
 
 
@@ -46,6 +151,218 @@ NimBLE::Keyboard::Device::subscribe(std::function<void(uint8_t key, Event_t e)>
 void
 NimBLE::Keyboard::Device::publish(uint8_t key, Event_t e)
 {
+    publish(key, e, RUNTIME::nowInMs());
+}
+
+
+void
+NimBLE::Keyboard::Device::publish(uint8_t key, Event_t e, long nowInMs)
+{
+    key = mKeyMap[key];
+
     mPressed[key] = (e == PRESSED);
     for (auto& it : mListeners) it.fct(key, e);
+
+    SemLockGuard lk(mGestureMutex);
+
+    // Report anything that was due before this event
+    serviceGestures(nowInMs);
+
+    if (e == PRESSED) {
+        auto t = track(key, true);
+        if (t == nullptr) return;
+
+        if (t->state == UP && nowInMs - t->deadline <= 0) {
+            t->state = DOWN_AGAIN;
+        } else {
+            t->state = DOWN;
+        }
+        t->downMs   = nowInMs;
+        t->deadline = nowInMs + mTiming.longPressMs;
+
+        checkChords(nowInMs);
+    } else {
+        auto t = track(key, false);
+        if (t == nullptr) return;
+
+        switch (t->state) {
+        case DOWN:
+            if (nowInMs - t->downMs <= mTiming.tapMaxMs) {
+                // Wait to see if it becomes a double-tap
+                t->state    = UP;
+                t->deadline = nowInMs + mTiming.doubleTapGapMs;
+            } else {
+                t->state = IDLE;
+            }
+            break;
+
+        case DOWN_AGAIN:
+            t->state = IDLE;
+            if (nowInMs - t->downMs <= mTiming.tapMaxMs) gesture(key, DOUBLE_TAP);
+            break;
+
+        default:
+            t->state = IDLE;
+            break;
+        }
+    }
+
+    updateDeadline();
+}
+
+
+void
+NimBLE::Keyboard::Device::setGestureTiming(const GestureTiming& timing)
+{
+    SemLockGuard lk(mGestureMutex);
+
+    mTiming = timing;
+}
+
+
+NimBLE::Keyboard::Device::GestureTiming
+NimBLE::Keyboard::Device::getGestureTiming()
+{
+    SemLockGuard lk(mGestureMutex);
+
+    return mTiming;
+}
+
+
+void
+NimBLE::Keyboard::Device::subscribeGestures(std::function<void(uint8_t key, Gesture_t g)> fct)
+{
+    SemLockGuard lk(mGestureMutex);
+
+    mGestureListeners.push_back(fct);
+}
+
+
+bool
+NimBLE::Keyboard::Device::addChord(uint8_t id, std::initializer_list<uint8_t> keys)
+{
+    if (keys.size() < 2 || keys.size() > 4) return false;
+
+    SemLockGuard lk(mGestureMutex);
+
+    Chord chord = {id, (uint8_t) keys.size(), {}};
+    unsigned i = 0;
+    for (auto it : keys) chord.keys[i++] = it;
+    mChords.push_back(chord);
+
+    return true;
+}
+
+
+void
+NimBLE::Keyboard::Device::serviceLoop(long nowInMs)
+{
+    serviceGestures(nowInMs);
+}
+
+
+void
+NimBLE::Keyboard::Device::serviceGestures(long nowInMs)
+{
+    if (nowInMs < mNextDeadline) return;
+
+    SemLockGuard lk(mGestureMutex);
+
+    for (auto& it : mTracks) {
+        if (it.state == IDLE || nowInMs < it.deadline) continue;
+
+        switch (it.state) {
+        case DOWN:
+        case DOWN_AGAIN:
+            gesture(it.key, LONG_PRESS);
+            it.state    = HELD;
+            it.deadline = nowInMs + mTiming.repeatMs;
+            break;
+
+        case HELD:
+            gesture(it.key, REPEAT);
+            it.deadline += mTiming.repeatMs;
+            if (it.deadline <= nowInMs) it.deadline = nowInMs + mTiming.repeatMs;
+            break;
+
+        case UP:
+            gesture(it.key, TAP);
+            it.state = IDLE;
+            break;
+
+        default:
+            it.deadline = sNoDeadline;
+            break;
+        }
+    }
+
+    updateDeadline();
+}
+
+
+NimBLE::Keyboard::Device::KeyTrack*
+NimBLE::Keyboard::Device::track(uint8_t key, bool alloc)
+{
+    KeyTrack* free = nullptr;
+
+    for (auto& it : mTracks) {
+        if (it.state != IDLE && it.key == key) return &it;
+        if (it.state == IDLE && free == nullptr) free = &it;
+    }
+    if (!alloc || free == nullptr) return nullptr;
+
+    free->key      = key;
+    free->state    = IDLE;
+    free->deadline = sNoDeadline;
+
+    return free;
+}
+
+
+void
+NimBLE::Keyboard::Device::checkChords(long nowInMs)
+{
+    for (auto& chord : mChords) {
+        KeyTrack* keys[4];
+        unsigned  n = 0;
+
+        for (; n < chord.nKeys; n++) {
+            keys[n] = track(chord.keys[n], false);
+            if (keys[n] == nullptr) break;
+            if (keys[n]->state != DOWN && keys[n]->state != DOWN_AGAIN) break;
+            if (nowInMs - keys[n]->downMs > mTiming.chordWindowMs) break;
+        }
+        if (n < chord.nKeys) continue;
+
+        // The keys in the chord do not report any other gesture
+        for (n = 0; n < chord.nKeys; n++) {
+            keys[n]->state    = CONSUMED;
+            keys[n]->deadline = sNoDeadline;
+        }
+        gesture(chord.id, CHORD);
+
+        return;
+    }
+}
+
+
+void
+NimBLE::Keyboard::Device::gesture(uint8_t key, Gesture_t g)
+{
+    ESP_LOGD(getName(), "Gesture %d on 0x%02x", g, key);
+    for (auto& it : mGestureListeners) it(key, g);
+}
+
+
+void
+NimBLE::Keyboard::Device::updateDeadline()
+{
+    long next = sNoDeadline;
+
+    for (auto& it : mTracks) {
+        if (it.state == IDLE || it.state == CONSUMED) continue;
+        if (it.deadline < next) next = it.deadline;
+    }
+
+    mNextDeadline = next;
 }
@@ -0,0 +1,89 @@
+#include "NimBLE-Device/LinkProbe.hh"
+
+
+NimBLE::LinkProbe::LinkProbe()
+    : mPeriodMs(500)
+    , mMaxMs(250)
+    , mMissed(2)
+    , mMisses(0)
+    , mInFlight(false)
+    , mSentMs(0)
+    , mNextMs(0)
+    , mLastHeardMs(0)
+    , mSent(0)
+    , mAnswerMs(0)
+    , mAnswered(0)
+{
+}
+
+
+void
+NimBLE::LinkProbe::setTiming(long periodMs, long maxMs, unsigned missed)
+{
+    mPeriodMs = periodMs;
+    mMaxMs    = maxMs;
+    mMissed   = (missed > 0) ? missed : 1;
+}
+
+
+void
+NimBLE::LinkProbe::restart(long nowInMs)
+{
+    // Answers still owed on the previous link are never coming
+    mSent        = mAnswered.load();
+    mMisses      = 0;
+    mInFlight    = false;
+    mNextMs      = nowInMs + mPeriodMs;
+    mLastHeardMs = nowInMs;
+}
+
+
+NimBLE::LinkProbe::Status_t
+NimBLE::LinkProbe::check(long nowInMs)
+{
+    if (!mInFlight) return (nowInMs - mNextMs < 0) ? WAIT : PROBE;
+
+    if ((int) (mAnswered.load() - mSent) >= 0) {
+        mInFlight = false;
+
+        long answerMs = mAnswerMs;
+        if (answerMs != 0 && answerMs - mSentMs >= 0 && answerMs - mSentMs <= mMaxMs) {
+            mMisses      = 0;
+            mLastHeardMs = answerMs;
+            return ANSWERED;
+        }
+    } else if (nowInMs - mSentMs <= mMaxMs) {
+        return WAIT;
+    } else {
+        // Its answer, if any, will be ignored
+        mInFlight = false;
+    }
+
+    return (++mMisses < mMissed) ? MISSED : LOST;
+}
+
+
+void
+NimBLE::LinkProbe::sent(long nowInMs)
+{
+    mSent++;
+    mInFlight = true;
+    mSentMs   = nowInMs;
+    mNextMs   = nowInMs + mPeriodMs;
+}
+
+
+void
+NimBLE::LinkProbe::answered(bool ok, long nowInMs)
+{
+    // The time of the answer is visible once it is counted
+    mAnswerMs = (!ok) ? 0 : (nowInMs != 0) ? nowInMs : 1;
+    mAnswered++;
+}
+
+
+long
+NimBLE::LinkProbe::getLastHeard() const
+{
+    return mLastHeardMs;
+}
@@ -8,27 +8,64 @@
 //
 
 #include "NimBLE-Device.hh"
+#include "NimBLE-Device/Registry.hh"
+#include "NimBLE-Device/Arena.hh"
+#include "NimBLE-Device/Accounting.hh"
+#include "Runtime.hh"
 #include <sys/_intsup.h>
 
+#include <algorithm>
+
 using namespace NimBLE;
 
 
 
 std::vector<InterestingDevice*> InterestingDevice::sAllDevices;
+uint32_t                        InterestingDevice::sGeneration = 0;
+long                            InterestingDevice::sWindowMs   = 0;
+int                             InterestingDevice::sStrongDbm  = -50;
+bool                            InterestingDevice::sStopped    = false;
+InterestingDevice::StopStats    InterestingDevice::sStopStats  = {};
+
+
+//
+// Serializes the selection and binding of devices: scan results are handled by the host task,
+// while selection windows are closed by the application task.
+//
+static SemaphoreHandle_t
+selectMutex()
+{
+    static SemaphoreHandle_t mutex = xSemaphoreCreateRecursiveMutex();
+
+    return mutex;
+}
 
 
 InterestingDevice::InterestingDevice(const char* name, const char* bleName, const char* macAddr, uint8_t addrType)
     : NimBLEClientCallbacks()
     , mDev(NULL)
     , mClient(NULL)
+    , mRouter()
+    , mWrites()
+    , mWatchdog()
     , mUniqueName(name)
     , mDeviceName(bleName)
-    , mAddress(macAddr, addrType)
+    , mAddress((macAddr != NULL) ? NimBLEAddress(macAddr, addrType) : NimBLEAddress())
+    , mWildcard(macAddr == NULL)
     , mMustFind(false)
     , mFound(false)
     , mConnected(false)
+    , mConnecting(false)
     , mInit(false)
     , mService(true)
+    , mWarm(false)
+    , mParked(false)
+    , mLatched(false)
+    , mCandidates()
+    , mNumCandidates(0)
+    , mSelecting(false)
+    , mWindowEndMs(0)
+    , mState()
     , mEventCb()
 {
 }
@@ -37,13 +74,36 @@ InterestingDevice::InterestingDevice(const char* name, const char* bleName, cons
 InterestingDevice::~InterestingDevice()
 {
     if (mClient != NULL && mClient->isConnected()) mClient->disconnect();
+
+    SemLockGuard lk(selectMutex());
+
+    auto it = std::find(sAllDevices.begin(), sAllDevices.end(), this);
+    if (it != sAllDevices.end()) {
+        sAllDevices.erase(it);
+        sGeneration++;
+    }
 }
 
 void InterestingDevice::changeAddress(const char* macAddr)
 {
-    mAddress = NimBLEAddress(macAddr, mAddress.getType());
+    mAddress  = (macAddr != NULL) ? NimBLEAddress(macAddr, mAddress.getType()) : NimBLEAddress();
+    mWildcard = (macAddr == NULL);
+    sGeneration++;
+}
+
+void
+InterestingDevice::rearm()
+{
+    SemLockGuard lk(selectMutex());
+
+    mFound     = false;
+    mDev       = NULL;
+    mSelecting = false;
+    sGeneration++;
+    publishState();
 }
 
+
 bool
 InterestingDevice::addToDevicePool(InterestingDevice* dev, bool mustFind)
 {
@@ -51,8 +111,18 @@ InterestingDevice::addToDevicePool(InterestingDevice* dev, bool mustFind)
         if (it->mUniqueName == dev->mUniqueName) return false;
     }
 
+#ifdef CONFIG_NIMBLE_DEVICE_STATIC_ALLOC
+    // The pool never grows past its initial allocation
+    if (sAllDevices.capacity() == 0) sAllDevices.reserve(CONFIG_NIMBLE_DEVICE_MAX_DEVICES);
+    if (sAllDevices.size() == sAllDevices.capacity()) {
+        ESP_LOGE(dev->getName(), "Device pool is full (%u devices).", (unsigned) sAllDevices.size());
+        return false;
+    }
+#endif
+
     sAllDevices.push_back(dev);
     dev->mMustFind = mustFind;
+    sGeneration++;
 
     return true;
 }
@@ -65,17 +135,27 @@ InterestingDevice::foundDevice(NimBLEAdvertisedDevice* dev)
 
     ESP_LOGD("NimBLE-Device", "Found \"%s\" (%s)", dev->getName().c_str(), macAddr.c_str());
 
+    long now = RUNTIME::nowInMs();
+
+    SemLockGuard lk(selectMutex());
+
     for (auto it : sAllDevices) {
         if (it->mFound) continue;
 
-        if (it->mAddress != macAddr) continue;
+        if (!it->mWildcard && it->mAddress != dev->getAddress()) continue;
         if (it->mDeviceName != "" && dev->getName() != "" && it->mDeviceName != dev->getName()) continue;
 
-        it->mDev   = dev;
-        it->mFound = true;
+        if (it->mWildcard) {
+            // Another wildcard device with the same name may already have it
+            if (inUse(dev->getAddress())) continue;
+
+            if (sWindowMs > 0) {
+                if (it->addCandidate(dev, now) && it->selectCandidate(now)) return it;
+                continue;
+            }
+        }
 
-        ESP_LOGI("NimBLE-Device", "FOUND \"%s\" (%s)", dev->getName().c_str(), macAddr.c_str());
-        it->notifyEvent(FOUND);
+        it->bind(dev->getAddress(), dev);
 
         return it;
     }
@@ -84,6 +164,173 @@ InterestingDevice::foundDevice(NimBLEAdvertisedDevice* dev)
 }
 
 
+InterestingDevice*
+InterestingDevice::repeatedDevice(NimBLEAdvertisedDevice* dev)
+{
+    long now = RUNTIME::nowInMs();
+
+    SemLockGuard lk(selectMutex());
+
+    for (auto it : sAllDevices) {
+        if (it->mFound || !it->mSelecting) continue;
+
+        auto c = it->updateCandidate(dev->getAddress(), dev->getRSSI(), now);
+        if (c == nullptr) continue;
+
+        if ((c->rssi >= sStrongDbm || now - it->mWindowEndMs >= 0) && it->selectCandidate(now)) return it;
+    }
+
+    return NULL;
+}
+
+
+void
+InterestingDevice::bind(const NimBLEAddress& addr, NimBLEAdvertisedDevice* dev)
+{
+    // A wildcard device connects to the device that was found
+    if (mWildcard) mAddress = addr;
+
+    mDev       = dev;
+    mFound     = true;
+    mSelecting = false;
+    sGeneration++;
+    publishState();
+
+    ESP_LOGI("NimBLE-Device", "FOUND \"%s\" (%s)", mUniqueName.c_str(), addr.toString().c_str());
+    notifyEvent(FOUND);
+}
+
+
+bool
+InterestingDevice::inUse(const NimBLEAddress& addr)
+{
+    for (auto it : sAllDevices) {
+        if (it->mFound && it->mAddress == addr) return true;
+    }
+    return false;
+}
+
+
+void
+InterestingDevice::setSelectionWindow(long windowMs, int strongDbm)
+{
+    sWindowMs  = windowMs;
+    sStrongDbm = strongDbm;
+}
+
+
+bool
+InterestingDevice::addCandidate(NimBLEAdvertisedDevice* dev, long nowInMs)
+{
+    // The first candidate opens the selection window
+    if (!mSelecting) {
+        mSelecting     = true;
+        mNumCandidates = 0;
+        mWindowEndMs   = nowInMs + sWindowMs;
+    }
+
+    int rssi = dev->getRSSI();
+    auto addr = dev->getAddress();
+
+    Candidate* c = updateCandidate(addr, rssi, nowInMs);
+    if (c == nullptr) {
+        if (mNumCandidates < sMaxCandidates) {
+            c = &mCandidates[mNumCandidates++];
+        } else {
+            // Replace the weakest candidate, if weaker than this one
+            c = &mCandidates[0];
+            for (unsigned i = 1; i < mNumCandidates; i++) {
+                if (mCandidates[i].rssi < c->rssi) c = &mCandidates[i];
+            }
+            if (c->rssi >= rssi) return nowInMs - mWindowEndMs >= 0;
+        }
+        *c = {addr, rssi, 1, nowInMs, nowInMs, 0};
+    }
+
+    // A single strong advertisement is not enough once smoothed with weaker ones
+    return c->rssi >= sStrongDbm || nowInMs - mWindowEndMs >= 0;
+}
+
+
+InterestingDevice::Candidate*
+InterestingDevice::updateCandidate(const NimBLEAddress& addr, int rssi, long nowInMs)
+{
+    for (unsigned i = 0; i < mNumCandidates; i++) {
+        auto& c = mCandidates[i];
+        if (c.addr != addr) continue;
+
+        c.rssi = (c.rssi * 3 + rssi) / 4;
+        c.adverts++;
+        c.lastMs = nowInMs;
+
+        return &c;
+    }
+
+    return nullptr;
+}
+
+
+void
+InterestingDevice::rankCandidates()
+{
+    long windowMs = (sWindowMs > 0) ? sWindowMs : 1;
+
+    for (unsigned i = 0; i < mNumCandidates; i++) {
+        auto& c = mCandidates[i];
+
+        long rate = c.adverts * 1000 / windowMs;
+        if (rate > 10) rate = 10;
+        c.score = c.rssi + 2 * rate;
+    }
+
+    std::sort(mCandidates, mCandidates + mNumCandidates,
+              [](const Candidate& a, const Candidate& b) {return a.score > b.score;});
+}
+
+
+bool
+InterestingDevice::selectCandidate(long nowInMs)
+{
+    rankCandidates();
+
+    for (unsigned i = 0; i < mNumCandidates; i++) {
+        if (inUse(mCandidates[i].addr)) continue;
+
+        ESP_LOGI(getName(), "Selected %s (%d dBm, score %d) out of %u candidates.",
+                 mCandidates[i].addr.toString().c_str(), mCandidates[i].rssi, mCandidates[i].score, mNumCandidates);
+        bind(mCandidates[i].addr, NULL);
+
+        return true;
+    }
+
+    // All candidates were taken by other devices: start over
+    mSelecting = false;
+
+    return false;
+}
+
+
+void
+InterestingDevice::serviceSelection(long nowInMs)
+{
+    SemLockGuard lk(selectMutex());
+
+    for (auto it : sAllDevices) {
+        if (it->mFound || !it->mSelecting || nowInMs - it->mWindowEndMs < 0) continue;
+        it->selectCandidate(nowInMs);
+    }
+}
+
+
+std::vector<InterestingDevice::Candidate>
+InterestingDevice::getCandidates()
+{
+    SemLockGuard lk(selectMutex());
+
+    return std::vector<Candidate>(mCandidates, mCandidates + mNumCandidates);
+}
+
+
 const std::vector<InterestingDevice*>&
 InterestingDevice::getDevices()
 {
@@ -102,6 +349,18 @@ InterestingDevice::getFoundDevices()
 }
 
 
+unsigned
+InterestingDevice::getFoundDevices(InterestingDevice* devs[], unsigned max)
+{
+    unsigned n = 0;
+    for (auto it : sAllDevices) {
+        if (n == max) break;
+        if (it->mFound) devs[n++] = it;
+    }
+    return n;
+}
+
+
 InterestingDevice*
 InterestingDevice::getByName(const char* name)
 {
@@ -129,6 +388,69 @@ InterestingDevice::getName() const
 }
 
 
+const NimBLEAddress&
+InterestingDevice::getAddress() const
+{
+    return mAddress;
+}
+
+
+bool
+InterestingDevice::isWildcard() const
+{
+    return mWildcard;
+}
+
+
+bool
+InterestingDevice::syncWhiteList()
+{
+    auto pending = [](const NimBLEAddress& addr) {
+        for (auto it : sAllDevices) {
+            if (!it->mFound && !it->mWildcard && it->mAddress == addr) return true;
+        }
+        return false;
+    };
+
+    for (size_t i = NimBLEDevice::getWhiteListCount(); i > 0; i--) {
+        auto addr = NimBLEDevice::getWhiteListAddress(i - 1);
+        if (!pending(addr)) NimBLEDevice::whiteListRemove(addr);
+    }
+
+    bool wildcard = false;
+    for (auto it : sAllDevices) {
+        if (it->mFound) continue;
+        if (it->mWildcard) {
+            wildcard = true;
+            continue;
+        }
+        if (NimBLEDevice::onWhiteList(it->mAddress)) continue;
+        if (!NimBLEDevice::whiteListAdd(it->mAddress)) {
+            ESP_LOGW(it->getName(), "Cannot add %s to the white list.", it->mAddress.toString().c_str());
+            return false;
+        }
+    }
+
+    return !wildcard;
+}
+
+
+uint32_t
+InterestingDevice::getPoolGeneration()
+{
+    return sGeneration;
+}
+
+
+int
+InterestingDevice::getRssi()
+{
+    if (!mConnected || mClient == nullptr) return 0;
+
+    return mClient->getRssi();
+}
+
+
 void
 InterestingDevice::subscribeEvents(std::function<void(uint8_t)> fct)
 {
@@ -154,6 +476,7 @@ void
 InterestingDevice::notifyBatteryLevel(uint8_t percent)
 {
     ESP_LOGD(getName(), "Battery Level = %d%%", percent);
+    mWatchdog.beat(Watchdog::BATTERY);
     if (mBatteryCb) mBatteryCb(percent);
 }
 
@@ -165,16 +488,49 @@ InterestingDevice::wasFound()
 }
 
 
+void
+InterestingDevice::warmStart()
+{
+    SemLockGuard lk(selectMutex());
+
+    for (auto it : sAllDevices) {
+        if (it->mFound) continue;
+
+        Registry::Entry entry;
+        if (!Registry::lookup(it->getName(), entry)) continue;
+
+        auto addr = Registry::address(entry);
+        if (!it->mWildcard && it->mAddress != addr) continue;
+        if (inUse(addr)) continue;
+
+        ESP_LOGI(it->getName(), "Known as %s: connecting directly.", addr.toString().c_str());
+        if (it->mWildcard) it->mAddress = addr;
+        it->mFound = true;
+        it->mWarm  = true;
+        sGeneration++;
+        it->publishState();
+    }
+}
+
+
 bool
 InterestingDevice::initFoundDevices()
 {
+    // Do not wait for a scan to find the devices seen on a previous run
+    warmStart();
+
     // Connect before probing for fast-fail
     for (auto it : sAllDevices) {
         if (!it->mFound) continue;
 
         if (!it->connect()) {
             ESP_LOGI(it->getName(), "InterestingDevice connect() failed!");
-            return false;
+            if (!it->mWarm) return false;
+
+            // Leave it to the scan
+            Registry::failed(it->getName());
+            it->mWarm = false;
+            it->rearm();
         }
     }
     for (auto it : sAllDevices) {
@@ -189,6 +545,9 @@ bool
 InterestingDevice::initDevice()
 {
     if (mInit) return true;
+
+    Accounting::Scope scope(*this);
+    size_t            heap = Accounting::freeHeap();
     
     if (!connect()) {
         ESP_LOGE(getName(), "Cannot connect device");
@@ -196,13 +555,24 @@ InterestingDevice::initDevice()
     }
 
     notifyEvent(START_INIT);
+
+    // Handles may have changed since the last connection
+    mRouter.clear();
+    mWrites.clear();
     
     mInit = doInitDevice();
+    if (mInit) mParked = false;
+    mWatchdog.restart();
+    publishState();
+    if (mInit) Accounting::connected(*this, mClient, heap);
 
     notifyEvent(INIT);
 
     ESP_LOGI(mUniqueName.c_str(), "Ready!");
 
+    if (mInit) Registry::remember(getName(), mDeviceName.c_str(), mAddress, getRssi());
+    mWarm = false;
+
     return mInit;
 }
 
@@ -214,11 +584,83 @@ InterestingDevice::isConnected()
 }
 
 
+Router::Stats
+InterestingDevice::getNotificationStats() const
+{
+    return mRouter.getStats();
+}
+
+
+WriteQueue::Stats
+InterestingDevice::getWriteStats(WriteQueue::Class_t cls) const
+{
+    return mWrites.getStats(cls);
+}
+
+
+InterestingDevice::State
+InterestingDevice::getState() const
+{
+    return mState.read();
+}
+
+
+void
+InterestingDevice::publishState()
+{
+    State state = {mFound, mConnected, mInit, mParked};
+
+    mState.update([&state](State& s) {
+        s = state;
+    });
+}
+
+
+bool
+InterestingDevice::isLinkUp()
+{
+    return mClient != NULL && mClient->isConnected();
+}
+
+
+bool
+InterestingDevice::park()
+{
+    if (!isLinkUp()) return false;
+
+    ESP_LOGI(getName(), "Parking.");
+    mParked = true;
+    publishState();
+    mClient->disconnect();
+
+    return true;
+}
+
+
+bool
+InterestingDevice::isParked() const
+{
+    return mParked;
+}
+
+
+bool
+InterestingDevice::isConnecting() const
+{
+    return mConnecting;
+}
+
+
 bool
 InterestingDevice::doConnect(bool refresh, int attempt)
 {
     ESP_LOGI(mUniqueName.c_str(), "Connecting to %s...", mClient->getPeerAddress().toString().c_str());
-    if (!mClient->connect(refresh)) {
+
+    mConnecting = true;
+    bool ok     = mClient->connect(refresh);
+    mConnecting = false;
+
+    if (!ok) {
         ESP_LOGI(mUniqueName.c_str(), "connect(%d) failed!", attempt);
         return false;
     }
@@ -244,8 +686,9 @@ InterestingDevice::connect(bool refresh)
         mClient = NimBLEDevice::getClientByPeerAddress(mAddress);
         if (mClient) {
             if (doConnect(false, 1)) {
-                notifyEvent(CONNECTED);
                 mConnected = true;
+                publishState();
+                notifyEvent(CONNECTED);
                 return true;
             }
         } else {
@@ -261,7 +704,8 @@ InterestingDevice::connect(bool refresh)
     mClient->setClientCallbacks(this, false);
             
     /** Set how long we are willing to wait for the connection to complete (milliseconds), default is 30. */
-    mClient->setConnectTimeout(3000);
+    /** A known device that is not in range should not hold up the others for long */
+    mClient->setConnectTimeout((mWarm) ? 1000 : 3000);
         
     if (!doConnect(refresh, 2)) {
         /** Created a client but failed to connect, don't need to keep it as it has no data */
@@ -280,6 +724,7 @@ InterestingDevice::connect(bool refresh)
     }
 
     mConnected = true;
+    publishState();
     ESP_LOGI(mUniqueName.c_str(), "Connected!");
 
     notifyEvent(CONNECTED);
@@ -292,7 +737,47 @@ void
 InterestingDevice::serviceAllDevices(long nowInMs)
 {
     for (auto it : sAllDevices) {
-        if (it->mInit && it->mService) it->serviceLoop(nowInMs);
+        if (!it->mInit) continue;
+
+        it->checkHealth(nowInMs);
+        if (it->mService) it->serviceLoop(nowInMs);
+    }
+}
+
+
+Watchdog&
+InterestingDevice::getWatchdog()
+{
+    return mWatchdog;
+}
+
+
+void
+InterestingDevice::checkHealth(long nowInMs)
+{
+    unsigned stalled = mWatchdog.check(nowInMs);
+    if (stalled == 0) return;
+
+    for (unsigned i = 0; i < Watchdog::NUM_HEARTBEATS; i++) {
+        if ((stalled & (1 << i)) == 0) continue;
+
+        auto hb = (Watchdog::Heartbeat_t) i;
+        ESP_LOGW(getName(), "Stalled %s heartbeat.", Watchdog::getName(hb));
+
+        switch (mWatchdog.getAction(hb)) {
+        case Watchdog::REPORT:
+            break;
+        case Watchdog::RESET:
+            resetHeartbeat(hb);
+            break;
+        case Watchdog::RECONNECT:
+            // Also unblocks a write waiting for the link
+            if (isLinkUp()) mClient->disconnect();
+            break;
+        case Watchdog::EMERGENCY_STOP:
+            emergencyStop();
+            break;
+        }
     }
 }
 
@@ -312,11 +797,74 @@ InterestingDevice::reset()
 }
 
 
+unsigned
+InterestingDevice::emergencyStop()
+{
+    int64_t start = RUNTIME::nowInUs();
+
+    sStopped = true;
+
+    // Latch everything first, so no device can start a power write while the others are being stopped
+    for (auto it : sAllDevices) it->mLatched = it->latchStop();
+
+    unsigned n      = 0;
+    unsigned failed = 0;
+    for (auto it : sAllDevices) {
+        if (!it->mLatched || !it->isConnected()) continue;
+
+        n++;
+        if (!it->sendStop()) failed++;
+    }
+
+    long elapsed = RUNTIME::nowInUs() - start;
+
+    sStopStats.stops++;
+    sStopStats.devices = n;
+    sStopStats.failed  = failed;
+    sStopStats.lastUs  = elapsed;
+    if (elapsed > sStopStats.maxUs) sStopStats.maxUs = elapsed;
+
+    ESP_LOGW("NimBLE", "Emergency stop: %u devices in %ld us, %u failed.", n, elapsed, failed);
+
+    return n;
+}
+
+
+void
+InterestingDevice::clearEmergencyStop()
+{
+    for (auto it : sAllDevices) {
+        if (it->mLatched) it->releaseStop();
+        it->mLatched = false;
+    }
+
+    sStopped = false;
+}
+
+
+bool
+InterestingDevice::isEmergencyStopped()
+{
+    return sStopped;
+}
+
+
+InterestingDevice::StopStats
+InterestingDevice::getStopStats()
+{
+    return sStopStats;
+}
+
+
 void
 InterestingDevice::doDisconnect()
 {
     mConnected = false;
     mInit      = false;
+    publishState();
+
+    // A must-find device that lost its link is missing again, to be found by a scan
+    if (mMustFind && !mParked) rearm();
 }
 
 
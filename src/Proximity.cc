@@ -0,0 +1,264 @@
+#include "NimBLE-Device/Proximity.hh"
+
+
+NimBLE::Proximity::Proximity(unsigned maxDevices)
+    : mMutex(xSemaphoreCreateRecursiveMutex())
+    , mSlots(maxDevices)
+    , mNumSlots(0)
+    , mCursor(0)
+    , mFilter(KALMAN)
+    , mAlpha(0.25)
+    , mQ(0.5)
+    , mR(16)
+    , mNearDbm(-60)
+    , mFarDbm(-75)
+    , mLostMs(10000)
+    , mPeriodMs(1000)
+    , mMaxPerService(2)
+    , mStats()
+    , mStatsStartMs(0)
+    , mEventCb()
+{
+}
+
+
+NimBLE::Proximity::~Proximity()
+{
+    vSemaphoreDelete(mMutex);
+}
+
+
+NimBLE::Proximity::Slot*
+NimBLE::Proximity::find(InterestingDevice* dev)
+{
+    for (unsigned i = 0; i < mNumSlots; i++) {
+        if (mSlots[i].dev == dev) return &mSlots[i];
+    }
+    return nullptr;
+}
+
+
+bool
+NimBLE::Proximity::track(InterestingDevice& dev)
+{
+    SemLockGuard lk(mMutex);
+
+    if (find(&dev) != nullptr) return true;
+    if (mNumSlots == mSlots.size()) return false;
+
+    mSlots[mNumSlots++] = {&dev, 0, 0, 0, 0, 0, UNKNOWN};
+
+    return true;
+}
+
+
+void
+NimBLE::Proximity::untrack(InterestingDevice& dev)
+{
+    SemLockGuard lk(mMutex);
+
+    auto slot = find(&dev);
+    if (slot == nullptr) return;
+
+    // Keep the slots packed
+    *slot = mSlots[--mNumSlots];
+    if (mCursor >= mNumSlots) mCursor = 0;
+}
+
+
+void
+NimBLE::Proximity::setFilter(Filter_t filter, float alpha, float q, float r)
+{
+    SemLockGuard lk(mMutex);
+
+    mFilter = filter;
+    mAlpha  = alpha;
+    mQ      = q;
+    mR      = r;
+}
+
+
+void
+NimBLE::Proximity::setZones(int nearDbm, int farDbm, long lostMs)
+{
+    if (farDbm > nearDbm) farDbm = nearDbm;
+
+    SemLockGuard lk(mMutex);
+
+    mNearDbm = nearDbm;
+    mFarDbm  = farDbm;
+    mLostMs  = lostMs;
+}
+
+
+void
+NimBLE::Proximity::setSampling(long periodMs, unsigned maxPerService)
+{
+    SemLockGuard lk(mMutex);
+
+    mPeriodMs      = periodMs;
+    mMaxPerService = maxPerService;
+}
+
+
+void
+NimBLE::Proximity::subscribe(std::function<void(InterestingDevice& dev, Zone_t zone, int rssi)> fct)
+{
+    SemLockGuard lk(mMutex);
+
+    mEventCb = fct;
+}
+
+
+void
+NimBLE::Proximity::advertised(NimBLEAdvertisedDevice* adv, long nowInMs)
+{
+    auto addr = adv->getAddress();
+
+    SemLockGuard lk(mMutex);
+
+    for (unsigned i = 0; i < mNumSlots; i++) {
+        if (mSlots[i].dev->getAddress() != addr) continue;
+
+        sample(mSlots[i], adv->getRSSI(), nowInMs);
+        mStats.advSamples++;
+        return;
+    }
+}
+
+
+bool
+NimBLE::Proximity::report(InterestingDevice& dev, int rssi, long nowInMs)
+{
+    SemLockGuard lk(mMutex);
+
+    auto slot = find(&dev);
+    if (slot == nullptr) return false;
+
+    sample(*slot, rssi, nowInMs);
+    if (dev.isConnected()) mStats.connSamples++;
+    else mStats.advSamples++;
+
+    return true;
+}
+
+
+void
+NimBLE::Proximity::sample(Slot& slot, int rssi, long nowInMs)
+{
+    slot.raw    = rssi;
+    slot.lastMs = nowInMs;
+
+    if (slot.zone == UNKNOWN || slot.zone == LOST) {
+        // Start over from the first sample
+        slot.est = rssi;
+        slot.var = mR;
+    } else if (mFilter == EMA) {
+        slot.est += mAlpha * (rssi - slot.est);
+    } else {
+        slot.var += mQ;
+        float k   = slot.var / (slot.var + mR);
+        slot.est += k * (rssi - slot.est);
+        slot.var *= 1 - k;
+    }
+
+    switch (slot.zone) {
+    case NEAR:
+        if (slot.est < mFarDbm) changeZone(slot, FAR);
+        break;
+    case FAR:
+        if (slot.est >= mNearDbm) changeZone(slot, NEAR);
+        break;
+    default:
+        changeZone(slot, (slot.est >= mNearDbm) ? NEAR : FAR);
+        break;
+    }
+}
+
+
+void
+NimBLE::Proximity::changeZone(Slot& slot, Zone_t zone)
+{
+    slot.zone = zone;
+    mStats.events++;
+
+    ESP_LOGD(slot.dev->getName(), "Zone %d at %d dBm", zone, (int) slot.est);
+    if (mEventCb) mEventCb(*slot.dev, zone, (int) slot.est);
+}
+
+
+void
+NimBLE::Proximity::service(long nowInMs)
+{
+    SemLockGuard lk(mMutex);
+
+    mStats.services++;
+    if (mNumSlots == 0) return;
+
+    // Visit each device at most once, sampling at most the budgeted number of connected devices
+    unsigned sampled = 0;
+    for (unsigned n = 0; n < mNumSlots && sampled < mMaxPerService; n++) {
+        Slot& slot = mSlots[mCursor];
+        mCursor = (mCursor + 1) % mNumSlots;
+
+        if (nowInMs - slot.nextMs < 0 || !slot.dev->isConnected()) continue;
+
+        slot.nextMs = nowInMs + mPeriodMs;
+        sampled++;
+
+        int rssi = slot.dev->getRssi();
+        if (rssi == 0) continue;
+
+        sample(slot, rssi, nowInMs);
+        mStats.connSamples++;
+    }
+
+    for (unsigned i = 0; i < mNumSlots; i++) {
+        Slot& slot = mSlots[i];
+        if (slot.zone == UNKNOWN || slot.zone == LOST) continue;
+        if (nowInMs - slot.lastMs > mLostMs) changeZone(slot, LOST);
+    }
+}
+
+
+NimBLE::Proximity::Zone_t
+NimBLE::Proximity::getZone(InterestingDevice& dev)
+{
+    SemLockGuard lk(mMutex);
+
+    auto slot = find(&dev);
+    return (slot) ? slot->zone : UNKNOWN;
+}
+
+
+int
+NimBLE::Proximity::getRssi(InterestingDevice& dev)
+{
+    SemLockGuard lk(mMutex);
+
+    auto slot = find(&dev);
+    return (slot && slot->zone != UNKNOWN) ? (int) slot->est : 0;
+}
+
+
+NimBLE::Proximity::Stats
+NimBLE::Proximity::getStats(long nowInMs)
+{
+    SemLockGuard lk(mMutex);
+
+    Stats stats = mStats;
+    stats.tracked   = mNumSlots;
+    stats.elapsedMs = nowInMs - mStatsStartMs;
+
+    return stats;
+}
+
+
+void
+NimBLE::Proximity::resetStats(long nowInMs)
+{
+    SemLockGuard lk(mMutex);
+
+    mStats        = {};
+    mStatsStartMs = nowInMs;
+}
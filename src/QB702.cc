@@ -1,14 +1,28 @@
 #include "NimBLE-Device/QB702.hh"
+#include "Runtime.hh"
+
+
+// Most clicks recovered from a single gap, e.g. clicks made while disconnected.
+// A counter going backward to at most this value was reset on the ring.
+static const unsigned sMaxRecovered = 16;
 
 
 NimBLE::QB702::Device::Device(const char* uniqueName, const char* macAddr)
     : NimBLE::Keyboard::Device(uniqueName, "QB702", macAddr, 1)
+    , mMutex(xSemaphoreCreateRecursiveMutex())
+    , mHaveCounter(false)
+    , mReconnected(false)
+    , mCounter(0)
+    , mPending(0)
+    , mNextClickMs(0)
+    , mStats()
 {
 }
 
 
 NimBLE::QB702::Device::~Device()
 {
+    vSemaphoreDelete(mMutex);
 }
 
 
@@ -29,8 +43,7 @@ NimBLE::QB702::Device::doInitDevice()
         return false;
     }
 
-    pChr->subscribe(true, std::bind(&NimBLE::QB702::Device::notifyButton, this,
-                                    std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+    mRouter.subscribe(pChr, this, &Router::handler<Device, &Device::notifyButton>);
     
     return true;
 }
@@ -39,15 +52,125 @@ NimBLE::QB702::Device::doInitDevice()
 void
 NimBLE::QB702::Device::serviceLoop(long nowInMs)
 {
+    publishPending(nowInMs);
+
+    NimBLE::Keyboard::Device::serviceLoop(nowInMs);
 }
 
 
 void
-NimBLE::QB702::Device::notifyButton(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify)
+NimBLE::QB702::Device::notifyEvent(uint8_t event)
+{
+    if (event == DISCONNECTED) {
+        SemLockGuard lk(mMutex);
+
+        mReconnected = true;
+    }
+
+    NimBLE::Keyboard::Device::notifyEvent(event);
+}
+
+
+NimBLE::QB702::Device::Stats
+NimBLE::QB702::Device::getStats()
+{
+    SemLockGuard lk(mMutex);
+
+    return mStats;
+}
+
+
+long
+NimBLE::QB702::Device::getCounter()
+{
+    SemLockGuard lk(mMutex);
+
+    return (mHaveCounter) ? mCounter : -1;
+}
+
+
+void
+NimBLE::QB702::Device::notifyButton(const uint8_t* pData, size_t length)
 {
     // The counter value is in pData[6..7] in big endian order
-    // ESP_LOGI("QB702", "-> %s", image(pData, length));    
+    // ESP_LOGI("QB702", "-> %s", image(pData, length));
+    if (length < 8) {
+        ESP_LOGW(getName(), "Short notification: %s", image(pData, length));
+        return;
+    }
+
+    SemLockGuard lk(mMutex);
+
+    uint16_t counter = (pData[6] << 8) | pData[7];
+    unsigned clicks  = 1;
+
+    if (mHaveCounter) {
+        uint16_t delta = counter - mCounter;
+
+        if (delta == 0) {
+            mStats.duplicates++;
+            return;
+        }
+
+        if (delta < 0x8000) {
+            clicks = delta;
+        } else if (counter <= sMaxRecovered || mReconnected) {
+            // Counter was reset: it is the number of clicks since then
+            mStats.resets++;
+            clicks = counter;
+        } else {
+            // An old notification
+            mStats.stale++;
+            return;
+        }
+    }
+    mHaveCounter = true;
+    mReconnected = false;
+    mCounter     = counter;
+
+    if (clicks == 0) return;
+    if (clicks > 1) {
+        ESP_LOGI(getName(), "Recovering %u missed clicks", clicks - 1);
+        if (clicks > sMaxRecovered) {
+            mStats.dropped += clicks - sMaxRecovered;
+            clicks = sMaxRecovered;
+        }
+        mStats.recovered += clicks - 1;
+    }
+
+    // Clicks already pending are reported first
+    long now = RUNTIME::nowInMs();
+    if (clicks == 1 && mPending == 0) {
+        click(now);
+        return;
+    }
+    mPending += clicks;
+    publishPending(now);
+}
+
+
+void
+NimBLE::QB702::Device::click(long nowInMs)
+{
+    // Translate button press to a SPC.
+    // There is no release notification: a press is a click
+    NimBLE::Keyboard::Device::publish(' ', NimBLE::Keyboard::Device::PRESSED, nowInMs);
+    NimBLE::Keyboard::Device::publish(' ', NimBLE::Keyboard::Device::RELEASED, nowInMs);
+
+    mStats.clicks++;
+
+    // A click sooner than that would make a double-tap with this one
+    mNextClickMs = nowInMs + getGestureTiming().doubleTapGapMs + 1;
+}
+
+
+void
+NimBLE::QB702::Device::publishPending(long nowInMs)
+{
+    SemLockGuard lk(mMutex);
+
+    if (mPending == 0 || nowInMs - mNextClickMs < 0) return;
 
-    // Translate button press to a SPC
-    NimBLE::Keyboard::Device::publish(' ', NimBLE::Keyboard::Device::PRESSED);
+    click(nowInMs);
+    mPending--;
 }
@@ -0,0 +1,273 @@
+#include "NimBLE-Device/Registry.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_LINUX)
+#include "nvs.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+// Changes whenever the layout of the image changes
+static const uint32_t sMagic = 0x4E424452;
+
+static const unsigned sMaxFailures = 3;
+
+
+NimBLE::Registry::Image* NimBLE::Registry::sImage = nullptr;
+bool                     NimBLE::Registry::sDirty = false;
+
+
+#if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_LINUX)
+
+//
+// On the target, the image is kept in RAM and written as a single NVS blob
+//
+static nvs_handle_t sHandle;
+
+
+bool
+NimBLE::Registry::load(const char* where)
+{
+    if (nvs_open(where, NVS_READWRITE, &sHandle) != ESP_OK) return false;
+
+    static Image image;
+    sImage = &image;
+
+    size_t len = sizeof(image);
+    if (nvs_get_blob(sHandle, "registry", sImage, &len) != ESP_OK || len != sizeof(image)) sImage->magic = 0;
+
+    return true;
+}
+
+
+bool
+NimBLE::Registry::flush()
+{
+    sDirty = false;
+
+    return nvs_set_blob(sHandle, "registry", sImage, sizeof(*sImage)) == ESP_OK && nvs_commit(sHandle) == ESP_OK;
+}
+
+
+void
+NimBLE::Registry::unload()
+{
+    nvs_close(sHandle);
+}
+
+#else
+
+//
+// On the host, the image is a memory-mapped file
+//
+static int sFd = -1;
+
+
+bool
+NimBLE::Registry::load(const char* where)
+{
+    sFd = ::open(where, O_RDWR | O_CREAT, 0644);
+    if (sFd < 0) return false;
+
+    if (ftruncate(sFd, sizeof(Image)) != 0) {
+        ::close(sFd);
+        return false;
+    }
+
+    void* p = mmap(nullptr, sizeof(Image), PROT_READ | PROT_WRITE, MAP_SHARED, sFd, 0);
+    if (p == MAP_FAILED) {
+        ::close(sFd);
+        return false;
+    }
+    sImage = (Image*) p;
+
+    return true;
+}
+
+
+bool
+NimBLE::Registry::flush()
+{
+    sDirty = false;
+
+    return msync(sImage, sizeof(*sImage), MS_SYNC) == 0;
+}
+
+
+void
+NimBLE::Registry::unload()
+{
+    munmap(sImage, sizeof(*sImage));
+    ::close(sFd);
+}
+
+#endif
+
+
+bool
+NimBLE::Registry::open(const char* where)
+{
+    if (sImage != nullptr) return true;
+
+    if (!load(where)) {
+        ESP_LOGE("Registry", "Cannot open \"%s\".", where);
+        sImage = nullptr;
+        return false;
+    }
+
+    if (sImage->magic != sMagic || sImage->count > MAX_ENTRIES) {
+        ESP_LOGI("Registry", "Initializing \"%s\".", where);
+        clear();
+    }
+
+    return true;
+}
+
+
+void
+NimBLE::Registry::close()
+{
+    if (sImage == nullptr) return;
+
+    if (sDirty) flush();
+    unload();
+    sImage = nullptr;
+}
+
+
+bool
+NimBLE::Registry::isOpen()
+{
+    return sImage != nullptr;
+}
+
+
+NimBLE::Registry::Entry*
+NimBLE::Registry::find(const char* name)
+{
+    for (unsigned i = 0; i < sImage->count; i++) {
+        if (strncmp(sImage->entries[i].name, name, sizeof(Entry::name)) == 0) return &sImage->entries[i];
+    }
+    return nullptr;
+}
+
+
+bool
+NimBLE::Registry::lookup(const char* name, Entry& entry)
+{
+    if (sImage == nullptr) return false;
+
+    auto e = find(name);
+    if (e == nullptr) return false;
+
+    entry = *e;
+
+    return true;
+}
+
+
+bool
+NimBLE::Registry::remember(const char* name, const char* bleName, const NimBLEAddress& addr, int rssi)
+{
+    if (sImage == nullptr) return false;
+
+    auto e       = find(name);
+    bool changed = e == nullptr;
+    if (e == nullptr) {
+        if (sImage->count < MAX_ENTRIES) {
+            e = &sImage->entries[sImage->count++];
+        } else {
+            e = &sImage->entries[0];
+            for (unsigned i = 1; i < sImage->count; i++) {
+                if (sImage->entries[i].seq < e->seq) e = &sImage->entries[i];
+            }
+        }
+        memset(e, 0, sizeof(*e));
+        strncpy(e->name, name, sizeof(e->name) - 1);
+    }
+
+    // Devices are initialized again on every reconnection: only write to flash what a warm start needs
+    changed |= strncmp(e->bleName, bleName, sizeof(e->bleName) - 1) != 0;
+    changed |= e->addr != (uint64_t) addr || e->addrType != addr.getType() || e->failures != 0;
+
+    strncpy(e->bleName, bleName, sizeof(e->bleName) - 1);
+    e->addr     = (uint64_t) addr;
+    e->addrType = addr.getType();
+    e->rssi     = rssi;
+    e->failures = 0;
+    e->connects++;
+    e->seq      = ++sImage->seq;
+
+    if (!changed) {
+        sDirty = true;
+        return true;
+    }
+
+    return flush();
+}
+
+
+void
+NimBLE::Registry::failed(const char* name)
+{
+    if (sImage == nullptr) return;
+
+    auto e = find(name);
+    if (e == nullptr) return;
+
+    if (++e->failures >= sMaxFailures) {
+        forget(name);
+        return;
+    }
+    flush();
+}
+
+
+void
+NimBLE::Registry::forget(const char* name)
+{
+    if (sImage == nullptr) return;
+
+    auto e = find(name);
+    if (e == nullptr) return;
+
+    // Keep the entries packed
+    *e = sImage->entries[--sImage->count];
+    flush();
+}
+
+
+void
+NimBLE::Registry::clear()
+{
+    if (sImage == nullptr) return;
+
+    memset(sImage, 0, sizeof(*sImage));
+    sImage->magic = sMagic;
+    flush();
+}
+
+
+std::vector<NimBLE::Registry::Entry>
+NimBLE::Registry::getEntries()
+{
+    std::vector<Entry> entries;
+    if (sImage == nullptr) return entries;
+
+    entries.assign(sImage->entries, sImage->entries + sImage->count);
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {return a.seq > b.seq;});
+
+    return entries;
+}
+
+
+NimBLEAddress
+NimBLE::Registry::address(const Entry& entry)
+{
+    return NimBLEAddress(entry.addr, entry.addrType);
+}
@@ -0,0 +1,132 @@
+#include "NimBLE-Device/Router.hh"
+
+#include <cstring>
+
+
+NimBLE::Router::Router()
+    : mRoutes()
+    , mNumRoutes(0)
+    , mIndex()
+    , mStats()
+{
+}
+
+
+bool
+NimBLE::Router::insert(const Route& route)
+{
+    if (mNumRoutes == MAX_ROUTES) return false;
+
+    mRoutes[mNumRoutes++] = route;
+    if (route.handle < MAX_HANDLES) mIndex[route.handle] = mNumRoutes;
+
+    return true;
+}
+
+
+bool
+NimBLE::Router::add(NimBLERemoteCharacteristic* chr, const Route& route)
+{
+    if (chr == nullptr) return false;
+
+    Route r  = route;
+    r.handle = chr->getHandle();
+    if (!insert(r)) return false;
+
+    // All characteristics share the same forwarding callback
+    if (chr->subscribe(true, [this](NimBLERemoteCharacteristic* pChr, uint8_t* pData, size_t length, bool isNotify) {
+            dispatch(pChr->getHandle(), pData, length);
+        })) return true;
+
+    mNumRoutes--;
+    if (r.handle < MAX_HANDLES) mIndex[r.handle] = 0;
+
+    return false;
+}
+
+
+bool
+NimBLE::Router::subscribe(NimBLERemoteCharacteristic* chr, void* ctx, Handler fct, uint8_t tag)
+{
+    return add(chr, {0, tag, ctx, fct, nullptr});
+}
+
+
+bool
+NimBLE::Router::subscribe(NimBLERemoteCharacteristic* chr, void* ctx, const OpTable& ops, uint8_t tag)
+{
+    return add(chr, {0, tag, ctx, nullptr, &ops});
+}
+
+
+bool
+NimBLE::Router::route(uint16_t handle, void* ctx, Handler fct, uint8_t tag)
+{
+    return insert({handle, tag, ctx, fct, nullptr});
+}
+
+
+bool
+NimBLE::Router::route(uint16_t handle, void* ctx, const OpTable& ops, uint8_t tag)
+{
+    return insert({handle, tag, ctx, nullptr, &ops});
+}
+
+
+void
+NimBLE::Router::clear()
+{
+    mNumRoutes = 0;
+    memset(mIndex, 0, sizeof(mIndex));
+}
+
+
+void
+NimBLE::Router::dispatch(uint16_t handle, const uint8_t* data, size_t len)
+{
+    unsigned idx = 0;
+    if (handle < MAX_HANDLES) {
+        idx = mIndex[handle];
+    } else {
+        for (unsigned i = 0; i < mNumRoutes; i++) {
+            if (mRoutes[i].handle == handle) idx = i + 1;
+        }
+    }
+    if (idx == 0) {
+        mStats.dropped++;
+        return;
+    }
+
+    const Route& route = mRoutes[idx - 1];
+    Handler      fct   = route.fct;
+
+    if (route.ops != nullptr) {
+        if (len == 0) {
+            mStats.dropped++;
+            return;
+        }
+        fct = route.ops->fct[data[0]];
+        if (fct == nullptr) {
+            mStats.unknown++;
+            return;
+        }
+    }
+
+    mStats.dispatched++;
+    fct(route.ctx, route.tag, data, len);
+}
+
+
+NimBLE::Router::Stats
+NimBLE::Router::getStats() const
+{
+    return mStats;
+}
+
+
+void
+NimBLE::Router::resetStats()
+{
+    mStats = {};
+}
+
@@ -0,0 +1,251 @@
+#include "NimBLE-Device/Scanner.hh"
+#include "Runtime.hh"
+
+
+// Number of cache entries probed for each advertisement
+static const unsigned sProbes = 4;
+
+
+NimBLE::Scanner::Scanner(unsigned cacheSize, long cacheMs)
+    : NimBLEAdvertisedDeviceCallbacks()
+    , mCache((cacheSize < sProbes) ? sProbes : cacheSize, Entry{0, 0, 0})
+    , mCacheMs(cacheMs)
+    , mIntervalMs(100)
+    , mWindowMs(50)
+    , mActive(true)
+    , mUseWhiteList(false)
+    , mWhiteListed(false)
+    , mGeneration(0)
+    , mDutyOnMs(0)
+    , mDutyOffMs(0)
+    , mState(STOPPED)
+    , mNextMs(0)
+    , mStats{}
+    , mStatsStartMs(0)
+    , mAdvCb()
+{
+}
+
+
+NimBLE::Scanner::~Scanner()
+{
+    stop();
+}
+
+
+void
+NimBLE::Scanner::setParams(uint16_t intervalMs, uint16_t windowMs, bool active)
+{
+    if (windowMs > intervalMs) windowMs = intervalMs;
+
+    mIntervalMs = intervalMs;
+    mWindowMs   = windowMs;
+    mActive     = active;
+}
+
+
+void
+NimBLE::Scanner::setWhiteList(bool enable)
+{
+    mUseWhiteList = enable;
+}
+
+
+void
+NimBLE::Scanner::setDutyCycle(long onMs, long offMs)
+{
+    mDutyOnMs  = onMs;
+    mDutyOffMs = offMs;
+}
+
+
+void
+NimBLE::Scanner::subscribe(std::function<void(NimBLEAdvertisedDevice* adv)> fct)
+{
+    mAdvCb = fct;
+}
+
+
+void
+NimBLE::Scanner::scan(bool on)
+{
+    auto pScan = NimBLEDevice::getScan();
+
+    if (!on) {
+        if (pScan->isScanning()) pScan->stop();
+        return;
+    }
+    if (pScan->isScanning()) return;
+
+    // The white list cannot change while it is in use: it is synchronized whenever scanning starts
+    mGeneration  = InterestingDevice::getPoolGeneration();
+    mWhiteListed = mUseWhiteList && InterestingDevice::syncWhiteList();
+
+    // Repeats are filtered here, by payload: the controller's filter would hide changes in advertised data
+    pScan->setAdvertisedDeviceCallbacks(this, true);
+    pScan->setDuplicateFilter(false);
+    pScan->setInterval(mIntervalMs);
+    pScan->setWindow(mWindowMs);
+    pScan->setActiveScan(mActive);
+    pScan->setFilterPolicy((mWhiteListed) ? BLE_HCI_SCAN_FILT_USE_WL : BLE_HCI_SCAN_FILT_NO_WL);
+
+    pScan->start(0, nullptr, false);
+}
+
+
+void
+NimBLE::Scanner::start()
+{
+    mState = SCANNING;
+    scan(true);
+}
+
+
+void
+NimBLE::Scanner::stop()
+{
+    mState = STOPPED;
+    scan(false);
+}
+
+
+bool
+NimBLE::Scanner::isScanning()
+{
+    return mState == SCANNING || mState == DUTY_ON;
+}
+
+
+void
+NimBLE::Scanner::service(long nowInMs)
+{
+    if (mState == STOPPED) return;
+
+    InterestingDevice::serviceSelection(nowInMs);
+
+    // Leave the radio to the connection in progress, if any
+    for (auto it : InterestingDevice::getDevices()) {
+        if (it->isConnecting()) {
+            scan(false);
+            return;
+        }
+    }
+
+    if (!InterestingDevice::allFound()) {
+        if (mState != SCANNING) {
+            ESP_LOGI("Scanner", "Must-find device missing: resuming scan.");
+            mStats.restarts++;
+            mState = SCANNING;
+        }
+
+        // Restart to pick up changes in the white list
+        if (mUseWhiteList && mGeneration != InterestingDevice::getPoolGeneration()) scan(false);
+        scan(true);
+        return;
+    }
+
+    switch (mState) {
+    case SCANNING:
+        ESP_LOGI("Scanner", "All devices found: %s scan.", (mDutyOnMs > 0) ? "duty-cycling" : "pausing");
+        mState  = DUTY_OFF;
+        mNextMs = nowInMs + mDutyOffMs;
+        scan(false);
+        break;
+
+    case DUTY_ON:
+        if (nowInMs - mNextMs < 0) break;
+        mState  = DUTY_OFF;
+        mNextMs = nowInMs + mDutyOffMs;
+        scan(false);
+        break;
+
+    case DUTY_OFF:
+        if (mDutyOnMs <= 0 || nowInMs - mNextMs < 0) break;
+        mState  = DUTY_ON;
+        mNextMs = nowInMs + mDutyOnMs;
+        scan(true);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+uint32_t
+NimBLE::Scanner::hash(const uint8_t* data, size_t len)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+bool
+NimBLE::Scanner::seen(uint64_t addr, uint32_t hash, long nowInMs)
+{
+    unsigned first  = (addr ^ hash ^ (addr >> 32)) % mCache.size();
+    Entry*   oldest = nullptr;
+
+    for (unsigned i = 0; i < sProbes; i++) {
+        Entry& e = mCache[(first + i) % mCache.size()];
+
+        if (e.addr == addr && e.hash == hash && e.seenMs != 0 && nowInMs - e.seenMs < mCacheMs) return true;
+        if (oldest == nullptr || e.seenMs - oldest->seenMs < 0) oldest = &e;
+    }
+
+    // Not seen recently: remember it in place of the oldest probed entry
+    *oldest = {addr, hash, (nowInMs != 0) ? nowInMs : 1};
+
+    return false;
+}
+
+
+void
+NimBLE::Scanner::onResult(NimBLEAdvertisedDevice* adv)
+{
+    if (mAdvCb) mAdvCb(adv);
+
+    long now = RUNTIME::nowInMs();
+
+    if (seen((uint64_t) adv->getAddress(), hash(adv->getPayload(), adv->getPayloadLength()), now)) {
+        mStats.dropped++;
+
+        // Repeats still count toward the advertising rate of selection candidates
+        if (InterestingDevice::repeatedDevice(adv) != nullptr) mStats.found++;
+        return;
+    }
+    mStats.processed++;
+
+    if (InterestingDevice::foundDevice(adv) != nullptr) mStats.found++;
+}
+
+
+NimBLE::Scanner::Stats
+NimBLE::Scanner::getStats(long nowInMs)
+{
+    Stats stats = {};
+    stats.processed = mStats.processed;
+    stats.dropped   = mStats.dropped;
+    stats.found     = mStats.found;
+    stats.restarts  = mStats.restarts;
+    stats.elapsedMs = nowInMs - mStatsStartMs;
+    stats.whiteList = mWhiteListed && isScanning();
+
+    return stats;
+}
+
+
+void
+NimBLE::Scanner::resetStats(long nowInMs)
+{
+    mStats.processed = 0;
+    mStats.dropped   = 0;
+    mStats.found     = 0;
+    mStats.restarts  = 0;
+    mStatsStartMs    = nowInMs;
+}
@@ -0,0 +1,244 @@
+#include "NimBLE-Device/TaskPolicy.hh"
+#include "NimBLE-Device/Arena.hh"
+#include "Runtime.hh"
+#include "esp_log.h"
+
+#include <atomic>
+#include <cstring>
+
+#if !defined(ESP_PLATFORM) || defined(CONFIG_IDF_TARGET_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+struct NimBLE::TaskPolicy::Task {
+    std::atomic<bool>     used;
+    char                  name[16];
+    Placement             placement;
+
+    // Only updated by the task itself
+    TickType_t            nextWake;
+    int64_t               sumUs;
+    int64_t               maxUs;
+    unsigned long         samples;
+    unsigned long         overruns;
+    std::atomic<bool>     reset;
+};
+
+
+namespace {
+
+struct Policy {
+    char                         key[32];
+    bool                         device;
+    NimBLE::TaskPolicy::Placement placement;
+};
+
+Policy                      sPolicies[NimBLE::TaskPolicy::MAX_POLICIES];
+unsigned                    sNumPolicies = 0;
+
+NimBLE::TaskPolicy::Task    sTasks[NimBLE::TaskPolicy::MAX_TASKS];
+
+std::atomic<bool>           sMeasure(false);
+
+// Time of the start of a tick, to convert wake-up targets to us
+TickType_t                  sRefTick = 0;
+int64_t                     sRefUs   = 0;
+
+
+bool
+set(const char* key, bool device, const NimBLE::TaskPolicy::Placement& placement)
+{
+    for (unsigned i = 0; i < sNumPolicies; i++) {
+        if (sPolicies[i].device == device && strncmp(sPolicies[i].key, key, sizeof(Policy::key)) == 0) {
+            sPolicies[i].placement = placement;
+            return true;
+        }
+    }
+    if (sNumPolicies == NimBLE::TaskPolicy::MAX_POLICIES) return false;
+
+    auto& p = sPolicies[sNumPolicies++];
+    strncpy(p.key, key, sizeof(p.key) - 1);
+    p.device    = device;
+    p.placement = placement;
+
+    return true;
+}
+
+
+const NimBLE::TaskPolicy::Placement*
+find(const char* key, bool device)
+{
+    for (unsigned i = 0; i < sNumPolicies; i++) {
+        if (sPolicies[i].device == device && strncmp(sPolicies[i].key, key, sizeof(Policy::key)) == 0) return &sPolicies[i].placement;
+    }
+    return nullptr;
+}
+
+
+void
+calibrate()
+{
+    TickType_t tick = xTaskGetTickCount();
+    while (xTaskGetTickCount() == tick) {}
+
+    sRefUs   = RUNTIME::nowInUs();
+    sRefTick = tick + 1;
+}
+
+}
+
+
+bool
+NimBLE::TaskPolicy::setForClass(const char* cls, const Placement& placement)
+{
+    return set(cls, false, placement);
+}
+
+
+bool
+NimBLE::TaskPolicy::setForDevice(const char* name, const Placement& placement)
+{
+    return set(name, true, placement);
+}
+
+
+NimBLE::TaskPolicy::Placement
+NimBLE::TaskPolicy::get(const char* cls, const char* name, const Placement& builtin)
+{
+    auto p = find(name, true);
+    if (p == nullptr) p = find(cls, false);
+
+    return (p != nullptr) ? *p : builtin;
+}
+
+
+bool
+NimBLE::TaskPolicy::createTask(TaskFunction_t fct, const char* name, void* arg, const Placement& placement,
+                               TaskHandle_t* handle, Task** task)
+{
+    Task* t = nullptr;
+    for (unsigned i = 0; i < MAX_TASKS && t == nullptr; i++) {
+        bool used = false;
+        if (sTasks[i].used.compare_exchange_strong(used, true)) t = &sTasks[i];
+    }
+    if (t == nullptr) {
+        ESP_LOGE(name, "Too many tasks.");
+        return false;
+    }
+
+    strncpy(t->name, name, sizeof(t->name) - 1);
+    t->placement = placement;
+    t->nextWake  = 0;
+    t->reset     = true;
+    *task = t;
+
+    BaseType_t core = (placement.core == ANY_CORE) ? tskNO_AFFINITY : placement.core;
+
+    if (!Arena::createTask(fct, name, placement.stackSize, arg, placement.priority, handle, core)) {
+        // The slot is free for another task
+        *task   = nullptr;
+        t->used = false;
+        return false;
+    }
+
+    return true;
+}
+
+
+void
+NimBLE::TaskPolicy::enter(Task* task)
+{
+#if !defined(ESP_PLATFORM) || defined(CONFIG_IDF_TARGET_LINUX)
+    // Each task is a thread: apply the placement to the thread
+    if (task->placement.core != ANY_CORE) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(task->placement.core, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            ESP_LOGW(task->name, "Cannot run on CPU %d.", task->placement.core);
+        }
+    }
+
+    sched_param param = {};
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO) + task->placement.priority;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        ESP_LOGW(task->name, "Cannot set real-time priority %d.", param.sched_priority);
+    }
+#endif
+}
+
+
+void
+NimBLE::TaskPolicy::delayUntil(Task* task, TickType_t* lastWake, TickType_t ticks)
+{
+    if (!sMeasure) {
+        vTaskDelayUntil(lastWake, ticks);
+        return;
+    }
+
+    // Start over if the schedule was changed outside of this function (e.g. by a sync group)
+    if (task->reset || task->nextWake != *lastWake) {
+        task->reset    = false;
+        task->sumUs    = 0;
+        task->maxUs    = 0;
+        task->samples  = 0;
+        task->overruns = 0;
+    }
+
+    if ((int32_t) (xTaskGetTickCount() - *lastWake) >= (int32_t) ticks) task->overruns++;
+
+    vTaskDelayUntil(lastWake, ticks);
+    task->nextWake = *lastWake;
+
+    // Late from the start of the target tick
+    int64_t due  = sRefUs + (int64_t) (int32_t) (*lastWake - sRefTick) * portTICK_PERIOD_MS * 1000;
+    int64_t late = RUNTIME::nowInUs() - due;
+    if (late < 0) late = 0;
+
+    task->sumUs += late;
+    if (late > task->maxUs) task->maxUs = late;
+    task->samples++;
+}
+
+
+void
+NimBLE::TaskPolicy::measure(bool enable)
+{
+    if (enable && !sMeasure) {
+        calibrate();
+        resetStats();
+    }
+    sMeasure = enable;
+}
+
+
+unsigned
+NimBLE::TaskPolicy::report(Report* reports, unsigned max)
+{
+    unsigned n = 0;
+
+    for (unsigned i = 0; i < MAX_TASKS && n < max; i++) {
+        const auto& t = sTasks[i];
+        if (!t.used) continue;
+
+        auto& r = reports[n++];
+
+        r.name      = t.name;
+        r.placement = t.placement;
+        r.samples   = t.samples;
+        r.overruns  = t.overruns;
+        r.avgLateUs = (t.samples > 0) ? t.sumUs / (int64_t) t.samples : 0;
+        r.maxLateUs = t.maxUs;
+    }
+    return n;
+}
+
+
+void
+NimBLE::TaskPolicy::resetStats()
+{
+    // Each task resets its own statistics on its next wake-up
+    for (auto& it : sTasks) it.reset = true;
+}
@@ -0,0 +1,186 @@
+
+#include "NimBLE-Device/Watchdog.hh"
+#include "Runtime.hh"
+
+
+static const char* sNames[] = {"tick", "ack", "battery"};
+
+
+//
+// Time stamp of a heartbeat: 0 means none
+//
+static long
+stamp()
+{
+    long now = RUNTIME::nowInMs();
+    return (now != 0) ? now : 1;
+}
+
+
+NimBLE::Watchdog::Watchdog()
+    : mHearts()
+    , mStatusCb()
+{
+    for (auto& it : mHearts) {
+        it.lateMs  = 0;
+        it.stallMs = 0;
+        it.action  = REPORT;
+        it.awaited = false;
+        it.lastMs.store(0);
+        it.sinceMs.store(0);
+        it.beats.store(0);
+        it.maxGapMs.store(0);
+        it.status  = OK;
+        it.late    = 0;
+        it.stalls  = 0;
+    }
+}
+
+
+void
+NimBLE::Watchdog::expect(Heartbeat_t hb, long lateMs, long stallMs, Action_t action, bool awaited)
+{
+    if ((unsigned) hb >= NUM_HEARTBEATS) return;
+
+    Heart& h  = mHearts[hb];
+    h.lateMs  = lateMs;
+    h.stallMs = (stallMs > lateMs) ? stallMs : lateMs;
+    h.action  = action;
+    h.awaited = awaited;
+    h.status  = OK;
+}
+
+
+void
+NimBLE::Watchdog::beat(Heartbeat_t hb)
+{
+    if ((unsigned) hb >= NUM_HEARTBEATS) return;
+
+    Heart& h   = mHearts[hb];
+    long   now = stamp();
+
+    long prev = h.awaited ? h.sinceMs.exchange(0) : h.lastMs.load();
+    h.lastMs  = now;
+    h.beats++;
+
+    if (prev != 0 && now - prev > h.maxGapMs) h.maxGapMs = now - prev;
+}
+
+
+void
+NimBLE::Watchdog::await(Heartbeat_t hb)
+{
+    if ((unsigned) hb >= NUM_HEARTBEATS) return;
+
+    long none = 0;
+    mHearts[hb].sinceMs.compare_exchange_strong(none, stamp());
+}
+
+
+void
+NimBLE::Watchdog::forget(Heartbeat_t hb)
+{
+    if ((unsigned) hb >= NUM_HEARTBEATS) return;
+
+    mHearts[hb].sinceMs = 0;
+}
+
+
+void
+NimBLE::Watchdog::restart()
+{
+    for (auto& it : mHearts) {
+        it.lastMs  = 0;
+        it.sinceMs = 0;
+    }
+}
+
+
+unsigned
+NimBLE::Watchdog::check(long nowInMs)
+{
+    unsigned stalled = 0;
+
+    for (unsigned i = 0; i < NUM_HEARTBEATS; i++) {
+        Heart& h = mHearts[i];
+        if (h.lateMs <= 0) continue;
+
+        long from    = h.awaited ? h.sinceMs.load() : h.lastMs.load();
+        long elapsed = (from != 0) ? nowInMs - from : 0;
+
+        Status_t status = OK;
+        if (elapsed > h.stallMs) status = STALLED;
+        else if (elapsed > h.lateMs) status = LATE;
+
+        if (status == h.status) continue;
+
+        // A heartbeat can go straight from OK to STALLED between two checks
+        if (status != OK && h.status == OK) h.late++;
+        if (status == STALLED) {
+            h.stalls++;
+            stalled |= 1 << i;
+        }
+        h.status = status;
+
+        if (mStatusCb) mStatusCb((Heartbeat_t) i, status, elapsed);
+    }
+
+    return stalled;
+}
+
+
+const char*
+NimBLE::Watchdog::getName(Heartbeat_t hb)
+{
+    if ((unsigned) hb >= NUM_HEARTBEATS) return "?";
+
+    return sNames[hb];
+}
+
+
+NimBLE::Watchdog::Status_t
+NimBLE::Watchdog::getStatus(Heartbeat_t hb) const
+{
+    if ((unsigned) hb >= NUM_HEARTBEATS) return OK;
+
+    return mHearts[hb].status;
+}
+
+
+NimBLE::Watchdog::Action_t
+NimBLE::Watchdog::getAction(Heartbeat_t hb) const
+{
+    if ((unsigned) hb >= NUM_HEARTBEATS) return REPORT;
+
+    return mHearts[hb].action;
+}
+
+
+void
+NimBLE::Watchdog::subscribe(std::function<void(Heartbeat_t hb, Status_t status, long elapsedMs)> fct)
+{
+    mStatusCb = fct;
+}
+
+
+NimBLE::Watchdog::Stats
+NimBLE::Watchdog::getStats(Heartbeat_t hb) const
+{
+    if ((unsigned) hb >= NUM_HEARTBEATS) return {};
+
+    const Heart& h = mHearts[hb];
+
+    return {h.beats.load(), h.late, h.stalls, h.maxGapMs.load()};
+}
+
+
+void
+NimBLE::Watchdog::resetStats()
+{
+    for (auto& it : mHearts) {
+        it.beats    = 0;
+        it.maxGapMs = 0;
+        it.late     = 0;
+        it.stalls   = 0;
+    }
+}
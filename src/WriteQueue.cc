@@ -0,0 +1,257 @@
+#include "NimBLE-Device/WriteQueue.hh"
+#include "NimBLE-Device.hh"
+#include "Runtime.hh"
+
+#include <cstring>
+
+
+NimBLE::WriteQueue::WriteQueue()
+    : mMutex(xSemaphoreCreateRecursiveMutex())
+    , mLink(xSemaphoreCreateRecursiveMutex())
+    , mFlushing(false)
+    , mQueue()
+    , mHeld(false)
+{
+}
+
+
+NimBLE::WriteQueue::~WriteQueue()
+{
+    vSemaphoreDelete(mMutex);
+    vSemaphoreDelete(mLink);
+}
+
+
+bool
+NimBLE::WriteQueue::post(Class_t cls, NimBLERemoteCharacteristic* chr, const uint8_t* data, size_t len, bool coalesce, bool response)
+{
+    if (chr == nullptr || len > MAX_DATA || (unsigned) cls >= NUM_CLASSES) return false;
+
+    SemLockGuard lk(mMutex);
+
+    Queue& q = mQueue[cls];
+    q.stats.posted++;
+
+    if (mHeld && cls == POWER) {
+        q.stats.dropped++;
+        return false;
+    }
+
+    if (coalesce) {
+        for (unsigned i = 0; i < q.size; i++) {
+            Write& w = q.writes[(q.head + i) % MAX_PENDING];
+            if (w.chr != chr) continue;
+
+            memcpy(w.data, data, len);
+            w.len      = len;
+            w.response = response;
+            q.stats.coalesced++;
+            return true;
+        }
+    }
+
+    if (q.size == MAX_PENDING) {
+        q.stats.dropped++;
+        return false;
+    }
+
+    Write& w = q.writes[(q.head + q.size) % MAX_PENDING];
+    w.chr      = chr;
+    memcpy(w.data, data, len);
+    w.len      = len;
+    w.response = response;
+    w.postedUs = RUNTIME::nowInUs();
+
+    q.size++;
+    if (q.size > q.stats.maxDepth) q.stats.maxDepth = q.size;
+
+    return true;
+}
+
+
+bool
+NimBLE::WriteQueue::pop(Write& w, unsigned& cls)
+{
+    SemLockGuard lk(mMutex);
+
+    for (cls = 0; cls < NUM_CLASSES; cls++) {
+        Queue& q = mQueue[cls];
+        if (q.size == 0) continue;
+
+        w      = q.writes[q.head];
+        q.head = (q.head + 1) % MAX_PENDING;
+        q.size--;
+        return true;
+    }
+
+    return false;
+}
+
+
+bool
+NimBLE::WriteQueue::pending() const
+{
+    SemLockGuard lk(mMutex);
+
+    for (auto& q : mQueue) {
+        if (q.size > 0) return true;
+    }
+    return false;
+}
+
+
+unsigned
+NimBLE::WriteQueue::flush()
+{
+    unsigned n = 0;
+    Write    w;
+    unsigned cls;
+
+    do {
+        // Two flushers could issue the writes they popped out of order
+        if (mFlushing.exchange(true)) return n;
+
+        // The write itself is issued without holding the lock, so posting never waits for the link
+        while (pop(w, cls)) {
+            bool ok;
+            {
+                SemLockGuard lk(mLink);
+
+                // A power write popped before hold() must not follow the safety write
+                if (cls == POWER && isHeld()) {
+                    dropped(cls);
+                    continue;
+                }
+                ok = w.chr->writeValue(w.data, w.len, w.response);
+            }
+            written(cls, ok, RUNTIME::nowInUs() - w.postedUs);
+            n++;
+        }
+
+        mFlushing = false;
+
+        // A write posted after the last pop() may have been left by a flusher that gave up
+    } while (pending());
+
+    return n;
+}
+
+
+bool
+NimBLE::WriteQueue::writeNow(NimBLERemoteCharacteristic* chr, const uint8_t* data, size_t len, bool response)
+{
+    if (chr == nullptr) return false;
+
+    int64_t start = RUNTIME::nowInUs();
+    {
+        SemLockGuard lk(mMutex);
+        mQueue[SAFETY].stats.posted++;
+    }
+
+    bool ok;
+    {
+        SemLockGuard lk(mLink);
+        ok = chr->writeValue(data, len, response);
+    }
+    written(SAFETY, ok, RUNTIME::nowInUs() - start);
+
+    return ok;
+}
+
+
+void
+NimBLE::WriteQueue::dropped(unsigned cls)
+{
+    SemLockGuard lk(mMutex);
+
+    mQueue[cls].stats.dropped++;
+}
+
+
+void
+NimBLE::WriteQueue::written(unsigned cls, bool ok, int64_t latencyUs)
+{
+    SemLockGuard lk(mMutex);
+
+    Stats& stats = mQueue[cls].stats;
+    if (!ok) {
+        stats.failed++;
+        return;
+    }
+    stats.written++;
+    mQueue[cls].sumLatencyUs += latencyUs;
+    if (latencyUs > stats.maxLatencyUs) stats.maxLatencyUs = latencyUs;
+}
+
+
+void
+NimBLE::WriteQueue::clear()
+{
+    SemLockGuard lk(mMutex);
+
+    for (auto& q : mQueue) {
+        q.head = 0;
+        q.size = 0;
+    }
+}
+
+
+void
+NimBLE::WriteQueue::hold()
+{
+    SemLockGuard lk(mMutex);
+
+    mHeld = true;
+    for (auto& q : mQueue) {
+        q.stats.dropped += q.size;
+        q.head = 0;
+        q.size = 0;
+    }
+}
+
+
+bool
+NimBLE::WriteQueue::isHeld() const
+{
+    SemLockGuard lk(mMutex);
+
+    return mHeld;
+}
+
+
+void
+NimBLE::WriteQueue::release()
+{
+    SemLockGuard lk(mMutex);
+
+    mHeld = false;
+}
+
+
+NimBLE::WriteQueue::Stats
+NimBLE::WriteQueue::getStats(Class_t cls) const
+{
+    if ((unsigned) cls >= NUM_CLASSES) return {};
+
+    SemLockGuard lk(mMutex);
+
+    const Queue& q     = mQueue[cls];
+    Stats        stats = q.stats;
+    stats.depth        = q.size;
+    stats.avgLatencyUs = (stats.written > 0) ? (long) (q.sumLatencyUs / stats.written) : 0;
+
+    return stats;
+}
+
+
+void
+NimBLE::WriteQueue::resetStats()
+{
+    SemLockGuard lk(mMutex);
+
+    for (auto& q : mQueue) {
+        q.stats          = {};
+        q.stats.maxDepth = q.size;
+        q.sumLatencyUs   = 0;
+    }
+}
@@ -1,9 +1,19 @@
 #include "NimBLE-Device/iTag.hh"
+#include "Runtime.hh"
 
 
 NimBLE::iTag::Device::Device(const char* uniqueName, const char* macAddr, uint8_t addrType)
     : NimBLE::InterestingDevice(uniqueName, "iTAG", macAddr, addrType)
+    , mAlarmChr(nullptr)
+    , mBatteryChr(nullptr)
+    , mParams({1000, 50, 500, 250, 2, HIGH, 3000})
+    , mLost(false)
+    , mProbe()
+    , mAlarmOffMs(0)
+    , mStats()
+    , mLinkLossCb()
 {
+    mProbe.setTiming(mParams.heartbeatMs, mParams.heartbeatMaxMs, mParams.missed);
 }
 
 
@@ -29,8 +39,8 @@ NimBLE::iTag::Device::doInitDevice()
         ESP_LOGE(getName(), "Cannot find battery characteristics.");
         return false;
     }
-    battery->subscribe(true, std::bind(&NimBLE::iTag::Device::notifyBattery, this,
-                                       std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+    mRouter.subscribe(battery, this, &Router::handler<Device, &Device::notifyBattery>);
+    mBatteryChr = battery;
     
     pSvc = mClient->getService(NimBLEUUID((uint16_t) 0x1802));
     if (pSvc == nullptr) {
@@ -43,6 +53,36 @@ NimBLE::iTag::Device::doInitDevice()
         return false;
     }
 
+    // Have the tag sound its own alarm if it loses the link (optional service)
+    pSvc = mClient->getService(NimBLEUUID((uint16_t) 0x1803));
+    if (pSvc != nullptr) {
+        auto level = pSvc->getCharacteristic(NimBLEUUID((uint16_t) 0x2A06));
+        if (level == nullptr || !level->writeValue((uint8_t) mParams.alertLevel, true)) {
+            ESP_LOGW(getName(), "Cannot set link loss alert level.");
+        }
+    }
+
+    // Connection interval in 1.25ms units, supervision timeout in 10ms units
+    if (mParams.supervisionMs > 0) {
+        uint16_t itvl = mParams.intervalMs * 4 / 5;
+        mClient->updateConnParams(itvl, itvl, 0, mParams.supervisionMs / 10);
+    }
+
+    long now = RUNTIME::nowInMs();
+    mProbe.restart(now);
+
+    if (mLost) {
+        mLost = false;
+        mStats.returns++;
+        ESP_LOGI(getName(), "Back in range.");
+
+        if (mParams.alarmMs > 0) {
+            setAlarm(mParams.alertLevel);
+            mAlarmOffMs = now + mParams.alarmMs;
+        }
+        if (mLinkLossCb) mLinkLossCb(false);
+    }
+
     return true;
 }
 
@@ -50,12 +90,125 @@ NimBLE::iTag::Device::doInitDevice()
 void
 NimBLE::iTag::Device::serviceLoop(long nowInMs)
 {
+    if (mAlarmOffMs != 0 && nowInMs - mAlarmOffMs >= 0) {
+        mAlarmOffMs = 0;
+        setAlarm(OFF);
+    }
+
+    mWrites.flush();
+
+    if (mLost || mBatteryChr == nullptr) return;
+
+    switch (mProbe.check(nowInMs)) {
+    case LinkProbe::PROBE:
+        probe(nowInMs);
+        break;
+
+    case LinkProbe::ANSWERED:
+        mStats.heartbeats++;
+        break;
+
+    case LinkProbe::MISSED:
+        mStats.missed++;
+        break;
+
+    case LinkProbe::LOST:
+        mStats.missed++;
+        linkLost(nowInMs);
+
+        // Do not wait for the supervision timeout
+        mClient->disconnect();
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+void
+NimBLE::iTag::Device::probe(long nowInMs)
+{
+    // The read is answered within a few connection intervals, or fails once the link is dropped
+    mProbe.sent(nowInMs);
+    if (ble_gattc_read(mClient->getConnId(), mBatteryChr->getHandle(), &onProbe, this) != 0) {
+        mProbe.answered(false, nowInMs);
+    }
+}
+
+
+int
+NimBLE::iTag::Device::onProbe(uint16_t connHandle, const ble_gatt_error* error, ble_gatt_attr* attr, void* arg)
+{
+    auto dev = (Device*) arg;
+
+    dev->mProbe.answered(error->status == 0, RUNTIME::nowInMs());
+
+    return 0;
+}
+
+
+void
+NimBLE::iTag::Device::notifyEvent(uint8_t event)
+{
+    // A parked tag was disconnected on purpose
+    if (event == DISCONNECTED && !isParked()) {
+        long now = RUNTIME::nowInMs();
+
+        mStats.disconnectMs = now - mProbe.getLastHeard();
+        if (!mLost) linkLost(now);
+
+        // Reconnect once found again by a scan
+        rearm();
+    }
+
+    NimBLE::InterestingDevice::notifyEvent(event);
+}
+
+
+void
+NimBLE::iTag::Device::linkLost(long nowInMs)
+{
+    mLost = true;
+
+    mStats.losses++;
+    mStats.detectMs = nowInMs - mProbe.getLastHeard();
+    if (mStats.detectMs > mStats.maxDetectMs) mStats.maxDetectMs = mStats.detectMs;
+
+    ESP_LOGI(getName(), "Link lost, detected in %ld ms.", mStats.detectMs);
+    if (mLinkLossCb) mLinkLossCb(true);
 }
 
 
 void
-NimBLE::iTag::Device::notifyBattery(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify)
+NimBLE::iTag::Device::setLinkLoss(const LinkLoss& params)
 {
+    mParams = params;
+    if (mParams.missed == 0) mParams.missed = 1;
+
+    mProbe.setTiming(mParams.heartbeatMs, mParams.heartbeatMaxMs, mParams.missed);
+}
+
+
+void
+NimBLE::iTag::Device::subscribeLinkLoss(std::function<void(bool lost)> fct)
+{
+    mLinkLossCb = fct;
+}
+
+
+NimBLE::iTag::Device::Stats
+NimBLE::iTag::Device::getStats()
+{
+    return mStats;
+}
+
+
+void
+NimBLE::iTag::Device::notifyBattery(const uint8_t* pData, size_t length)
+{
+    if (length < 1) return;
+
     NimBLE::InterestingDevice::notifyBatteryLevel(pData[0]);
 }
 
@@ -65,5 +218,9 @@ NimBLE::iTag::Device::setAlarm(AlarmSetting_t level)
 {
     if (mAlarmChr == nullptr) return;
 
-    mAlarmChr->writeValue(level);
+    // There is no transmit task: issue it right away, or leave it to the task already writing.
+    // Alarm settings are issued in order, the latest replacing a pending one.
+    uint8_t val = level;
+    mWrites.post(WriteQueue::CONFIG, mAlarmChr, &val, sizeof(val));
+    mWrites.flush();
 }
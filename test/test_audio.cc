@@ -0,0 +1,92 @@
+#include "unity.h"
+#include "test_util.hh"
+
+#include "NimBLE-Device/Coyote-Audio.hh"
+
+#include <vector>
+
+
+using namespace NimBLE::COYOTE;
+
+
+//
+// A square wave of the specified amplitude: its RMS level is the amplitude
+//
+static std::vector<int16_t>
+square(size_t n, int16_t amplitude)
+{
+    std::vector<int16_t> pcm(n);
+    for (size_t i = 0; i < n; i++) pcm[i] = (i & 1) ? amplitude : -amplitude;
+
+    return pcm;
+}
+
+
+TEST_CASE("AudioStream maps the RMS level of each slot", "[coyote][audio]")
+{
+    auto loud  = square(1000, 32767);
+    auto quiet = square(1000, 64 << 7);
+
+    TEST_ASSERT_EQUAL(0, AudioStream::level(loud.data(), 0));
+    TEST_ASSERT_EQUAL(255, AudioStream::level(loud.data(), loud.size()));
+    TEST_ASSERT_EQUAL(64, AudioStream::level(quiet.data(), quiet.size()));
+
+    // 1000 Hz, 25 ms slots: 25 samples per slot
+    AudioStream audio(1000, 4);
+    audio.setPeriod(100, 10);
+
+    // Partial slots are completed by the next push
+    audio.push(loud.data(), 20);
+    TEST_ASSERT_EQUAL(4, audio.room());
+    audio.push(loud.data(), 5);
+    TEST_ASSERT_EQUAL(3, audio.room());
+
+    Generator::Sample s;
+    TEST_ASSERT_TRUE(audio.next(25, s));
+    TEST_ASSERT_EQUAL(100, s.intensity);
+    TEST_ASSERT_EQUAL(10, s.period);
+
+    // Nothing left to play
+    TEST_ASSERT_TRUE(audio.next(25, s));
+    TEST_ASSERT_EQUAL(0, s.intensity);
+    TEST_ASSERT_EQUAL(100, s.period);
+
+    // The oldest slots are dropped when pushed faster than played
+    audio.push(loud.data(), 6 * 25);
+    TEST_ASSERT_EQUAL(0, audio.room());
+
+    auto stats = audio.getStats();
+    TEST_ASSERT_EQUAL(7, stats.slots);
+    TEST_ASSERT_EQUAL(2, stats.overruns);
+    TEST_ASSERT_EQUAL(1, stats.underruns);
+    TEST_ASSERT_EQUAL(20 + 5 + 6 * 25, stats.samples);
+}
+
+
+TEST_CASE("AudioStream processing throughput", "[coyote][audio][bench]")
+{
+    static const unsigned RATE   = 44100;
+    static const size_t   BLOCK  = 1024;
+    static const unsigned BLOCKS = 2000;
+
+    TEST::Random         rnd;
+    std::vector<int16_t> pcm(BLOCK);
+    for (auto& it : pcm) it = (int16_t) rnd.next();
+
+    AudioStream       audio(RATE, 64);
+    Generator::Sample s;
+
+    // Played as fast as it is pushed, so no slot is dropped
+    for (unsigned i = 0; i < BLOCKS; i++) {
+        audio.push(pcm.data(), pcm.size());
+        while (audio.room() < 64) audio.next(25, s);
+    }
+
+    auto stats = audio.getStats();
+    TEST_ASSERT_EQUAL(BLOCKS * BLOCK, stats.samples);
+    TEST_ASSERT_EQUAL(0, stats.overruns);
+
+    TEST::report("AudioStream push, 44.1 kHz", stats.samples, stats.processUs, "sample");
+    printf("      %lu samples/sec of CPU, %.0fx real time\n", stats.samplesPerSec(),
+           (double) stats.samplesPerSec() / RATE);
+}
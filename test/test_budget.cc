@@ -0,0 +1,179 @@
+#include "unity.h"
+#include "test_util.hh"
+
+#include "NimBLE-Device/ConnectionBudget.hh"
+
+#include <map>
+
+
+using namespace NimBLE;
+
+
+//
+// A budget on a simulated controller with a limited number of connections.
+// Disconnections complete on the next call to disconnect().
+//
+class SimBudget : public ConnectionBudget
+{
+public:
+    SimBudget(unsigned budget, unsigned controller)
+        : ConnectionBudget(budget)
+        , mController(controller)
+        , mLinks(0)
+        , mMaxLinks(0)
+        , mRefused(0)
+        , mState()
+        , mOrder()
+        {}
+
+    void disconnect()
+        {
+            for (auto& it : mState) {
+                if (!it.second.closing) continue;
+                it.second.closing = false;
+                it.second.link    = false;
+                mLinks--;
+            }
+        }
+
+    bool connected(InterestingDevice& dev)
+        {
+            return mState[&dev].init;
+        }
+
+    unsigned                        mController;
+    unsigned                        mLinks;
+    unsigned                        mMaxLinks;
+    unsigned                        mRefused;
+    std::vector<InterestingDevice*> mOrder;
+
+protected:
+    struct State {
+        bool link;
+        bool init;
+        bool parked;
+        bool closing;
+    };
+
+    std::map<InterestingDevice*, State> mState;
+
+    virtual bool devFound(InterestingDevice& dev)      override {return true;}
+    virtual bool devLinkUp(InterestingDevice& dev)     override {return mState[&dev].link;}
+    virtual bool devConnected(InterestingDevice& dev)  override {return mState[&dev].init;}
+    virtual bool devParked(InterestingDevice& dev)     override {return mState[&dev].parked;}
+
+    virtual bool devInit(InterestingDevice& dev)  override
+        {
+            auto& s = mState[&dev];
+            if (s.link) return s.init;
+
+            if (mLinks >= mController) {
+                mRefused++;
+                return false;
+            }
+            s = {true, true, false, false};
+            if (++mLinks > mMaxLinks) mMaxLinks = mLinks;
+            mOrder.push_back(&dev);
+
+            return true;
+        }
+
+    virtual bool devPark(InterestingDevice& dev)  override
+        {
+            auto& s = mState[&dev];
+            if (!s.link || s.closing) return false;
+
+            s.init    = false;
+            s.parked  = true;
+            s.closing = true;
+
+            return true;
+        }
+};
+
+
+TEST_CASE("ConnectionBudget shares a simulated 3-connection controller", "[budget]")
+{
+    SimBudget budget(3, 3);
+    auto      devs = TEST::makeDevices("Dev", 7);
+    TEST_ASSERT_EQUAL(7, devs.size());
+
+    budget.setSlices(1000, 500);
+    budget.add(*devs[0], ConnectionBudget::ALWAYS);
+    for (unsigned i = 1; i < 7; i++) budget.add(*devs[i], ConnectionBudget::TIME_SLICED);
+
+    for (long now = 0; now < 60000; now += 100) {
+        budget.disconnect();
+        budget.service(now);
+        if (now > 0) TEST_ASSERT_TRUE(budget.connected(*devs[0]));
+    }
+
+    // Never more connections than the controller supports, and everyone gets turns
+    TEST_ASSERT_EQUAL(3, budget.mMaxLinks);
+    TEST_ASSERT_EQUAL(0, budget.mRefused);
+    for (unsigned i = 1; i < 7; i++) {
+        unsigned turns = 0;
+        for (auto it : budget.mOrder) turns += (it == devs[i].get());
+        TEST_ASSERT_GREATER_OR_EQUAL(10, turns);
+    }
+    TEST_ASSERT_EQUAL(1, budget.getStats(ConnectionBudget::ALWAYS).connects);
+    TEST_ASSERT_EQUAL(0, budget.getStats(ConnectionBudget::TIME_SLICED).failures);
+}
+
+
+TEST_CASE("ConnectionBudget gives a freed connection to the device that freed it", "[budget]")
+{
+    SimBudget budget(1, 1);
+    auto      devs = TEST::makeDevices("Dev", 3);
+    TEST_ASSERT_EQUAL(3, devs.size());
+
+    budget.setSlices(1000, 500);
+    for (auto& it : devs) budget.add(*it, ConnectionBudget::TIME_SLICED);
+
+    for (long now = 0; now < 10000; now += 100) {
+        budget.disconnect();
+        budget.service(now);
+    }
+
+    // Turns in order
+    TEST_ASSERT_GREATER_OR_EQUAL(6, budget.mOrder.size());
+    for (unsigned i = 0; i < budget.mOrder.size(); i++) {
+        TEST_ASSERT_EQUAL_PTR(devs[i % 3].get(), budget.mOrder[i]);
+    }
+}
+
+
+TEST_CASE("ConnectionBudget connects requested devices first", "[budget]")
+{
+    SimBudget budget(2, 3);
+    auto      devs = TEST::makeDevices("Dev", 3);
+    TEST_ASSERT_EQUAL(3, devs.size());
+
+    budget.setSlices(10000, 500);
+    budget.add(*devs[0], ConnectionBudget::TIME_SLICED);
+    budget.add(*devs[1], ConnectionBudget::TIME_SLICED);
+    budget.add(*devs[2], ConnectionBudget::ON_DEMAND);
+
+    budget.service(0);
+    TEST_ASSERT_TRUE(budget.connected(*devs[0]));
+    TEST_ASSERT_TRUE(budget.connected(*devs[1]));
+
+    // The request parks a time-sliced device, then gets its connection
+    budget.request(*devs[2]);
+    budget.service(100);
+    TEST_ASSERT_FALSE(budget.connected(*devs[2]));
+    TEST_ASSERT_EQUAL(1, budget.getStats(ConnectionBudget::TIME_SLICED).parks);
+
+    budget.disconnect();
+    budget.service(200);
+    TEST_ASSERT_TRUE(budget.connected(*devs[2]));
+    TEST_ASSERT_EQUAL(2, budget.mMaxLinks);
+
+    // And is parked once idle
+    for (long now = 300; now < 2000; now += 100) {
+        budget.disconnect();
+        budget.service(now);
+    }
+    TEST_ASSERT_FALSE(budget.connected(*devs[2]));
+    TEST_ASSERT_EQUAL(1, budget.getStats(ConnectionBudget::ON_DEMAND).parks);
+}
@@ -0,0 +1,161 @@
+
+#include "unity.h"
+#include "test_util.hh"
+
+#include "NimBLE-Device/Coyote-Codec.hh"
+
+#include <cstring>
+
+
+using namespace NimBLE::COYOTE::CODEC;
+
+
+static const unsigned ROUNDS = 100000;
+
+
+static void
+fill(TEST::Random& rnd, uint8_t* buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) buf[i] = rnd.next();
+}
+
+
+TEST_CASE("Codec round-trips random V2 messages", "[coyote][codec]")
+{
+    TEST::Random rnd(1);
+
+    for (unsigned i = 0; i < ROUNDS; i++) {
+        uint8_t buf[3];
+
+        // Fields wider than their encoding are truncated
+        V2::Wave w = {(uint8_t) rnd.next(), (uint16_t) rnd.next(), (uint8_t) rnd.next()};
+        V2::Wave wd = {};
+        TEST_ASSERT_EQUAL(V2::WaveLen, V2::encode(w, buf, sizeof(buf)));
+        TEST_ASSERT_TRUE(V2::decode(buf, sizeof(buf), wd));
+        TEST_ASSERT_EQUAL(w.x & 0x1F, wd.x);
+        TEST_ASSERT_EQUAL(w.y & 0x3FF, wd.y);
+        TEST_ASSERT_EQUAL(w.z & 0x1F, wd.z);
+
+        V2::Power p = {(uint16_t) rnd.next(), (uint16_t) rnd.next()};
+        V2::Power pd = {};
+        TEST_ASSERT_EQUAL(V2::PowerLen, V2::encode(p, buf, sizeof(buf)));
+        TEST_ASSERT_TRUE(V2::decode(buf, sizeof(buf), pd));
+        TEST_ASSERT_EQUAL(p.A & 0x7FF, pd.A);
+        TEST_ASSERT_EQUAL(p.B & 0x7FF, pd.B);
+
+        V2::Config c = {(uint8_t) rnd.next(), (uint16_t) rnd.next()};
+        V2::Config cd = {};
+        TEST_ASSERT_EQUAL(V2::ConfigLen, V2::encode(c, buf, sizeof(buf)));
+        TEST_ASSERT_TRUE(V2::decode(buf, sizeof(buf), cd));
+        TEST_ASSERT_EQUAL(c.step, cd.step);
+        TEST_ASSERT_EQUAL(c.maxPwr & 0x7FF, cd.maxPwr);
+    }
+}
+
+
+TEST_CASE("Codec re-encodes random V3 messages byte for byte", "[coyote][codec]")
+{
+    TEST::Random rnd(2);
+
+    for (unsigned i = 0; i < ROUNDS; i++) {
+        uint8_t in[V3::B0Len];
+        uint8_t out[V3::B0Len];
+        fill(rnd, in, sizeof(in));
+
+        // Every bit of B0, B1 and the limits is significant
+        in[0] = 0xB0;
+        V3::B0 b0 = {};
+        TEST_ASSERT_TRUE(V3::decode(in, V3::B0Len, b0));
+        TEST_ASSERT_EQUAL(V3::B0Len, V3::encode(b0, out, sizeof(out)));
+        TEST_ASSERT_EQUAL_MEMORY(in, out, V3::B0Len);
+
+        in[0] = 0xB1;
+        V3::B1 b1 = {};
+        TEST_ASSERT_TRUE(V3::decode(in, V3::B1Len, b1));
+        TEST_ASSERT_EQUAL(V3::B1Len, V3::encode(b1, out, sizeof(out)));
+        TEST_ASSERT_EQUAL_MEMORY(in, out, V3::B1Len);
+
+        in[0] = 0xBE;
+        V3::Limits lim = {};
+        TEST_ASSERT_TRUE(V3::decode(in, V3::LimitsLen, lim));
+        TEST_ASSERT_EQUAL(V3::LimitsLen, V3::encode(lim, out, sizeof(out), 0xBE));
+        TEST_ASSERT_EQUAL_MEMORY(in, out, V3::LimitsLen);
+    }
+}
+
+
+TEST_CASE("Codec rejects short, truncated and mistyped messages", "[coyote][codec]")
+{
+    TEST::Random rnd(3);
+
+    for (unsigned i = 0; i < ROUNDS; i++) {
+        uint8_t buf[V3::B0Len + 4];
+        fill(rnd, buf, sizeof(buf));
+
+        size_t len = rnd.below(V3::B0Len + 1);
+
+        // Decoding never accepts fewer bytes than the message
+        V2::Wave   w;
+        V2::Power  p;
+        V2::Config c;
+        V3::B0     b0;
+        V3::B1     b1;
+        V3::Limits lim;
+        if (len < V2::WaveLen) TEST_ASSERT_FALSE(V2::decode(buf, len, w));
+        if (len < V2::PowerLen) TEST_ASSERT_FALSE(V2::decode(buf, len, p));
+        if (len < V2::ConfigLen) TEST_ASSERT_FALSE(V2::decode(buf, len, c));
+        if (len < V3::B0Len) TEST_ASSERT_FALSE(V3::decode(buf, len, b0));
+        if (len < V3::B1Len) TEST_ASSERT_FALSE(V3::decode(buf, len, b1));
+        if (len < V3::LimitsLen) TEST_ASSERT_FALSE(V3::decode(buf, len, lim));
+
+        // Nor a message of another type
+        if (buf[0] != 0xB0) TEST_ASSERT_FALSE(V3::decode(buf, sizeof(buf), b0));
+        if (buf[0] != 0xB1) TEST_ASSERT_FALSE(V3::decode(buf, sizeof(buf), b1));
+        if (buf[0] != 0xBE) TEST_ASSERT_FALSE(V3::decode(buf, sizeof(buf), lim));
+
+        // Encoding into a short buffer writes nothing
+        uint8_t copy[sizeof(buf)];
+        memcpy(copy, buf, sizeof(buf));
+        if (len < V2::WaveLen) TEST_ASSERT_EQUAL(0, V2::encode(V2::Wave{1, 2, 3}, buf, len));
+        if (len < V3::B0Len) TEST_ASSERT_EQUAL(0, V3::encode(V3::B0{}, buf, len));
+        if (len < V3::LimitsLen) TEST_ASSERT_EQUAL(0, V3::encode(V3::Limits{}, buf, len));
+        TEST_ASSERT_EQUAL_MEMORY(copy, buf, sizeof(buf));
+    }
+}
+
+
+TEST_CASE("Codec encode and decode throughput", "[coyote][codec][bench]")
+{
+    static const unsigned N = 1000000;
+
+    TEST::Random rnd(4);
+    uint8_t      buf[V3::B0Len];
+    V3::B0       b0 = {};
+    fill(rnd, b0.freqA, sizeof(b0.freqA));
+    fill(rnd, b0.intB, sizeof(b0.intB));
+
+    int64_t start = RUNTIME::nowInUs();
+    for (unsigned i = 0; i < N; i++) {
+        b0.serial = i;
+        V3::encode(b0, buf, sizeof(buf));
+        TEST::keep(buf);
+    }
+    TEST::report("V3 B0 encode", N, RUNTIME::nowInUs() - start);
+
+    start = RUNTIME::nowInUs();
+    for (unsigned i = 0; i < N; i++) {
+        buf[1] = i;
+        V3::decode(buf, sizeof(buf), b0);
+        TEST::keep(b0);
+    }
+    TEST::report("V3 B0 decode", N, RUNTIME::nowInUs() - start);
+
+    V2::Wave w = {};
+    start = RUNTIME::nowInUs();
+    for (unsigned i = 0; i < N; i++) {
+        V2::encode(V2::Wave{(uint8_t) i, (uint16_t) (i >> 5), (uint8_t) (i >> 15)}, buf, sizeof(buf));
+        V2::decode(buf, sizeof(buf), w);
+        TEST::keep(w);
+    }
+    TEST::report("V2 wave encode + decode", N, RUNTIME::nowInUs() - start);
+}
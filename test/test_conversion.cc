@@ -0,0 +1,102 @@
+
+#include "unity.h"
+#include "test_util.hh"
+
+#include "NimBLE-Device/Coyote.hh"
+
+#include <vector>
+
+
+using namespace NimBLE::COYOTE;
+
+
+//
+// Reference conversion of a V2 pulse period (X + Y) to a V3 frequency, as originally written
+//
+static uint8_t
+refFreq(uint32_t xy)
+{
+    if (xy <= 10)  return 10;
+    if (xy <= 100) return xy;
+    if (xy <= 600) return (xy - 100) / 5 + 100;
+    if (xy <= 1000) return (xy - 600) / 10 + 200;
+    return 240;
+}
+
+
+static V2::Waveform
+randomWave(TEST::Random& rnd, size_t n)
+{
+    V2::Waveform wave;
+    wave.reserve(n);
+    for (size_t i = 0; i < n; i++) wave.push_back(V2::WaveVal(rnd.below(32), rnd.below(1024), rnd.below(32)));
+
+    return wave;
+}
+
+
+TEST_CASE("V2 to V3 conversion matches the reference for every period", "[coyote][conversion]")
+{
+    for (unsigned x = 0; x < 32; x++) {
+        for (unsigned y = 0; y < 1024; y++) {
+            V3::WaveVal v3(V2::WaveVal(x, y, 0));
+            TEST_ASSERT_EQUAL_UINT8(refFreq(x + y), v3.getFreq());
+        }
+    }
+}
+
+
+TEST_CASE("V2 to V3 batch conversion matches the segment conversion", "[coyote][conversion]")
+{
+    TEST::Random rnd;
+    auto         wave = randomWave(rnd, 1000);
+
+    auto out = V3::convert(wave);
+    TEST_ASSERT_EQUAL(wave.size(), out.size());
+
+    for (size_t i = 0; i < wave.size(); i++) {
+        V3::WaveVal one(wave[i]);
+        TEST_ASSERT_EQUAL_UINT8(one.getFreq(), out[i].getFreq());
+        TEST_ASSERT_EQUAL_UINT8(one.getInt(), out[i].getInt());
+        TEST_ASSERT_EQUAL_UINT16(one.getRepeat(), out[i].getRepeat());
+    }
+}
+
+
+TEST_CASE("V2 to V3 batch conversion throughput", "[coyote][conversion][bench]")
+{
+    static const size_t   N      = 1024;
+    static const unsigned PASSES = 200;
+
+    TEST::Random rnd;
+    auto         wave = randomWave(rnd, N);
+    V3::Waveform out(N, V3::WaveVal(10, 0));
+
+    // Segment by segment, through the constructor
+    int64_t start = RUNTIME::nowInUs();
+    for (unsigned p = 0; p < PASSES; p++) {
+        for (size_t i = 0; i < N; i++) out[i] = V3::WaveVal(wave[i]);
+        TEST::keep(out);
+    }
+    TEST::report("V2->V3 segment conversion", N * PASSES, RUNTIME::nowInUs() - start, "segment");
+
+    // In one pass
+    start = RUNTIME::nowInUs();
+    for (unsigned p = 0; p < PASSES; p++) {
+        V3::WaveVal::convert(wave.data(), N, out.data());
+        TEST::keep(out);
+    }
+    TEST::report("V2->V3 batch conversion", N * PASSES, RUNTIME::nowInUs() - start, "segment");
+
+    // Frequencies only, through the branching reference
+    std::vector<uint16_t> periods(N);
+    std::vector<uint8_t>  freqs(N);
+    for (auto& it : periods) it = rnd.below(32) + rnd.below(1024);
+
+    start = RUNTIME::nowInUs();
+    for (unsigned p = 0; p < PASSES; p++) {
+        for (size_t i = 0; i < N; i++) freqs[i] = refFreq(periods[i]);
+        TEST::keep(freqs);
+    }
+    TEST::report("V2->V3 scalar reference (frequency only)", N * PASSES, RUNTIME::nowInUs() - start, "segment");
+}
@@ -0,0 +1,149 @@
+#include "unity.h"
+
+#include "NimBLE-Device/Keyboard.hh"
+
+#include <vector>
+
+
+using namespace NimBLE;
+
+
+//
+// A keyboard recording its gestures, driven on a virtual clock
+//
+struct Recorder {
+    Keyboard::Device dev;
+
+    std::vector<std::pair<uint8_t, Keyboard::Device::Gesture_t>> gestures;
+
+    Recorder()
+        : dev("Test", "Test", NULL)
+        , gestures()
+        {
+            dev.subscribeGestures([this](uint8_t key, Keyboard::Device::Gesture_t g) {gestures.push_back({key, g});});
+        }
+
+    void press(uint8_t key, long ms)   {dev.publish(key, Keyboard::Device::PRESSED, ms);}
+    void release(uint8_t key, long ms) {dev.publish(key, Keyboard::Device::RELEASED, ms);}
+
+    void expect(uint8_t key, Keyboard::Device::Gesture_t g)
+        {
+            TEST_ASSERT_EQUAL(1, gestures.size());
+            TEST_ASSERT_EQUAL(key, gestures[0].first);
+            TEST_ASSERT_EQUAL(g, gestures[0].second);
+            gestures.clear();
+        }
+};
+
+
+TEST_CASE("Keyboard reports a tap once it cannot be a double-tap", "[keyboard]")
+{
+    Recorder r;
+
+    r.press(0x28, 1000);
+    r.release(0x28, 1100);
+    r.dev.serviceGestures(1399);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+
+    r.dev.serviceGestures(1400);
+    r.expect(0x28, Keyboard::Device::TAP);
+
+    r.dev.serviceGestures(5000);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+}
+
+
+TEST_CASE("Keyboard reports a double-tap instead of two taps", "[keyboard]")
+{
+    Recorder r;
+
+    r.press(0x28, 1000);
+    r.release(0x28, 1100);
+    r.press(0x28, 1300);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+    r.release(0x28, 1400);
+    r.expect(0x28, Keyboard::Device::DOUBLE_TAP);
+
+    r.dev.serviceGestures(5000);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+
+    // Too long a gap makes two taps
+    r.press(0x28, 6000);
+    r.release(0x28, 6100);
+    r.press(0x28, 6500);
+    r.expect(0x28, Keyboard::Device::TAP);
+    r.release(0x28, 6600);
+    r.dev.serviceGestures(7000);
+    r.expect(0x28, Keyboard::Device::TAP);
+}
+
+
+TEST_CASE("Keyboard reports a long-press then repeats until released", "[keyboard]")
+{
+    Recorder r;
+
+    r.press(0x29, 1000);
+    r.dev.serviceGestures(1599);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+
+    r.dev.serviceGestures(1600);
+    r.expect(0x29, Keyboard::Device::LONG_PRESS);
+
+    r.dev.serviceGestures(1749);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+    r.dev.serviceGestures(1750);
+    r.expect(0x29, Keyboard::Device::REPEAT);
+    r.dev.serviceGestures(1900);
+    r.expect(0x29, Keyboard::Device::REPEAT);
+
+    // A late service reports a single repeat, and the cadence restarts from there
+    r.dev.serviceGestures(2500);
+    r.expect(0x29, Keyboard::Device::REPEAT);
+    r.dev.serviceGestures(2649);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+
+    r.release(0x29, 2640);
+    r.dev.serviceGestures(5000);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+}
+
+
+TEST_CASE("Keyboard reports nothing for a press between a tap and a long-press", "[keyboard]")
+{
+    Recorder r;
+
+    r.press(0x29, 1000);
+    r.release(0x29, 1400);
+    r.dev.serviceGestures(5000);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+}
+
+
+TEST_CASE("Keyboard reports chords instead of the gestures of their keys", "[keyboard]")
+{
+    Recorder r;
+
+    TEST_ASSERT_FALSE(r.dev.addChord(0x80, {4}));
+    TEST_ASSERT_TRUE(r.dev.addChord(0x80, {4, 5}));
+
+    r.press(4, 1000);
+    r.press(5, 1050);
+    r.expect(0x80, Keyboard::Device::CHORD);
+
+    r.dev.serviceGestures(2000);
+    r.release(4, 2100);
+    r.release(5, 2100);
+    r.dev.serviceGestures(5000);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+
+    // Keys pressed too far apart are not a chord
+    r.press(4, 6000);
+    r.press(5, 6100);
+    r.release(4, 6150);
+    r.release(5, 6150);
+    TEST_ASSERT_EQUAL(0, r.gestures.size());
+    r.dev.serviceGestures(7000);
+    TEST_ASSERT_EQUAL(2, r.gestures.size());
+    TEST_ASSERT_EQUAL(Keyboard::Device::TAP, r.gestures[0].second);
+    TEST_ASSERT_EQUAL(Keyboard::Device::TAP, r.gestures[1].second);
+}
@@ -0,0 +1,136 @@
+#include "unity.h"
+#include "test_util.hh"
+
+#include "NimBLE-Device/LinkProbe.hh"
+
+
+using namespace NimBLE;
+
+
+TEST_CASE("LinkProbe probes periodically and tracks answers", "[linkprobe]")
+{
+    LinkProbe probe;
+    probe.setTiming(500, 250, 2);
+    probe.restart(1000);
+
+    TEST_ASSERT_EQUAL(LinkProbe::WAIT, probe.check(1499));
+    TEST_ASSERT_EQUAL(LinkProbe::PROBE, probe.check(1500));
+    probe.sent(1500);
+    TEST_ASSERT_EQUAL(LinkProbe::WAIT, probe.check(1550));
+
+    probe.answered(true, 1600);
+    TEST_ASSERT_EQUAL(LinkProbe::ANSWERED, probe.check(1610));
+    TEST_ASSERT_EQUAL(1600, probe.getLastHeard());
+
+    // The next probe is due a period after the previous one was sent
+    TEST_ASSERT_EQUAL(LinkProbe::WAIT, probe.check(1999));
+    TEST_ASSERT_EQUAL(LinkProbe::PROBE, probe.check(2000));
+}
+
+
+TEST_CASE("LinkProbe ignores late answers and detects loss", "[linkprobe]")
+{
+    LinkProbe probe;
+    probe.setTiming(500, 250, 2);
+    probe.restart(0);
+
+    // Not answered in time
+    probe.sent(500);
+    TEST_ASSERT_EQUAL(LinkProbe::WAIT, probe.check(750));
+    TEST_ASSERT_EQUAL(LinkProbe::MISSED, probe.check(751));
+
+    // Its late answer does not answer the next probe
+    probe.sent(1000);
+    probe.answered(true, 1010);
+    TEST_ASSERT_EQUAL(LinkProbe::WAIT, probe.check(1020));
+    probe.answered(true, 1100);
+    TEST_ASSERT_EQUAL(LinkProbe::ANSWERED, probe.check(1110));
+    TEST_ASSERT_EQUAL(1100, probe.getLastHeard());
+
+    // An answer arriving late, but before the check, is still missed
+    probe.sent(1500);
+    probe.answered(true, 1800);
+    TEST_ASSERT_EQUAL(LinkProbe::MISSED, probe.check(1810));
+
+    // As is a probe that could not be sent
+    probe.sent(2000);
+    probe.answered(false, 2000);
+    TEST_ASSERT_EQUAL(LinkProbe::LOST, probe.check(2010));
+    TEST_ASSERT_EQUAL(1100, probe.getLastHeard());
+
+    // A new link starts over
+    probe.restart(5000);
+    probe.sent(5500);
+    probe.answered(true, 5550);
+    TEST_ASSERT_EQUAL(LinkProbe::ANSWERED, probe.check(5560));
+}
+
+
+//
+// Latency from the moment a link is lost (e.g. the tag goes out of range) to its detection,
+// by heartbeat and by supervision timeout, whichever is first (heartbeat period 0 for none).
+// The service loop runs every 10 ms and a read is answered in 1 to 2 connection intervals.
+//
+static void
+detection(const char* name, long periodMs, long maxMs, unsigned missed, long intervalMs, long supervisionMs,
+          long& meanMs, long& maxDetectMs)
+{
+    static const unsigned TRIALS = 1000;
+
+    TEST::Random rnd(6);
+    long         sum = 0;
+
+    maxDetectMs = 0;
+    for (unsigned n = 0; n < TRIALS; n++) {
+        LinkProbe probe;
+        probe.setTiming(periodMs, maxMs, missed);
+        probe.restart(0);
+
+        long lossMs   = 5000 + rnd.below(1000);
+        long detectMs = lossMs + supervisionMs;
+        long answerMs = -1;
+
+        for (long now = 0; periodMs > 0 && now < detectMs; now++) {
+            if (answerMs >= 0 && now >= answerMs) {
+                probe.answered(true, now);
+                answerMs = -1;
+            }
+            if (now % 10 != 0) continue;
+
+            auto status = probe.check(now);
+            if (status == LinkProbe::LOST) {
+                detectMs = now;
+                break;
+            }
+            if (status != LinkProbe::PROBE) continue;
+
+            probe.sent(now);
+            long latency = intervalMs + rnd.below(intervalMs + 1);
+            if (now + latency < lossMs) answerMs = now + latency;
+        }
+
+        sum += detectMs - lossMs;
+        if (detectMs - lossMs > maxDetectMs) maxDetectMs = detectMs - lossMs;
+    }
+    meanMs = sum / TRIALS;
+
+    printf("LINK  %-52s mean %5ld ms, max %5ld ms\n", name, meanMs, maxDetectMs);
+}
+
+
+TEST_CASE("LinkProbe loss detection latency against the default connection parameters", "[linkprobe][bench]")
+{
+    long mean[4];
+    long max[4];
+
+    // The iTag defaults: a 50ms interval and a 1s supervision timeout
+    detection("heartbeat 500/250ms x2, 50ms interval, 1s timeout", 500, 250, 2, 50, 1000, mean[0], max[0]);
+    detection("heartbeat 500/250ms x2, default parameters", 500, 250, 2, 50, 2560, mean[1], max[1]);
+    detection("no heartbeat, 1s timeout", 0, 0, 1, 50, 1000, mean[2], max[2]);
+    detection("no heartbeat, default parameters (2.56s timeout)", 0, 0, 1, 50, 2560, mean[3], max[3]);
+
+    // At most 'missed' periods and the answer timeout after the last answer
+    TEST_ASSERT_LESS_OR_EQUAL(2 * 500 + 250 + 10, max[1]);
+    TEST_ASSERT_LESS_THAN(mean[3], mean[1]);
+    TEST_ASSERT_LESS_OR_EQUAL(max[1], max[0]);
+}
@@ -0,0 +1,94 @@
+#include "unity.h"
+#include "test_util.hh"
+
+#include "NimBLE-Device/Proximity.hh"
+
+
+using namespace NimBLE;
+
+
+static const unsigned NUM_TAGS = 50;
+
+
+TEST_CASE("Proximity reports zones with hysteresis for 50 tags", "[proximity]")
+{
+    Proximity prox;
+    auto      tags = TEST::makeDevices("Tag", NUM_TAGS);
+    TEST_ASSERT_EQUAL(NUM_TAGS, tags.size());
+
+    for (auto& it : tags) TEST_ASSERT_TRUE(prox.track(*it));
+
+    TEST::Device extra("Extra");
+    TEST_ASSERT_FALSE(prox.track(extra));
+
+    unsigned events = 0;
+    prox.subscribe([&events](InterestingDevice& dev, Proximity::Zone_t zone, int rssi) {events++;});
+
+    prox.setFilter(Proximity::EMA, 0.5);
+    for (auto& it : tags) TEST_ASSERT_TRUE(prox.report(*it, -50, 1000));
+    for (auto& it : tags) TEST_ASSERT_EQUAL(Proximity::NEAR, prox.getZone(*it));
+    TEST_ASSERT_EQUAL(NUM_TAGS, events);
+
+    // Between the thresholds: no change
+    for (unsigned n = 0; n < 10; n++) {
+        for (auto& it : tags) prox.report(*it, -70, 1100 + n);
+    }
+    for (auto& it : tags) TEST_ASSERT_EQUAL(Proximity::NEAR, prox.getZone(*it));
+    TEST_ASSERT_EQUAL(NUM_TAGS, events);
+
+    for (unsigned n = 0; n < 10; n++) {
+        for (auto& it : tags) prox.report(*it, -90, 1200 + n);
+    }
+    for (auto& it : tags) TEST_ASSERT_EQUAL(Proximity::FAR, prox.getZone(*it));
+    TEST_ASSERT_EQUAL(2 * NUM_TAGS, events);
+
+    // Not heard of for too long
+    prox.service(1209 + 10000);
+    TEST_ASSERT_EQUAL(Proximity::FAR, prox.getZone(*tags[0]));
+    prox.service(1210 + 10000);
+    for (auto& it : tags) TEST_ASSERT_EQUAL(Proximity::LOST, prox.getZone(*it));
+
+    auto stats = prox.getStats(20000);
+    TEST_ASSERT_EQUAL(NUM_TAGS, stats.tracked);
+    TEST_ASSERT_EQUAL(0, stats.connSamples);
+    TEST_ASSERT_EQUAL(21 * NUM_TAGS, stats.advSamples);
+    TEST_ASSERT_EQUAL(3 * NUM_TAGS, stats.events);
+}
+
+
+TEST_CASE("Proximity sampling throughput at 50 tags", "[proximity][bench]")
+{
+    // Ten minutes of tags heard every second, with a service every 100 ms
+    static const long DURATION_MS = 10 * 60 * 1000;
+
+    Proximity    prox;
+    auto         tags = TEST::makeDevices("Tag", NUM_TAGS);
+    TEST::Random rnd(5);
+
+    for (auto& it : tags) prox.track(*it);
+    prox.resetStats(0);
+
+    int rssi[NUM_TAGS];
+    for (auto& it : rssi) it = -40 - rnd.below(50);
+
+    int64_t start = RUNTIME::nowInUs();
+    for (long now = 0; now < DURATION_MS; now += 100) {
+        // A tenth of the tags each time, as they are spread over the second
+        for (unsigned i = (now / 100) % 10; i < NUM_TAGS; i += 10) {
+            rssi[i] += (int) rnd.below(5) - 2;
+            if (rssi[i] > -30) rssi[i] = -30;
+            if (rssi[i] < -100) rssi[i] = -100;
+            prox.report(*tags[i], rssi[i] + (int) rnd.below(9) - 4, now);
+        }
+        prox.service(now);
+    }
+    int64_t us = RUNTIME::nowInUs() - start;
+
+    auto stats = prox.getStats(DURATION_MS);
+    TEST_ASSERT_EQUAL(NUM_TAGS * DURATION_MS / 1000, stats.advSamples);
+    TEST_ASSERT_EQUAL(DURATION_MS / 100, stats.services);
+
+    TEST::report("Proximity sample + service, 50 tags", stats.advSamples, us, "sample");
+    printf("      %.1f samples/sec simulated, %lu zone changes, %.0f samples/sec of CPU\n",
+           stats.samplesPerSec(), stats.events, (us > 0) ? stats.advSamples * 1e6 / us : 0.0);
+}
@@ -0,0 +1,102 @@
+#include "unity.h"
+#include "test_util.hh"
+
+#include "NimBLE-Device/Router.hh"
+
+
+using namespace NimBLE;
+
+
+namespace {
+
+struct Sink {
+    unsigned long count;
+    unsigned long bytes;
+    uint8_t       lastTag;
+
+    void onMessage(const uint8_t* data, size_t len)
+    {
+        count++;
+        bytes += len;
+    }
+
+    void onReport(uint8_t tag, const uint8_t* data, size_t len)
+    {
+        count++;
+        lastTag = tag;
+    }
+};
+
+constexpr Router::Op      sOps[] = {{0xB1, &Router::handler<Sink, &Sink::onMessage>},
+                                    {0xBE, &Router::handler<Sink, &Sink::onMessage>}};
+constexpr Router::OpTable sTable = Router::table(sOps);
+
+}
+
+
+TEST_CASE("Router dispatches by handle and opcode", "[router]")
+{
+    Router router;
+    Sink   ops  = {};
+    Sink   tags = {};
+
+    TEST_ASSERT_TRUE(router.route(0x2A, &ops, sTable));
+    TEST_ASSERT_TRUE(router.route(0x2E, &tags, &Router::taggedHandler<Sink, &Sink::onReport>, 7));
+
+    // Handles beyond the index are found by a linear search
+    TEST_ASSERT_TRUE(router.route(Router::MAX_HANDLES + 10, &tags, &Router::taggedHandler<Sink, &Sink::onReport>, 9));
+
+    uint8_t b1[]     = {0xB1, 0x10, 0x20};
+    uint8_t b0[]     = {0xB0, 0x10};
+    uint8_t report[] = {0x01, 0x02};
+
+    router.dispatch(0x2A, b1, sizeof(b1));
+    router.dispatch(0x2A, b0, sizeof(b0));
+    router.dispatch(0x2A, b1, 0);
+    router.dispatch(0x2B, b1, sizeof(b1));
+    TEST_ASSERT_EQUAL(1, ops.count);
+    TEST_ASSERT_EQUAL(3, ops.bytes);
+
+    router.dispatch(0x2E, report, sizeof(report));
+    TEST_ASSERT_EQUAL(7, tags.lastTag);
+    router.dispatch(Router::MAX_HANDLES + 10, report, sizeof(report));
+    TEST_ASSERT_EQUAL(9, tags.lastTag);
+    TEST_ASSERT_EQUAL(2, tags.count);
+
+    auto stats = router.getStats();
+    TEST_ASSERT_EQUAL(3, stats.dispatched);
+    TEST_ASSERT_EQUAL(2, stats.dropped);
+    TEST_ASSERT_EQUAL(1, stats.unknown);
+
+    // Routes are bounded, and cleared together
+    for (unsigned i = 3; i < Router::MAX_ROUTES; i++) TEST_ASSERT_TRUE(router.route(0x40 + i, &ops, sTable));
+    TEST_ASSERT_FALSE(router.route(0x50, &ops, sTable));
+
+    router.clear();
+    router.dispatch(0x2A, b1, sizeof(b1));
+    TEST_ASSERT_EQUAL(1, ops.count);
+}
+
+
+TEST_CASE("Router dispatch throughput through an opcode table", "[router][bench]")
+{
+    static const unsigned long N = 1000000;
+
+    Router router;
+    Sink   sink = {};
+    router.route(0x2A, &sink, sTable);
+
+    uint8_t msg[4] = {0xB1, 0x10, 0x20, 0x30};
+
+    int64_t start = RUNTIME::nowInUs();
+    for (unsigned long i = 0; i < N; i++) {
+        msg[0] = (i & 1) ? 0xB1 : 0xBE;
+        router.dispatch(0x2A, msg, sizeof(msg));
+    }
+    int64_t us = RUNTIME::nowInUs() - start;
+
+    TEST::keep(sink);
+    TEST_ASSERT_EQUAL(N, sink.count);
+
+    TEST::report("Router dispatch, opcode table", N, us, "notification");
+}
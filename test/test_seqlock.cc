@@ -0,0 +1,88 @@
+#include "unity.h"
+#include "test_util.hh"
+
+#include "NimBLE-Device/Seqlock.hh"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+using namespace NimBLE;
+
+
+namespace {
+
+//
+// All fields are derived from 'a', so a torn copy is detected
+//
+struct Record {
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+    uint16_t d;
+    bool     e;
+};
+
+
+void
+set(Record& r, uint32_t i)
+{
+    r.a = i;
+    r.b = ~i;
+    r.c = i * 3;
+    r.d = i ^ 0x5555;
+    r.e = i & 1;
+}
+
+
+bool
+isCoherent(const Record& r)
+{
+    uint16_t i = r.a;
+
+    return r.b == (uint16_t) ~i && r.c == (uint16_t) (i * 3) && r.d == (uint16_t) (i ^ 0x5555) && r.e == (bool) (i & 1);
+}
+
+}
+
+
+TEST_CASE("Seqlock readers never see a torn record", "[seqlock]")
+{
+    static const unsigned WRITERS = 2;
+    static const unsigned READERS = 3;
+    static const uint32_t UPDATES = 200000;     // Per writer
+
+    Seqlock<Record>            lock;
+    std::atomic<bool>          stop(false);
+    std::atomic<unsigned long> reads(0);
+    std::atomic<unsigned long> torn(0);
+    std::vector<std::thread>   threads;
+
+    int64_t start = RUNTIME::nowInUs();
+
+    for (unsigned w = 0; w < WRITERS; w++) {
+        threads.emplace_back([&lock] {
+            for (uint32_t i = 0; i < UPDATES; i++) lock.update([i](Record& r) { set(r, i); });
+        });
+    }
+    for (unsigned r = 0; r < READERS; r++) {
+        threads.emplace_back([&] {
+            while (!stop) {
+                if (!isCoherent(lock.read())) torn++;
+                reads++;
+            }
+        });
+    }
+
+    for (unsigned w = 0; w < WRITERS; w++) threads[w].join();
+    stop = true;
+    for (unsigned r = WRITERS; r < threads.size(); r++) threads[r].join();
+
+    TEST::report("Seqlock update, 2 writers and 3 readers", WRITERS * UPDATES, RUNTIME::nowInUs() - start, "update");
+
+    TEST_ASSERT_EQUAL(0, torn.load());
+    TEST_ASSERT_GREATER_THAN(0, reads.load());
+    TEST_ASSERT_EQUAL(WRITERS * UPDATES, lock.version());
+    TEST_ASSERT_TRUE(isCoherent(lock.read()));
+}
@@ -0,0 +1,86 @@
+#include "unity.h"
+#include "test_util.hh"
+
+
+using namespace NimBLE;
+
+
+#ifdef CONFIG_NIMBLE_DEVICE_STATIC_ALLOC
+static const unsigned NUM_DEVICES = CONFIG_NIMBLE_DEVICE_MAX_DEVICES;
+#else
+static const unsigned NUM_DEVICES = 8;
+#endif
+
+static const unsigned STOP_MS = 5;      // Time to write the zero power, e.g. a write with response
+
+
+//
+// A connected device whose zero-power write blocks for STOP_MS
+//
+class Stoppable : public TEST::Device
+{
+public:
+    Stoppable(const char* name)
+        : TEST::Device(name)
+        , mLatched(false)
+        , mStopped(false)
+        {}
+
+    virtual bool isConnected()  override
+        {
+            return true;
+        }
+
+    bool mLatched;
+    bool mStopped;
+
+protected:
+    virtual bool latchStop()  override
+        {
+            mLatched = true;
+            return true;
+        }
+
+    virtual bool sendStop()  override
+        {
+            vTaskDelay(pdMS_TO_TICKS(STOP_MS));
+            mStopped = true;
+            return true;
+        }
+
+    virtual void releaseStop()  override
+        {
+            mLatched = false;
+        }
+};
+
+
+TEST_CASE("Emergency stop latency with a full device pool", "[stop][bench]")
+{
+    auto devs = TEST::makeDevices<Stoppable>("Stop", NUM_DEVICES);
+    TEST_ASSERT_EQUAL(NUM_DEVICES, devs.size());
+
+    for (auto& it : devs) TEST_ASSERT_TRUE(InterestingDevice::addToDevicePool(it.get()));
+
+    auto before = InterestingDevice::getStopStats();
+
+    TEST_ASSERT_EQUAL(NUM_DEVICES, InterestingDevice::emergencyStop());
+    TEST_ASSERT_TRUE(InterestingDevice::isEmergencyStopped());
+
+    auto stats = InterestingDevice::getStopStats();
+    TEST_ASSERT_EQUAL(before.stops + 1, stats.stops);
+    TEST_ASSERT_EQUAL(NUM_DEVICES, stats.devices);
+    TEST_ASSERT_EQUAL(0, stats.failed);
+    for (auto& it : devs) TEST_ASSERT_TRUE(it->mLatched && it->mStopped);
+
+    // The writes are issued one after the other: the last device waits for all the others
+    TEST_ASSERT_GREATER_OR_EQUAL(NUM_DEVICES * STOP_MS * 1000, stats.lastUs);
+
+    InterestingDevice::clearEmergencyStop();
+    TEST_ASSERT_FALSE(InterestingDevice::isEmergencyStopped());
+    for (auto& it : devs) TEST_ASSERT_FALSE(it->mLatched);
+
+    TEST::report("Emergency stop, 5 ms writes", NUM_DEVICES, stats.maxUs, "device");
+    printf("      worst case %ld us for %u devices (%u ms of writes)\n", stats.maxUs, NUM_DEVICES,
+           NUM_DEVICES * STOP_MS);
+}
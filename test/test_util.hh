@@ -0,0 +1,120 @@
+//
+// NimBLE-Device test helpers
+//
+// Copyright (c) 2024 ltx4jay@yahoo.com
+//
+// Licensed under MIT License
+//
+//
+// The code is provided as-is, with no warranties of any kind. Not suitable for any purpose.
+// Provided as an example and exercise in BLE development only.
+//
+
+#pragma once
+
+
+#include "NimBLE-Device.hh"
+#include "Runtime.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+
+namespace TEST {
+
+//
+// Report a benchmark result
+//
+inline void
+report(const char* name, unsigned long n, int64_t us, const char* unit = "op")
+{
+    printf("BENCH %-40s %10lu %s in %8ld us: %8.1f ns/%s\n", name, n, unit, (long) us,
+           (n > 0) ? us * 1000.0 / n : 0.0, unit);
+}
+
+
+//
+// Keep the optimizer from discarding a result
+//
+template<class T>
+inline void
+keep(const T& val)
+{
+    asm volatile("" : : "g"(&val) : "memory");
+}
+
+
+//
+// Deterministic pseudo-random numbers (xorshift32), for fuzzing
+//
+class Random
+{
+public:
+    Random(uint32_t seed = 0x12345678)
+        : mState((seed) ? seed : 1)
+        {}
+
+    uint32_t next()
+        {
+            mState ^= mState << 13;
+            mState ^= mState >> 17;
+            mState ^= mState << 5;
+            return mState;
+        }
+
+    uint32_t below(uint32_t n)
+        {
+            return next() % n;
+        }
+
+private:
+    uint32_t mState;
+};
+
+
+//
+// A device that is never connected, for tests of the device pool and its helpers
+//
+class Device : public NimBLE::InterestingDevice
+{
+public:
+    Device(const char* name)
+        : InterestingDevice(name, "Dummy", NULL)
+        {}
+
+    virtual void serviceLoop(long nowInMs)  override
+        {}
+
+private:
+    virtual bool doInitDevice()  override
+        {
+            return true;
+        }
+};
+
+
+static const unsigned MAX_DEVICES = 64;
+
+//
+// Create 'n' devices named "<prefix><index>", 'prefix' followed by 0 to n - 1.
+// Returns no devices if 'n' is more than MAX_DEVICES.
+//
+template<class DEV = Device>
+inline std::vector<std::unique_ptr<DEV>>
+makeDevices(const char* prefix, unsigned n)
+{
+    std::vector<std::unique_ptr<DEV>> devs;
+    if (n > MAX_DEVICES) return devs;
+
+    for (unsigned i = 0; i < n; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s%u", prefix, i);
+        devs.emplace_back(new DEV(name));
+    }
+
+    return devs;
+}
+
+}